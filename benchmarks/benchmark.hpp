@@ -0,0 +1,53 @@
+#ifndef CPPBOT_BENCHMARK_HPP
+#define CPPBOT_BENCHMARK_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// Helpers of benchmarks: every case is a function of iteration number returning some value,
+// values are summed into a checksum, so the compiler can't throw the measured work away.
+
+namespace benchmark
+{
+  inline size_t& checksum()
+  {
+    static size_t value = 0;
+    return value;
+  }
+
+  inline void report(const std::string& name, double nanosecondsPerOp)
+  {
+    std::cout << std::left << std::setw(56) << name << std::right << std::fixed << std::setprecision(1)
+      << std::setw(12) << nanosecondsPerOp << " ns/op\n";
+  }
+
+  template< class F >
+  double run(const std::string& name, size_t iterations, F&& function)
+  {
+    size_t sum = 0;
+    for (size_t i = 0; i < iterations / 10; ++i)
+    {
+      sum += function(i);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+      sum += function(i);
+    }
+    std::chrono::duration< double, std::nano > elapsed = std::chrono::steady_clock::now() - start;
+    checksum() += sum;
+    double result = elapsed.count() / static_cast< double >(iterations);
+    report(name, result);
+    return result;
+  }
+
+  inline void finish()
+  {
+    std::cout << "checksum: " << checksum() << '\n';
+  }
+}
+
+#endif
@@ -0,0 +1,127 @@
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "benchmark.hpp"
+#include "cppbot/handlers.hpp"
+#include "cppbot/states.hpp"
+
+// Dispatch of messages in default state at several rates of messages missing all command handlers:
+// MessageHandler against the lookups with at() and catching std::out_of_range used before it.
+
+namespace
+{
+  constexpr size_t CHATS = 100000;
+  constexpr size_t COMMANDS = 50;
+  constexpr size_t ITERATIONS = 1000000;
+
+  // Dispatch path of the old MessageHandler::processMessage and StateMachine::getState
+  class OldDispatcher
+  {
+   public:
+    using handler_t = std::function< void(const types::Message&) >;
+
+    void addHandler(const std::string& cmd, handler_t handler)
+    {
+      cmdHandlers_[cmd] = handler;
+    }
+
+    void processMessage(const types::Message& msg) const
+    {
+      std::string cmd;
+      for (size_t i = 0; (i < msg.text.size()) && (msg.text[i] != ' '); ++i)
+      {
+        cmd += msg.text[i];
+      }
+      if (getState(msg.chat.id) == states::StateMachine::DEFAULT_STATE)
+      {
+        try
+        {
+          cmdHandlers_.at(cmd)(msg);
+        }
+        catch (const std::exception&)
+        {}
+      }
+    }
+   private:
+    std::unordered_map< std::string, handler_t > cmdHandlers_;
+    std::unordered_map< size_t, states::State > currentStates_;
+
+    states::State getState(size_t chatId) const
+    {
+      try
+      {
+        return currentStates_.at(chatId);
+      }
+      catch (const std::out_of_range&)
+      {
+        return states::StateMachine::DEFAULT_STATE;
+      }
+    }
+  };
+
+  std::vector< types::Message > makeMessages(size_t missPercent)
+  {
+    std::vector< types::Message > messages(CHATS);
+    for (size_t i = 0; i < CHATS; ++i)
+    {
+      messages[i].chat.id = i;
+      if (i % 100 < missPercent)
+      {
+        messages[i].text = "just some text";
+      }
+      else
+      {
+        messages[i].text = "/command" + std::to_string(i % COMMANDS) + " argument";
+      }
+    }
+    return messages;
+  }
+}
+
+int main()
+{
+  size_t calls = 0;
+  OldDispatcher oldDispatcher;
+  handlers::MessageHandler messageHandler;
+  for (size_t i = 0; i < COMMANDS; ++i)
+  {
+    std::string cmd = "/command" + std::to_string(i);
+    oldDispatcher.addHandler(cmd, [&calls](const types::Message&)
+    {
+      ++calls;
+    });
+    messageHandler.addHandler(cmd, [&calls](const types::Message&)
+    {
+      ++calls;
+    });
+  }
+  messageHandler.setFallbackHandler([&calls](const types::Message&, states::StateContext&)
+  {
+    ++calls;
+  });
+  states::StateMachine stateMachine(std::make_shared< states::Storage >());
+
+  std::cout << COMMANDS << " commands, " << CHATS << " chats in default state\n";
+  for (size_t missPercent : {0, 10, 50, 90})
+  {
+    std::vector< types::Message > messages = makeMessages(missPercent);
+    std::string suffix = ", " + std::to_string(missPercent) + "% misses";
+    benchmark::run("at() + catch (old)" + suffix, ITERATIONS / 10, [&](size_t i)
+    {
+      oldDispatcher.processMessage(messages[i % CHATS]);
+      return calls;
+    });
+    benchmark::run("MessageHandler::processMessage" + suffix, ITERATIONS, [&](size_t i)
+    {
+      const types::Message& msg = messages[i % CHATS];
+      states::StateContext context(msg.chat.id, &stateMachine);
+      messageHandler.processMessage(msg, context);
+      return calls;
+    });
+  }
+  benchmark::finish();
+  return 0;
+}
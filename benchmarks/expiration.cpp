@@ -0,0 +1,69 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <boost/any.hpp>
+#include "benchmark.hpp"
+#include "cppbot/states.hpp"
+
+// Cost of expiration and of the limit of chats on access to Storage, and a check that a chat expired
+// but not swept yet comes back empty and is reported as evicted.
+
+namespace
+{
+  constexpr size_t CHATS = 1000000;
+  constexpr size_t ITERATIONS = 2000000;
+
+  bool checkExpiredChat()
+  {
+    states::State form;
+    std::atomic< size_t > evicted(0);
+    states::Storage storage(1);
+    storage.setExpiration(std::chrono::milliseconds(100));
+    storage.setEvictionHandler([&evicted](size_t)
+    {
+      ++evicted;
+    });
+    storage.setState(1, form);
+    storage.data(1, form) = std::string("old answer");
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    storage.state(1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    // Sweep sees the chat accessed after queuing and moves it to the front instead of deleting
+    storage.setState(2, form);
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    // The chat is expired now, but sweeping stops at it because it was queued recently
+    storage.setState(1, form);
+    return (evicted == 1) && storage.data(1, form).empty();
+  }
+}
+
+int main()
+{
+  if (!checkExpiredChat())
+  {
+    std::cerr << "Expired chat wasn't reset on access\n";
+    return 1;
+  }
+  states::State state;
+  states::Storage plain;
+  states::Storage limited;
+  limited.setExpiration(std::chrono::hours(1));
+  limited.setMaxChats(CHATS / 2);
+
+  std::cout << CHATS << " chats, the limit is " << CHATS / 2 << '\n';
+  benchmark::run("setState() without limits", ITERATIONS, [&](size_t i)
+  {
+    size_t chatId = (i * 7919) % CHATS;
+    plain.setState(chatId, state);
+    return chatId;
+  });
+  benchmark::run("setState() with expiration and the limit", ITERATIONS, [&](size_t i)
+  {
+    size_t chatId = (i * 7919) % CHATS;
+    limited.setState(chatId, state);
+    return chatId;
+  });
+  benchmark::finish();
+  return 0;
+}
@@ -0,0 +1,152 @@
+#include <functional>
+#include <memory>
+#include <regex>
+#include <unordered_set>
+#include <vector>
+#include "benchmark.hpp"
+#include "cppbot/filters.hpp"
+
+// Choosing the first matching filter for a mix of messages: Filter compiled into alternatives with
+// bit tests against the same conditions combined as plain functions and checked in the written order.
+
+namespace
+{
+  constexpr size_t MESSAGES = 10000;
+  constexpr size_t ITERATIONS = 1000000;
+
+  using check_t = std::function< bool(const types::Message&) >;
+
+  check_t both(check_t lhs, check_t rhs)
+  {
+    return [lhs, rhs](const types::Message& msg)
+    {
+      return lhs(msg) && rhs(msg);
+    };
+  }
+
+  check_t negation(check_t check)
+  {
+    return [check](const types::Message& msg)
+    {
+      return !check(msg);
+    };
+  }
+
+  check_t regex(const std::string& pattern)
+  {
+    auto expression = std::make_shared< const std::regex >(pattern, std::regex::ECMAScript | std::regex::optimize);
+    return [expression](const types::Message& msg)
+    {
+      return std::regex_search(msg.text, *expression);
+    };
+  }
+
+  check_t chatType(types::Chat::Type type)
+  {
+    return [type](const types::Message& msg)
+    {
+      return msg.chat.type == type;
+    };
+  }
+
+  check_t idIn(const std::vector< size_t >& ids, bool isChat)
+  {
+    auto set = std::make_shared< const std::unordered_set< size_t > >(ids.cbegin(), ids.cend());
+    return [set, isChat](const types::Message& msg)
+    {
+      return set->count(isChat ? msg.chat.id : msg.from.id) != 0;
+    };
+  }
+
+  std::vector< types::Message > makeMessages()
+  {
+    std::vector< types::Message > messages(MESSAGES);
+    for (size_t i = 0; i < MESSAGES; ++i)
+    {
+      types::Message& msg = messages[i];
+      msg.from.id = i % 1000;
+      msg.chat.id = i % 500;
+      switch (i % 10)
+      {
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+          msg.chat.type = types::Chat::PRIVATE;
+          msg.photo.resize(1);
+          msg.photo[0].fileId = "photo";
+          break;
+        case 4:
+        case 5:
+        case 6:
+          msg.chat.type = types::Chat::PRIVATE;
+          msg.text = (i % 3 == 0) ? "hello, I have a question about delivery" : "where is my parcel?";
+          break;
+        case 7:
+        case 8:
+          msg.chat.type = types::Chat::GROUP;
+          msg.text = (i % 4 == 0) ? "status of order #" + std::to_string(i) : "thanks, everything is fine";
+          break;
+        default:
+          msg.chat.type = types::Chat::PRIVATE;
+          msg.text = "/start";
+      }
+    }
+    return messages;
+  }
+}
+
+int main()
+{
+  using handlers::Filter;
+  std::vector< size_t > admins = {1, 2, 3};
+  std::vector< size_t > vipChats = {10, 20, 30};
+
+  std::vector< Filter > filters = {
+    Filter::regex("order #[0-9]+") && Filter::chatType(types::Chat::GROUP),
+    Filter::content(Filter::PHOTO | Filter::DOCUMENT) && Filter::fromUsers(admins),
+    Filter::regex("^(hi|hello)") && Filter::chatType(types::Chat::PRIVATE) && !Filter::content(Filter::COMMAND),
+    Filter::inChats(vipChats) && Filter::content(Filter::VIDEO)
+  };
+  std::vector< check_t > checks = {
+    both(regex("order #[0-9]+"), chatType(types::Chat::GROUP)),
+    both([](const types::Message& msg)
+    {
+      return !msg.photo.empty() || !msg.document.fileId.empty();
+    }, idIn(admins, false)),
+    both(both(regex("^(hi|hello)"), chatType(types::Chat::PRIVATE)), negation([](const types::Message& msg)
+    {
+      return !msg.text.empty() && (msg.text.front() == '/');
+    })),
+    both(idIn(vipChats, true), [](const types::Message& msg)
+    {
+      return !msg.video.fileId.empty();
+    })
+  };
+  std::vector< types::Message > messages = makeMessages();
+
+  std::cout << filters.size() << " filters, 40% photos, 30% private texts, 20% group texts, 10% commands\n";
+  benchmark::run("functions in written order", ITERATIONS, [&](size_t i)
+  {
+    const types::Message& msg = messages[i % MESSAGES];
+    size_t index = 0;
+    while ((index < checks.size()) && !checks[index](msg))
+    {
+      ++index;
+    }
+    return index;
+  });
+  benchmark::run("Filter with features computed once", ITERATIONS, [&](size_t i)
+  {
+    const types::Message& msg = messages[i % MESSAGES];
+    uint32_t features = Filter::features(msg);
+    size_t index = 0;
+    while ((index < filters.size()) && !filters[index].matches(msg, features))
+    {
+      ++index;
+    }
+    return index;
+  });
+  benchmark::finish();
+  return 0;
+}
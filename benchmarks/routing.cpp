@@ -0,0 +1,91 @@
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "benchmark.hpp"
+#include "cppbot/handlers.hpp"
+#include "cppbot/routing.hpp"
+
+// Lookup of callback data among partial match handlers: radix trie against the scan of std::map
+// used by CallbackQueryHandler before it.
+
+namespace
+{
+  constexpr size_t PREFIXES = 10000;
+  constexpr size_t ITERATIONS = 1000000;
+
+  using handler_t = std::function< void(const types::CallbackQuery&) >;
+
+  // Loop of the old CallbackQueryHandler::processCallbackQuery
+  size_t scanMap(const std::map< std::string, handler_t >& handlers, const types::CallbackQuery& query)
+  {
+    size_t found = 0;
+    auto it = handlers.cbegin();
+    while ((it != handlers.cend()) && (query.data[0] <= (*it).first[0]))
+    {
+      if (((*it).first.size() <= query.data.size()) && (query.data.find((*it).first) == 0))
+      {
+        (*it).second(query);
+        ++found;
+      }
+      ++it;
+    }
+    return found;
+  }
+}
+
+int main()
+{
+  size_t calls = 0;
+  handler_t handler = [&calls](const types::CallbackQuery&)
+  {
+    ++calls;
+  };
+
+  std::vector< types::CallbackQuery > queries(PREFIXES);
+  std::map< std::string, handler_t > map;
+  handlers::detail::PrefixTrie< handler_t > trie;
+  handlers::CallbackQueryHandler allPrefixes;
+  handlers::CallbackQueryHandler longestPrefix;
+  longestPrefix.setPartialMatchMode(handlers::CallbackQueryHandler::LONGEST_PREFIX);
+  for (size_t i = 0; i < PREFIXES; ++i)
+  {
+    std::string prefix = "item:" + std::to_string(i) + ':';
+    map[prefix] = handler;
+    trie[prefix] = handler;
+    allPrefixes.addHandler(prefix, handler, true);
+    longestPrefix.addHandler(prefix, handler, true);
+    queries[(i * 7919) % PREFIXES].data = prefix + "open:42";
+  }
+
+  std::cout << PREFIXES << " callback data prefixes\n";
+  benchmark::run("std::map scan (old)", ITERATIONS / 100, [&](size_t i)
+  {
+    return scanMap(map, queries[i % PREFIXES]);
+  });
+  benchmark::run("PrefixTrie::forEachPrefix", ITERATIONS, [&](size_t i)
+  {
+    size_t found = 0;
+    trie.forEachPrefix(queries[i % PREFIXES].data, [&found](const handler_t&)
+    {
+      ++found;
+    });
+    return found;
+  });
+  benchmark::run("PrefixTrie::findLongestPrefix", ITERATIONS, [&](size_t i)
+  {
+    return static_cast< size_t >(trie.findLongestPrefix(queries[i % PREFIXES].data) != nullptr);
+  });
+  benchmark::run("CallbackQueryHandler, all prefixes", ITERATIONS, [&](size_t i)
+  {
+    allPrefixes.processCallbackQuery(queries[i % PREFIXES]);
+    return calls;
+  });
+  benchmark::run("CallbackQueryHandler, longest prefix", ITERATIONS, [&](size_t i)
+  {
+    longestPrefix.processCallbackQuery(queries[i % PREFIXES]);
+    return calls;
+  });
+  benchmark::finish();
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/any.hpp>
+#include "benchmark.hpp"
+#include "cppbot/states.hpp"
+
+// Lookups made while handling one message (state of the chat, then data of the state) in random chats:
+// Storage keeping both in one session against the two node-based hash maps used before it.
+// Usage: cppbot-benchmark-sessions [number of chats]
+
+namespace
+{
+  constexpr size_t DEFAULT_CHATS = 1000000;
+  constexpr size_t ITERATIONS = 5000000;
+  constexpr size_t STATES = 8;
+
+  // Layout of the old Storage
+  struct OldStorage
+  {
+    std::unordered_map< size_t, states::State > currentStates;
+    std::unordered_map< size_t, std::unordered_map< states::State, boost::any > > data;
+  };
+
+  size_t nextRandom(size_t& seed)
+  {
+    // xorshift64
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  size_t chats = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_CHATS;
+  if (chats == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [number of chats]\n";
+    return 1;
+  }
+  std::vector< states::State > states(STATES);
+  states::Storage storage;
+  OldStorage oldStorage;
+  for (size_t chatId = 0; chatId < chats; ++chatId)
+  {
+    const states::State& state = states[chatId % STATES];
+    storage.setState(chatId, state);
+    storage.data(chatId, state) = chatId;
+    oldStorage.currentStates.insert_or_assign(chatId, state);
+    oldStorage.data[chatId][state] = chatId;
+  }
+  std::vector< size_t > chatIds(ITERATIONS);
+  size_t seed = 0x9e3779b97f4a7c15ULL;
+  for (size_t& chatId : chatIds)
+  {
+    chatId = nextRandom(seed) % chats;
+  }
+
+  std::cout << chats << " chats\n";
+  benchmark::run("two unordered_maps (old)", ITERATIONS, [&](size_t i)
+  {
+    size_t chatId = chatIds[i];
+    auto it = oldStorage.currentStates.find(chatId);
+    states::State state = (it == oldStorage.currentStates.end()) ? states::StateMachine::DEFAULT_STATE : it->second;
+    return boost::any_cast< size_t >(oldStorage.data[chatId][state]);
+  });
+  benchmark::run("Storage sessions", ITERATIONS, [&](size_t i)
+  {
+    size_t chatId = chatIds[i];
+    return boost::any_cast< size_t >(storage.data(chatId, storage.state(chatId)));
+  });
+  benchmark::finish();
+  return 0;
+}
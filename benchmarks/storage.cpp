@@ -0,0 +1,119 @@
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "benchmark.hpp"
+#include "cppbot/states.hpp"
+
+// Concurrent access to states of millions of chats from 1 to 32 threads (90% reads, 10% writes):
+// sharded Storage against std::unordered_map guarded by one std::shared_mutex.
+// Time is wall time of all threads divided by the total number of operations.
+// Usage: cppbot-benchmark-storage [number of chats]
+
+namespace
+{
+  constexpr size_t DEFAULT_CHATS = 2000000;
+  constexpr size_t OPERATIONS = 4000000; ///< Total number of operations of all threads
+
+  class LockedMap
+  {
+   public:
+    states::State state(size_t chatId) const
+    {
+      std::shared_lock< std::shared_mutex > lock(mutex_);
+      auto it = states_.find(chatId);
+      return (it == states_.cend()) ? states::StateMachine::DEFAULT_STATE : it->second;
+    }
+
+    void setState(size_t chatId, const states::State& state)
+    {
+      std::unique_lock< std::shared_mutex > lock(mutex_);
+      states_.insert_or_assign(chatId, state);
+    }
+   private:
+    std::unordered_map< size_t, states::State > states_;
+    mutable std::shared_mutex mutex_;
+  };
+
+  size_t nextRandom(size_t& seed)
+  {
+    // xorshift64
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+  }
+
+  template< class S >
+  double measure(S& storage, size_t chats, size_t threads, const states::State& state)
+  {
+    std::vector< std::thread > workers;
+    std::vector< size_t > sums(threads, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < threads; ++t)
+    {
+      workers.emplace_back([&storage, &sums, &state, chats, threads, t]()
+      {
+        size_t seed = 0x9e3779b97f4a7c15ULL * (t + 1);
+        size_t sum = 0;
+        for (size_t i = 0; i < OPERATIONS / threads; ++i)
+        {
+          size_t random = nextRandom(seed);
+          size_t chatId = random % chats;
+          if ((random >> 32) % 10 == 0)
+          {
+            storage.setState(chatId, state);
+          }
+          else
+          {
+            sum += storage.state(chatId).id();
+          }
+        }
+        sums[t] = sum;
+      });
+    }
+    for (std::thread& worker : workers)
+    {
+      worker.join();
+    }
+    std::chrono::duration< double, std::nano > elapsed = std::chrono::steady_clock::now() - start;
+    for (size_t sum : sums)
+    {
+      benchmark::checksum() += sum;
+    }
+    return elapsed.count() / static_cast< double >(OPERATIONS);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  size_t chats = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_CHATS;
+  if (chats == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [number of chats]\n";
+    return 1;
+  }
+  states::State first;
+  states::State second;
+  states::Storage storage;
+  LockedMap lockedMap;
+  for (size_t chatId = 0; chatId < chats; ++chatId)
+  {
+    storage.setState(chatId, first);
+    lockedMap.setState(chatId, first);
+  }
+
+  std::cout << chats << " chats, " << std::thread::hardware_concurrency() << " hardware threads\n";
+  for (size_t threads : {1, 2, 4, 8, 16, 32})
+  {
+    std::string suffix = ", " + std::to_string(threads) + " threads";
+    benchmark::report("unordered_map + shared_mutex" + suffix, measure(lockedMap, chats, threads, second));
+    benchmark::report("Storage" + suffix, measure(storage, chats, threads, second));
+  }
+  benchmark::finish();
+  return 0;
+}
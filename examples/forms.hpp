@@ -1,14 +1,15 @@
 #ifndef STATES_HPP
 #define STATES_HPP
 
+#include <string>
 #include "cppbot/states.hpp"
 
 namespace forms
 {
   struct RegistrationForm: public states::StatesForm
   {
-    states::State username;
-    states::State age;
+    states::Field< std::string > username;
+    states::Field< std::string > age;
     states::State country;
   } registrationForm;
 }
@@ -15,26 +15,25 @@ void startRegistration(const types::Message& msg)
 
 void processUsername(const types::Message& msg, states::StateContext& state)
 {
-  state.data(state.current()) = msg.text; // set state context data for current state (registration.username)
+  state.get(forms::registrationForm.username) = msg.text; // set typed value of the field
   app::bot.sendMessage(msg.chat.id, "Great! Now enter your age:");
   state.setState(forms::registrationForm.age); // set next state
 }
 
 void processAge(const types::Message& msg, states::StateContext& state)
 {
-  state.data(state.current()) = msg.text;
+  state.get(forms::registrationForm.age) = msg.text;
   app::bot.sendMessage(msg.chat.id, "Last question, what's your country?");
   state.setState(forms::registrationForm.country);
 }
 
 void finishRegistration(const types::Message& msg, states::StateContext& state)
 {
-  auto data = state.data(); // get all current data fields
   std::string text = "Successfull registration! Please check all fields are right:\n\n";
 
   // Now we can read fields that write before
-  text += "Username: " + boost::any_cast< std::string >(data[forms::registrationForm.username]) + '\n';
-  text += "Age: " + boost::any_cast< std::string >(data[forms::registrationForm.age]) + '\n';
+  text += "Username: " + state.get(forms::registrationForm.username) + '\n';
+  text += "Age: " + state.get(forms::registrationForm.age) + '\n';
   text += "Country: " + msg.text;
 
   state.resetState(); // Don't forget to reset the state to default
@@ -0,0 +1,170 @@
+/*!
+  @file
+  @brief Header contains compact binary codec for typed callback data.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_CALLBACK_DATA_HPP
+#define CPPBOT_CALLBACK_DATA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace handlers
+{
+  namespace detail
+  {
+    /// First character of encoded callback data, other data is handled as plain string.
+    constexpr char CALLBACK_DATA_PREFIX = '~';
+
+    /// Maximum size of callback data allowed by Telegram.
+    constexpr size_t MAX_CALLBACK_DATA_SIZE = 64;
+
+    /// Maximum size of binary data (action id and fields) fitting into callback data.
+    constexpr size_t MAX_CALLBACK_PAYLOAD_SIZE = (MAX_CALLBACK_DATA_SIZE - 1) * 3 / 4;
+
+    std::string encodeBase64Url(const uint8_t* data, size_t size);
+
+    /*!
+      @brief Decodes base64url without padding.
+      @return Number of decoded bytes or 0 if data is invalid or doesn't fit into the buffer
+    */
+    size_t decodeBase64Url(std::string_view data, uint8_t* buffer, size_t capacity);
+  }
+
+  /*!
+    @brief Archive packing fields of callback data.
+
+    Unsigned integers and enums are written as varints, signed ones as zigzag varints,
+    strings with their length.
+  */
+  class CallbackDataWriter
+  {
+   public:
+    CallbackDataWriter(uint8_t actionId);
+
+    template< class T >
+    CallbackDataWriter& operator&(const T& value)
+    {
+      if constexpr (std::is_same_v< T, bool >)
+      {
+        writeVarint(value ? 1 : 0);
+      }
+      else if constexpr (std::is_enum_v< T >)
+      {
+        writeVarint(static_cast< uint64_t >(value));
+      }
+      else if constexpr (std::is_integral_v< T > && std::is_signed_v< T >)
+      {
+        writeSigned(static_cast< int64_t >(value));
+      }
+      else if constexpr (std::is_integral_v< T >)
+      {
+        writeVarint(static_cast< uint64_t >(value));
+      }
+      else
+      {
+        static_assert(std::is_same_v< T, std::string >, "Unsupported type of callback data field");
+        writeString(value);
+      }
+      return *this;
+    }
+
+    /*!
+      @brief Method allows to get callback data for a button.
+      @throw std::length_error if encoded data is longer than 64 bytes
+    */
+    std::string str() const;
+   private:
+    std::string bytes_;
+
+    void writeVarint(uint64_t value);
+    void writeSigned(int64_t value);
+    void writeString(const std::string& value);
+  };
+
+  /*!
+    @brief Archive unpacking fields of callback data, it never throws.
+
+    If data is damaged, fields are left as they are and isValid() returns false.
+  */
+  class CallbackDataReader
+  {
+   public:
+    CallbackDataReader(const uint8_t* data, size_t size);
+
+    template< class T >
+    CallbackDataReader& operator&(T& value)
+    {
+      uint64_t raw = 0;
+      if constexpr (std::is_same_v< T, bool >)
+      {
+        value = readVarint(raw) && (raw != 0);
+      }
+      else if constexpr (std::is_enum_v< T >)
+      {
+        if (readVarint(raw))
+        {
+          value = static_cast< T >(raw);
+        }
+      }
+      else if constexpr (std::is_integral_v< T > && std::is_signed_v< T >)
+      {
+        int64_t signedRaw = 0;
+        if (readSigned(signedRaw))
+        {
+          value = static_cast< T >(signedRaw);
+        }
+      }
+      else if constexpr (std::is_integral_v< T >)
+      {
+        if (readVarint(raw))
+        {
+          value = static_cast< T >(raw);
+        }
+      }
+      else
+      {
+        static_assert(std::is_same_v< T, std::string >, "Unsupported type of callback data field");
+        readString(value);
+      }
+      return *this;
+    }
+
+    /// Method checks if all fields were read and no bytes are left.
+    bool isValid() const;
+   private:
+    const uint8_t* data_;
+    size_t size_;
+    bool isValid_;
+
+    bool readVarint(uint64_t& value);
+    bool readSigned(int64_t& value);
+    bool readString(std::string& value);
+  };
+
+  /*!
+    @brief Function packs action into callback data of inline keyboard button.
+
+    Action is a struct with static constexpr uint8_t ID and method
+    template< class Archive > void serialize(Archive& ar) { ar & field1 & field2; }
+    @param action Action
+    @return Callback data
+    @throw std::length_error if encoded data is longer than 64 bytes
+  */
+  template< class Action >
+  std::string encodeCallbackData(Action action)
+  {
+    CallbackDataWriter writer(Action::ID);
+    action.serialize(writer);
+    return writer.str();
+  }
+}
+
+#endif
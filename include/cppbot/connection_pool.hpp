@@ -0,0 +1,98 @@
+/*!
+  @file
+  @brief Header contains pool of keep-alive TLS connections to Telegram servers.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_CONNECTION_POOL_HPP
+#define CPPBOT_CONNECTION_POOL_HPP
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+
+namespace cppbot
+{
+  /*!
+    @brief Class keeps established TLS connections to one host and gives them to requests.
+
+    Connection is returned to the pool after a response allowing keep-alive was read,
+    so next requests skip resolving, TCP connect and TLS handshake.
+  */
+  class ConnectionPool
+  {
+   public:
+    using stream_t = boost::asio::ssl::stream< boost::asio::ip::tcp::socket >;
+    using connection_t = std::shared_ptr< stream_t >;
+    using handler_t = std::function< void(const boost::system::error_code&, connection_t, bool) >;
+    using phase_handler_t = std::function< void(const char* phase, std::chrono::steady_clock::time_point start) >;
+
+    /*!
+      @param ioContext Context running connections
+      @param sslContext Context for TLS streams
+      @param host Host to connect to
+      @param port Port to connect to
+      @param maxIdle Maximum number of idle connections kept in the pool
+    */
+    ConnectionPool(boost::asio::io_context& ioContext, boost::asio::ssl::context& sslContext,
+      const std::string& host, const std::string& port, size_t maxIdle = 8);
+
+    /*!
+      @brief Method gives idle connection or establishes a new one.
+      @param handler Callback receiving error code, connection and flag showing it was taken from the pool
+      @param allowReuse If false, a new connection is always established
+      @param onPhase Callback called when resolving, TCP connect and TLS handshake of a new connection are finished
+    */
+    void acquire(handler_t handler, bool allowReuse = true, phase_handler_t onPhase = nullptr);
+
+    /*!
+      @brief Method returns connection to the pool.
+      @param connection Connection which is ready for the next request
+    */
+    void release(connection_t connection);
+
+    /*!
+      @brief Method closes connection which can't be used anymore (after errors or "Connection: close").
+      @param connection Connection given by acquire()
+    */
+    void discard(connection_t connection);
+
+    /// Method allows to get number of idle connections.
+    size_t idle() const;
+
+    /// Method allows to get number of connections given to requests at the moment.
+    size_t active() const;
+
+    /// Method closes all idle connections.
+    void clear();
+   private:
+    struct IdleConnection
+    {
+      connection_t connection;
+      std::chrono::steady_clock::time_point since;
+    };
+
+    boost::asio::io_context& ioContext_;
+    boost::asio::ssl::context& sslContext_;
+    std::string host_;
+    std::string port_;
+    size_t maxIdle_;
+    std::deque< IdleConnection > idle_;
+    size_t active_;
+    mutable std::mutex mutex_;
+
+    void connect(handler_t handler, phase_handler_t onPhase);
+  };
+}
+
+#endif
@@ -13,6 +13,7 @@
 #define CPPBOT_HPP
 
 #include <iostream>
+#include <functional>
 #include <future>
 #include <thread>
 #include <string>
@@ -21,13 +22,27 @@
 #include <condition_variable>
 #include <memory>
 #include <utility>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
 
 #include <nlohmann/json.hpp>
 #include <boost/asio/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <boost/beast.hpp>
 #include <boost/beast/http.hpp>
 
 #include "types.hpp"
+#include "multipart.hpp"
+#include "file_cache.hpp"
+#include "connection_pool.hpp"
+#include "download.hpp"
+#include "dispatcher.hpp"
+#include "monitor.hpp"
+#include "metrics.hpp"
+#include "tracer.hpp"
+#include "logger.hpp"
 #include "handlers.hpp"
 #include "states.hpp"
 
@@ -45,6 +60,9 @@ namespace cppbot
     using futureMessage = std::future< types::Message >;
     using futureFile = std::future< types::File >;
     using futureBool = std::future< bool >;
+    using futureSize = std::future< size_t >;
+    using futureMessages = std::future< std::vector< types::Message > >;
+    using futureMessageIds = std::future< std::vector< types::MessageId > >;
 
     /*!
       @param token Unique token for telegram bot
@@ -55,6 +73,12 @@ namespace cppbot
     Bot(const std::string& token, std::shared_ptr< handlers::MessageHandler > mh,
       std::shared_ptr< handlers::CallbackQueryHandler > qh, std::shared_ptr< states::Storage > storage);
 
+    /*!
+      @brief Destructor stops the bot (see stop()).
+      @warning Bot must not be destroyed from its own handler.
+    */
+    ~Bot();
+
     /*!
       @brief Method for starting polling.
     */
@@ -62,9 +86,92 @@ namespace cppbot
 
     /*!
       @brief Method for stopping polling.
+
+      It waits until handlers running on workers finish, so they can still send requests and log.
+      Called from a handler, it doesn't wait for that handler.
     */
     void stop();
 
+    /*!
+      @brief Method enables sending files with kernel TLS offload.
+
+      Works only on Linux when the library is built with CPPBOT_ENABLE_KTLS option.
+      Each upload then uses its own blocking connection on one of the bot's upload threads and file content
+      is passed to the kernel with sendfile(). If kernel or OpenSSL can't offload TLS, files are sent
+      in the usual way. stop() waits for started uploads.
+      @param enable Enable or disable zero-copy uploads
+    */
+    void setZeroCopyUploads(bool enable);
+
+    /*!
+      @brief Method enables reusing file_id of already uploaded files.
+
+      Before uploading a file bot looks for it in the cache and sends cached file_id instead.
+      After successful upload file_id from returned message is saved in the cache.
+      @param cache Shared pointer to FileIdCache (nullptr disables caching)
+    */
+    void setFileCache(std::shared_ptr< FileIdCache > cache);
+
+    /*!
+      @brief Method enables handling updates on worker threads.
+
+      Updates of one chat are handled in order, updates of different chats are handled in parallel,
+      so a blocking handler stalls only its chat. Handlers and middlewares must be thread-safe.
+      Call it before startPolling().
+      @param workers Number of worker threads, 0 handles all updates in the polling thread (default)
+      @param maxQueued Maximum number of waiting updates, polling pauses when it is reached
+      @param maxQueuedPerChat Maximum number of waiting updates of one chat, newer updates are dropped
+      @throw std::logic_error if it's called from a handler running on a worker
+    */
+    void setWorkers(size_t workers, size_t maxQueued = 10000, size_t maxQueuedPerChat = 100);
+
+    /*!
+      @brief Method enables measuring handlers latency.
+
+      Every update handling (with middlewares) is measured and grouped by command, state or callback data.
+      @param monitor Shared pointer to Monitor (nullptr disables measuring)
+    */
+    void setMonitor(std::shared_ptr< Monitor > monitor);
+
+    /*!
+      @brief Method enables collecting metrics of the bot.
+
+      Bot counts requests to Telegram by endpoint (latency, HTTP statuses, Telegram error codes, sent bytes),
+      received updates, handlers latency, and exports queue depths and connection pool usage as gauges.
+      Call it before startPolling().
+      @param metrics Shared pointer to Metrics (nullptr disables collecting)
+    */
+    void setMetrics(std::shared_ptr< Metrics > metrics);
+
+    /*!
+      @brief Method starts HTTP endpoint /metrics for scraping metrics by Prometheus.
+
+      Endpoint is served by the bot's network thread, so it works only while polling.
+      If metrics weren't set with setMetrics(), new registry is created.
+      @param port Port to listen
+      @param address Address to listen
+    */
+    void serveMetrics(unsigned short port, const std::string& address = "0.0.0.0");
+
+    /*!
+      @brief Method enables tracing of updates.
+
+      Spans of sampled updates (ingest, queue wait, handler, requests sent by the handler with their phases)
+      are kept in the tracer and can be exported with Tracer::chromeTrace(). Call it before startPolling().
+      @param tracer Shared pointer to Tracer (nullptr disables tracing)
+    */
+    void setTracer(std::shared_ptr< Tracer > tracer);
+
+    /*!
+      @brief Method replaces logger of the bot.
+
+      By default errors are written to std::cerr by AsyncLogger, so network and handling threads
+      don't wait for the output. Call it before startPolling().
+      @param logger Shared pointer to AsyncLogger (with nullptr records of the bot are dropped, while
+        the dispatcher and the metrics server write errors to std::cerr at once)
+    */
+    void setLogger(std::shared_ptr< AsyncLogger > logger);
+
     /*!
       @brief Async method for sending text messages.
       @param chatId Chat id
@@ -85,6 +192,43 @@ namespace cppbot
     */
     futureBool    deleteMessage        (size_t chatId, size_t messageId);
 
+    /*!
+      @brief Async method for deleting several messages of one chat.
+
+      Messages are deleted with one request per 100 ids. Messages which can't be found are skipped.
+      @param chatId Chat id
+      @param messageIds Ids of messages
+      @return std::future< bool >
+    */
+    futureBool    deleteMessages       (size_t chatId, const std::vector< size_t >& messageIds);
+
+    /*!
+      @brief Async method for forwarding several messages with one request per 100 ids.
+      @param chatId Id of chat where messages are forwarded
+      @param fromChatId Id of chat where messages were sent
+      @param messageIds Ids of messages
+      @return std::future< std::vector< types::MessageId > > with ids of new messages
+    */
+    futureMessageIds forwardMessages   (size_t chatId, size_t fromChatId, const std::vector< size_t >& messageIds);
+
+    /*!
+      @brief Async method for copying several messages with one request per 100 ids.
+      @param chatId Id of chat where messages are copied
+      @param fromChatId Id of chat where messages were sent
+      @param messageIds Ids of messages
+      @return std::future< std::vector< types::MessageId > > with ids of new messages
+    */
+    futureMessageIds copyMessages      (size_t chatId, size_t fromChatId, const std::vector< size_t >& messageIds);
+
+    /*!
+      @brief Method enables merging deleteMessage calls into deleteMessages requests.
+
+      deleteMessage calls for the same chat made within {window} are sent as one request,
+      every returned future gets result of this request.
+      @param window Time to wait for other calls, zero disables batching
+    */
+    void setDeleteBatching(std::chrono::milliseconds window);
+
     /*!
       @brief Async method for answer callback queries.
       @param queryId Query id
@@ -143,6 +287,17 @@ namespace cppbot
     futureMessage sendVideo             (size_t chatId, const types::InputFile& video, const std::string& caption = "",
       const types::InlineKeyboardMarkup& replyMarkup = {}, bool hasSpoiler = false);
 
+    /*!
+      @brief Async method for sending an album of photos, videos, documents or audio with one request.
+
+      If Telegram refuses a cached file_id, files are uploaded again, unless some of them is produced
+      by generator: it can't be read twice, so the error is returned.
+      @param chatId Chat id
+      @param media From 2 to 10 media to be sent (documents and audio can't be mixed with other types)
+      @return std::future< std::vector< types::Message > > with sent messages
+    */
+    futureMessages sendMediaGroup       (size_t chatId, const std::vector< types::InputMedia >& media);
+
     /*!
       @brief Async method for editing message text.
       @param chatId Chat id
@@ -192,6 +347,18 @@ namespace cppbot
     */
     futureFile    getFile               (const std::string& fileId);
 
+    /*!
+      @brief Async method for downloading file content.
+
+      Content is streamed to the sink in chunks over pooled connections, so memory usage doesn't
+      depend on file size. Several downloads can run at the same time. If the sink has non-zero offset,
+      only the rest of the file is requested.
+      @param file File info with filePath (see getFile)
+      @param sink Destination for file content
+      @return std::future< size_t > with number of bytes written to the sink
+    */
+    futureSize    downloadFile          (const types::File& file, DownloadSink sink);
+
     /*!
       @brief Method for getting .
       @param fileId File id
@@ -199,136 +366,239 @@ namespace cppbot
     */
     states::StateContext getStateContext(size_t chatId);
    private:
+    struct PendingDeletes
+    {
+      std::vector< size_t > messageIds;
+      std::vector< std::shared_ptr< std::promise< bool > > > promises;
+      std::shared_ptr< asio::steady_timer > timer;
+    };
+
     std::string token_;
     std::shared_ptr< handlers::MessageHandler > mh_;
     std::shared_ptr< handlers::CallbackQueryHandler > qh_;
     asio::io_context ioContext_;
     asio::ssl::context sslContext_;
     std::thread ioThread_;
-    std::queue< types::Message > messageQueue_;
-    std::queue< types::CallbackQuery > queryQueue_;
+    template< class Update >
+    struct QueuedUpdate
+    {
+      Update update;
+      size_t updateId;
+      std::chrono::steady_clock::time_point since;
+    };
+
+    std::queue< QueuedUpdate< types::Message > > messageQueue_;
+    std::queue< QueuedUpdate< types::CallbackQuery > > queryQueue_;
     std::mutex updateMutex_;
     std::condition_variable updateCondition_;
     states::StateMachine stateMachine_;
+    ConnectionPool pool_;
     bool isRunning_;
+    bool zeroCopyUploads_;
+    std::shared_ptr< FileIdCache > fileCache_;
+    std::unique_ptr< Dispatcher > dispatcher_;
+    std::shared_ptr< Monitor > monitor_;
+    struct Instruments;
+    std::shared_ptr< Instruments > instruments_;
+    std::unique_ptr< MetricsServer > metricsServer_;
+    std::shared_ptr< Tracer > tracer_;
+    std::shared_ptr< AsyncLogger > logger_;
+    std::chrono::milliseconds deleteBatchWindow_;
+    std::unordered_map< size_t, PendingDeletes > pendingDeletes_;
+    std::mutex deleteMutex_;
+    // Declared last: it's joined first on destruction, while everything used by uploads still exists
+    std::unique_ptr< asio::thread_pool > uploadPool_;
 
     void runIoContext();
     void fetchUpdates();
     void processUpdates();
+    void handleMessage(const QueuedUpdate< types::Message >& queued);
+    void handleCallbackQuery(const QueuedUpdate< types::CallbackQuery >& queued);
+
+    using response_handler_t = std::function< void(bool, const nlohmann::json&) >;
 
     futureMessage sendFile(const types::InputFile& file, const std::string& fileType,
       const nlohmann::json& fields);
     futureMessage updateFile(const types::InputMedia& media, const nlohmann::json& fields);
-
-    void printError(const std::string& errorMessage) const;
-
+    void sendCachedFile(const std::string& endpoint, const std::string& fileType, const std::string& partName,
+      const types::InputFile& file, const nlohmann::json& fields, const nlohmann::json::json_pointer& idField,
+      response_handler_t handler);
+    void uploadFile(const std::string& endpoint, const std::string& partName, const types::InputFile& file,
+      const nlohmann::json& fields, response_handler_t handler);
+    void uploadMediaGroup(size_t chatId, const std::vector< types::InputMedia >& media,
+      const std::vector< std::string >& cacheKeys, bool useCache, response_handler_t handler);
+    std::shared_ptr< http::request< multipart::Body > > makeMultipartRequest(const std::string& endpoint,
+      multipart::Form form);
+    void sendMultipart(std::shared_ptr< http::request< multipart::Body > > req, response_handler_t handler);
+    void handleResponse(boost::beast::string_view target, std::chrono::steady_clock::time_point start,
+      unsigned status, const std::string& body, const response_handler_t& handler) const;
+    void observeSent(boost::beast::string_view target, size_t bytes) const;
+    void observeFailure(boost::beast::string_view target, const std::string& error) const;
+    void traceRequest(const Tracer::Context& trace, const char* phase, boost::beast::string_view target,
+      std::chrono::steady_clock::time_point start) const;
+    ConnectionPool::phase_handler_t tracePhases(const Tracer::Context& trace, boost::beast::string_view target) const;
+
+    void sendInBatches(const std::string& endpoint, const nlohmann::json& fields, std::vector< size_t > messageIds,
+      response_handler_t handler);
+    void flushDeletes(size_t chatId);
+
+    struct DownloadData;
+    void startDownload(std::shared_ptr< DownloadData > download, bool allowReuse);
+    void readDownloadChunk(std::shared_ptr< DownloadData > download);
+    void finishDownload(std::shared_ptr< DownloadData > download, const std::string& error);
+
+    void log(LogLevel level, const std::string& message, LogFields fields = {}) const;
+
+    template< typename Body >
     struct RequestData
     {
-      std::string body;
-      std::string endpoint;
-      std::vector< std::pair< http::field, std::string > > additionalHeaders;
-      std::string contentType;
-      std::shared_ptr< asio::ip::tcp::resolver > resolver;
-      std::shared_ptr < asio::ssl::stream<asio::ip::tcp::socket> > socket;
-      std::shared_ptr< http::request< http::string_body > > req;
+      ConnectionPool::connection_t connection;
+      std::shared_ptr< http::request< Body > > req;
       std::shared_ptr< http::response<http::string_body> > res;
       std::shared_ptr< boost::beast::flat_buffer > buffer;
+      std::chrono::steady_clock::time_point start;
+      Tracer::Context trace;
     };
 
+    template< typename Body >
+    std::shared_ptr< http::request< Body > > makeRequest(const std::string& endpoint, const std::string& contentType)
+    {
+      auto req = std::make_shared< http::request< Body > >(http::verb::post, "/bot" + token_ + endpoint, 11);
+      req->set(http::field::host, "api.telegram.org");
+      req->set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+      req->set(http::field::content_type, contentType);
+      return req;
+    }
+
     template< typename T >
     std::future< T > sendRequest(const std::string& body, const std::string& endpoint,
       const std::vector< std::pair< http::field, std::string > >& additionalHeaders = {},
       const std::string& contentType = "application/json")
     {
-      auto data = std::make_shared< RequestData >();
+      auto req = makeRequest< http::string_body >(endpoint, contentType);
+      for (const auto& header : additionalHeaders)
+      {
+        req->set(header.first, header.second);
+      }
+      req->body() = body;
+      req->prepare_payload();
+      return sendRequest< T >(req);
+    }
 
-      data->body = body;
-      data->endpoint = endpoint;
-      data->additionalHeaders = additionalHeaders;
-      data->contentType = contentType;
-      data->resolver = std::make_shared< asio::ip::tcp::resolver >(ioContext_);
-      data->socket = std::make_shared< asio::ssl::stream< asio::ip::tcp::socket > >(ioContext_, sslContext_);
+    template< typename T >
+    static void completePromise(std::promise< T >& promise, bool isOk, const nlohmann::json& result)
+    {
+      if (!isOk)
+      {
+        promise.set_exception(std::make_exception_ptr(std::runtime_error("Correct message wasn't received")));
+        return;
+      }
+      try
+      {
+        promise.set_value(result.template get< T >());
+      }
+      catch (...)
+      {
+        promise.set_exception(std::current_exception());
+      }
+    }
 
+    template< typename T, typename Body >
+    std::future< T > sendRequest(std::shared_ptr< http::request< Body > > req)
+    {
       auto promise = std::make_shared< std::promise< T > >();
       std::future< T > future = promise->get_future();
+      performRequest(req, [promise](bool isOk, const nlohmann::json& result)
+      {
+        completePromise(*promise, isOk, result);
+      });
+      return future;
+    }
+
+    template< typename Body >
+    static bool isReplayable(const http::request< Body >&)
+    {
+      return true;
+    }
+
+    static bool isReplayable(const http::request< multipart::Body >& req)
+    {
+      return req.body().isReplayable();
+    }
 
-      if (!SSL_set_tlsext_host_name(data->socket->native_handle(), "api.telegram.org"))
+    template< typename Body >
+    void performRequest(std::shared_ptr< http::request< Body > > req, response_handler_t handler,
+      bool allowReuse = true, std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now(),
+      Tracer::Context trace = Tracer::current())
+    {
+      // Body produced by generator can't be written twice, so it never goes to a reused connection
+      // and isn't repeated when the connection turns out to be closed
+      allowReuse = allowReuse && isReplayable(*req);
+      pool_.acquire([this, req, handler, start, trace](const boost::system::error_code& ec,
+        ConnectionPool::connection_t connection, bool isReused)
       {
-        printError("Problems with SSL");
-        promise->set_exception(std::make_exception_ptr(std::runtime_error("Correct message wasn't received")));
-      }
-      data->resolver->async_resolve("api.telegram.org", "443",
-        [this, data, promise](auto ec, auto endpoints)
+        if (ec)
+        {
+          observeFailure(req->target(), ec.message());
+          handler(false, nullptr);
+          return;
+        }
+        auto data = std::make_shared< RequestData< Body > >();
+        data->connection = connection;
+        data->req = req;
+        data->buffer = std::make_shared< boost::beast::flat_buffer >();
+        data->res = std::make_shared< http::response< http::string_body > >();
+        data->start = start;
+        data->trace = trace;
+        auto writeStart = std::chrono::steady_clock::now();
+        http::async_write(*(data->connection), *(data->req), [this, data, handler, isReused, writeStart](auto ec,
+          auto bytes)
         {
           if (ec)
           {
-            printError(ec.message());
-            promise->set_exception(std::make_exception_ptr(std::runtime_error("Correct message wasn't received")));
+            pool_.discard(data->connection);
+            if (isReused)
+            {
+              // Server has closed idle connection, request is repeated with a new one
+              performRequest(data->req, handler, false, data->start, data->trace);
+              return;
+            }
+            observeFailure(data->req->target(), ec.message());
+            handler(false, nullptr);
             return;
           }
-          async_connect(data->socket->next_layer(), endpoints, [this, data, promise](auto ec, auto)
+          observeSent(data->req->target(), bytes);
+          traceRequest(data->trace, "write", data->req->target(), writeStart);
+          auto readStart = std::chrono::steady_clock::now();
+          http::async_read(*(data->connection), *(data->buffer), *(data->res), [this, handler, data, isReused,
+            readStart](auto ec, auto)
           {
             if (ec)
             {
-              printError(ec.message());
-              promise->set_exception(std::make_exception_ptr(std::runtime_error("Correct message wasn't received")));
-              return;
-            }
-            data->socket->async_handshake(asio::ssl::stream_base::client, [this, data, promise](auto ec)
-            {
-              if (ec)
+              pool_.discard(data->connection);
+              if (isReused && (ec == http::error::end_of_stream))
               {
-                printError(ec.message());
-                promise->set_exception(std::make_exception_ptr(std::runtime_error("Correct message wasn't received")));
+                performRequest(data->req, handler, false, data->start, data->trace);
                 return;
               }
-              std::string host = "api.telegram.org";
-              std::string path = "/bot" + token_ + data->endpoint;
-              auto req = std::make_shared< http::request< http::string_body > >(http::verb::post, path, 11);
-              req->set(http::field::host, host);
-              req->set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
-              req->set(http::field::content_type, data->contentType);
-              for (const auto& header : data->additionalHeaders)
-              {
-                req->set(header.first, header.second);
-              }
-              req->body() = data->body;
-              req->prepare_payload();
-              data->req = req;
-              http::async_write(*(data->socket), *(data->req), [this, data, promise](auto ec, auto)
-              {
-                if (ec)
-                {
-                  printError(ec.message());
-                  promise->set_exception(std::make_exception_ptr(std::runtime_error("Correct message wasn't received")));
-                  return;
-                }
-                auto buffer = std::make_shared< boost::beast::flat_buffer >();
-                auto res = std::make_shared< http::response< http::string_body > >();
-                data->buffer = buffer;
-                data->res = res;
-                http::async_read(*(data->socket), *(data->buffer), *(data->res), [this, promise, data](auto ec, auto)
-                {
-                  if (ec)
-                  {
-                    printError(ec.message());
-                    promise->set_exception(std::make_exception_ptr(std::runtime_error("Correct message wasn't received")));
-                    return;
-                  }
-                  nlohmann::json response = nlohmann::json::parse(data->res->body());
-                  if (!response["ok"])
-                  {
-                    printError(response["description"].dump());
-                    promise->set_exception(std::make_exception_ptr(std::runtime_error("Correct message wasn't received")));
-                    return;
-                  }
-                  promise->set_value(response["result"].template get< T >());
-                });
-              });
-            });
+              observeFailure(data->req->target(), ec.message());
+              handler(false, nullptr);
+              return;
+            }
+            if (data->res->keep_alive())
+            {
+              pool_.release(data->connection);
+            }
+            else
+            {
+              pool_.discard(data->connection);
+            }
+            traceRequest(data->trace, "read", data->req->target(), readStart);
+            traceRequest(data->trace, "request", data->req->target(), data->start);
+            handleResponse(data->req->target(), data->start, data->res->result_int(), data->res->body(), handler);
           });
         });
-      return future;
+      }, allowReuse, tracePhases(trace, req->target()));
     }
   };
 }
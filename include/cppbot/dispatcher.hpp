@@ -0,0 +1,109 @@
+/*!
+  @file
+  @brief Header contains dispatcher running handlers of different chats in parallel.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_DISPATCHER_HPP
+#define CPPBOT_DISPATCHER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "logger.hpp"
+
+namespace cppbot
+{
+  /*!
+    @brief Class runs update handlers on worker threads.
+
+    Updates of one chat are handled one by one in order of receiving, updates of different chats
+    are handled in parallel. So a handler waiting for a future or doing its own I/O stalls only its chat.
+  */
+  class Dispatcher
+  {
+   public:
+    using task_t = std::function< void() >;
+
+    /*!
+      @param workers Number of worker threads (maximum number of handlers running at the same time)
+      @param maxQueued Maximum number of waiting updates, submit() blocks when it is reached
+      @param maxQueuedPerChat Maximum number of waiting updates of one chat, newer updates are dropped
+    */
+    Dispatcher(size_t workers, size_t maxQueued = 10000, size_t maxQueuedPerChat = 100);
+
+    /*!
+      @brief Destructor stops workers and joins them.
+      @warning It must not be called from a handler running on a worker: the worker would use the destroyed
+      dispatcher after the handler returns, so the process is terminated.
+    */
+    ~Dispatcher();
+
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+
+    /*!
+      @brief Method adds handler of an update to the queue of its chat.
+      @param chatId Chat id
+      @param task Function handling the update
+      @return false if update was dropped (chat queue is full or dispatcher is stopped)
+    */
+    bool submit(size_t chatId, task_t task);
+
+    /*!
+      @brief Method stops workers and waits until running handlers finish, waiting updates are dropped.
+
+      Called from a handler, it doesn't wait for that handler (and for other handlers stopping the dispatcher).
+    */
+    void stop();
+
+    /// Method checks if it's called from a handler running on a worker of the dispatcher.
+    bool isWorker() const;
+
+    /// Method allows to get number of waiting updates.
+    size_t queued() const;
+
+    /// Method allows to get number of handlers running at the moment.
+    size_t active() const;
+
+    /*!
+      @brief Method sets logger for exceptions thrown by handlers. Call it before submitting updates.
+      @param logger Shared pointer to AsyncLogger (nullptr writes them to std::cerr)
+    */
+    void setLogger(std::shared_ptr< AsyncLogger > logger);
+   private:
+    struct ChatQueue
+    {
+      std::deque< task_t > tasks;
+      bool isRunning = false;
+    };
+
+    size_t maxQueued_;
+    size_t maxQueuedPerChat_;
+    std::unordered_map< size_t, ChatQueue > chats_;
+    std::deque< size_t > readyChats_;
+    size_t queued_;
+    size_t active_;
+    size_t running_; ///< Workers which haven't exited yet
+    size_t stopping_; ///< Handlers waiting in stop()
+    bool isStopped_;
+    mutable std::mutex mutex_;
+    std::condition_variable taskCondition_;
+    std::condition_variable spaceCondition_;
+    std::condition_variable exitCondition_;
+    std::vector< std::thread > workers_;
+    std::shared_ptr< AsyncLogger > logger_;
+
+    void work();
+  };
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*!
+  @file
+  @brief Header contains destinations for downloaded files.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_DOWNLOAD_HPP
+#define CPPBOT_DOWNLOAD_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace cppbot
+{
+  /*!
+    @brief Class represents a place where downloaded file content is written chunk by chunk.
+
+    Only one chunk of a file is kept in memory at a time, except for the buffer sink.
+  */
+  class DownloadSink
+  {
+   public:
+    using chunk_handler_t = std::function< void(const char* data, size_t size) >;
+
+    /*!
+      @param path Path to a file for saving content
+      @param resume If true and file already exists, download continues from its end
+    */
+    DownloadSink(const std::string& path, bool resume = false);
+
+    /*!
+      @param fd Opened file descriptor, content is written at its current position
+      @param offset Number of bytes already written there (download continues from this byte)
+    */
+    DownloadSink(int fd, size_t offset = 0);
+
+    /*!
+      @param buffer String where content is appended
+    */
+    DownloadSink(std::shared_ptr< std::string > buffer);
+
+    /*!
+      @param handler Callback receiving every chunk of content
+      @param offset Number of bytes received earlier (download continues from this byte)
+    */
+    DownloadSink(chunk_handler_t handler, size_t offset = 0);
+
+    /// Method allows to get position from which download starts.
+    size_t offset() const;
+
+    /*!
+      @brief Method writes next chunk of content.
+      @param data Chunk bytes
+      @param size Chunk size
+    */
+    void write(const char* data, size_t size);
+   private:
+    chunk_handler_t handler_;
+    size_t offset_;
+  };
+}
+
+#endif
@@ -0,0 +1,87 @@
+/*!
+  @file
+  @brief Header contains cache of Telegram file ids for already uploaded files.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_FILE_CACHE_HPP
+#define CPPBOT_FILE_CACHE_HPP
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "types.hpp"
+
+namespace cppbot
+{
+  /*!
+    @brief Class remembers file_id of uploaded files, so the same content is not uploaded twice.
+
+    Bot looks up every InputFile before uploading it. If the file was already sent,
+    its file_id is sent instead of multipart body.
+  */
+  class FileIdCache
+  {
+   public:
+    /// Way of identifying files.
+    enum KeyMode
+    {
+      METADATA,    ///< Path, modification time and size (cheap, doesn't read a file)
+      CONTENT_HASH ///< SHA-256 of file content (finds identical files with different paths)
+    };
+
+    /*!
+      @param mode Way of identifying files
+      @param persistencePath Path to a file for saving cache between restarts, empty for in-memory cache
+    */
+    FileIdCache(KeyMode mode = METADATA, const std::string& persistencePath = "");
+
+    /*!
+      @brief Method allows to get cache key of a file.
+      @param fileType Type of media ("photo", "document", "audio" or "video")
+      @param file File to be uploaded
+      @return Key for find() and store() methods
+      @warning In-memory files are always identified by content, files with generator can't be cached
+    */
+    std::string key(const std::string& fileType, const types::InputFile& file) const;
+
+    /*!
+      @brief Method allows to find file_id by cache key.
+      @param key Cache key
+      @return file_id or empty string if file wasn't uploaded yet
+    */
+    std::string find(const std::string& key) const;
+
+    /*!
+      @brief Method saves file_id of uploaded file.
+      @param key Cache key
+      @param fileId Telegram file id
+    */
+    void store(const std::string& key, const std::string& fileId);
+
+    /*!
+      @brief Method deletes file_id from cache (e.g. when Telegram doesn't accept it anymore).
+      @param key Cache key
+    */
+    void remove(const std::string& key);
+
+    /// Method deletes all cached file ids.
+    void clear();
+   private:
+    KeyMode mode_;
+    std::string persistencePath_;
+    std::ofstream journal_;
+    std::unordered_map< std::string, std::string > fileIds_;
+    mutable std::mutex mutex_;
+
+    void load();
+    void append(const std::string& key, const std::string& fileId);
+  };
+}
+
+#endif
@@ -0,0 +1,123 @@
+/*!
+  @file
+  @brief Header contains filters for choosing messages to handle.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_FILTERS_HPP
+#define CPPBOT_FILTERS_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "types.hpp"
+
+namespace handlers
+{
+  /*!
+    @brief Class represents a condition on a message.
+
+    Filters are combined with &&, || and !. Combination is compiled into a list of alternatives,
+    each of them checks bits of message features first and calls predicates (regex, allow-lists,
+    custom functions) only if the bits match. Features are computed once per message.
+  */
+  class Filter
+  {
+   public:
+    using predicate_t = std::function< bool(const types::Message&) >;
+
+    /// Content of a message.
+    enum Content: uint32_t
+    {
+      TEXT = 1 << 0,     ///< Non-empty text
+      COMMAND = 1 << 1,  ///< Text starting with '/'
+      PHOTO = 1 << 2,
+      DOCUMENT = 1 << 3,
+      AUDIO = 1 << 4,
+      VIDEO = 1 << 5
+    };
+
+    /*!
+      @brief Filter matching messages with certain content.
+      @param content One or several Content values combined with '|' (any of them matches)
+    */
+    static Filter content(uint32_t content);
+
+    /*!
+      @brief Filter matching messages from chats of certain type.
+      @param type Chat type
+    */
+    static Filter chatType(types::Chat::Type type);
+
+    /*!
+      @brief Filter matching messages whose text contains a match of regular expression.
+      @param pattern ECMAScript regular expression
+    */
+    static Filter regex(const std::string& pattern);
+
+    /*!
+      @brief Filter matching messages sent by certain users.
+      @param userIds Allowed user ids
+    */
+    static Filter fromUsers(const std::vector< size_t >& userIds);
+
+    /*!
+      @brief Filter matching messages sent to certain chats.
+      @param chatIds Allowed chat ids
+    */
+    static Filter inChats(const std::vector< size_t >& chatIds);
+
+    /*!
+      @brief Filter calling custom function.
+      @param predicate Function returning true for matching messages
+    */
+    static Filter predicate(predicate_t predicate);
+
+    /// Filter matching all messages.
+    static Filter any();
+
+    /*!
+      @brief Method computes features of a message checked by filters.
+      @param msg Message
+      @return Bitmask of features
+    */
+    static uint32_t features(const types::Message& msg);
+
+    /*!
+      @brief Method checks if message matches the filter.
+      @param msg Message
+      @param features Features of the message computed by features()
+    */
+    bool matches(const types::Message& msg, uint32_t features) const;
+
+    bool operator()(const types::Message& msg) const;
+
+    friend Filter operator&&(const Filter& lhs, const Filter& rhs);
+    friend Filter operator||(const Filter& lhs, const Filter& rhs);
+    friend Filter operator!(const Filter& filter);
+   private:
+    // Conjunction: all required bits are set, all forbidden bits are unset and all predicates are true
+    struct Term
+    {
+      uint32_t required;
+      uint32_t forbidden;
+      std::vector< std::shared_ptr< const predicate_t > > predicates;
+    };
+
+    std::vector< Term > terms_; ///< Disjunction of terms, filter without terms matches nothing
+
+    Filter() = default;
+    explicit Filter(Term term);
+  };
+
+  Filter operator&&(const Filter& lhs, const Filter& rhs);
+  Filter operator||(const Filter& lhs, const Filter& rhs);
+  Filter operator!(const Filter& filter);
+}
+
+#endif
@@ -11,35 +11,31 @@
 #define CPPBOT_HANDLERS_HPP
 
 #include <functional>
+#include <memory>
 #include <string>
-#include <map>
+#include <string_view>
 #include <unordered_map>
-#include <utility>
+#include <vector>
 #include "types.hpp"
 #include "states.hpp"
+#include "routing.hpp"
+#include "filters.hpp"
+#include "middleware.hpp"
+#include "callback_data.hpp"
 
 namespace handlers
 {
-  namespace detail
-  {
-    struct PairHasher
-    {
-      size_t operator()(const std::pair< std::string, states::State >& p) const
-      {
-        size_t h1 = std::hash< std::string >{}(p.first);
-        size_t h2 = std::hash< states::State >{}(p.second);
-        return h1 ^ (h2 << 1);
-      }
-    };
-  }
-
   /*!
     @brief Handler class for processing text messages.
   */
   class MessageHandler
   {
     using handler_t = std::function< void(const types::Message&) >;
+    using args_handler_t = std::function< void(const types::Message&, const CommandArgs&) >;
     using state_handler_t = std::function< void(const types::Message&, states::StateContext&) >;
+    using state_args_handler_t = std::function< void(const types::Message&, states::StateContext&,
+      const CommandArgs&) >;
+    using static_router_t = bool (*)(std::string_view, const types::Message&, const CommandArgs&);
    public:
     MessageHandler() = default;
 
@@ -50,6 +46,13 @@ namespace handlers
     */
     void addHandler(const std::string& cmd, handler_t handler);
 
+    /*!
+      @brief Method for adding a new handler of some command, which receives command arguments
+      @param cmd Command
+      @param handler Handler for message and words after the command
+    */
+    void addHandler(const std::string& cmd, args_handler_t handler);
+
     /*!
       @brief Method for adding a new handler of messages in some state
       @param state State
@@ -65,11 +68,102 @@ namespace handlers
     */
     void addHandler(const std::string& cmd, const states::State& state, state_handler_t handler);
 
+    /*!
+      @brief Method for adding a new handler of some command in some state, which receives command arguments
+      @param cmd Command
+      @param state State
+      @param handler Handler for message and words after the command
+    */
+    void addHandler(const std::string& cmd, const states::State& state, state_args_handler_t handler);
+
+    /*!
+      @brief Method for adding a new handler of messages matching filter.
+
+      Filter handlers are checked in order of adding when no command handler matched the message.
+      @param filter Filter
+      @param handler Handler for message
+    */
+    void addHandler(const Filter& filter, handler_t handler);
+
+    /*!
+      @brief Method for adding a new handler of messages matching filter in some state.
+
+      These handlers are checked before the handler of the whole state.
+      @param filter Filter
+      @param state State
+      @param handler Handler for message
+    */
+    void addHandler(const Filter& filter, const states::State& state, state_handler_t handler);
+
+    /*!
+      @brief Method sets username of the bot.
+
+      Commands like "/start@username" are handled as "/start", commands mentioning other bots are ignored.
+      If username isn't set, any mention is just removed.
+      @param username Bot username (with or without '@')
+    */
+    void setBotUsername(const std::string& username);
+
+    /*!
+      @brief Method sets handler of messages which don't match any other handler
+      @param handler Handler for message
+    */
+    void setFallbackHandler(state_handler_t handler);
+
+    /*!
+      @brief Method sets router with commands known at compile time (see static_router.hpp).
+
+      Router is checked before handlers added with addHandler() for messages in default state.
+      @tparam Router StaticRouter type
+    */
+    template< class Router >
+    void setStaticRouter()
+    {
+      staticRouter_ = &Router::template dispatch< const types::Message, const CommandArgs >;
+    }
+
+    /*!
+      @brief Method for adding a middleware called around message handlers
+      @param middleware Middleware
+    */
+    void addMiddleware(std::shared_ptr< Middleware > middleware);
+
+    /// Method allows to get middlewares in order of calling.
+    const std::vector< std::shared_ptr< Middleware > >& middlewares() const;
+
     void processMessage(const types::Message& msg, states::StateContext& state) const;
+
+    /*!
+      @brief Method allows to get key identifying the handler group of a message (for statistics).
+      @param msg Message
+      @param state Current state of the chat
+      @return Registered command, "state #N" for messages in some state or content type ("text", "photo"...)
+    */
+    std::string routeKey(const types::Message& msg, const states::State& state) const;
    private:
-    std::unordered_map< std::string, handler_t > cmdHandlers_;
+    struct CommandHandlers
+    {
+      args_handler_t handler;
+      std::unordered_map< states::State, state_args_handler_t > stateHandlers;
+    };
+
+    struct FilterHandler
+    {
+      Filter filter;
+      state_handler_t handler;
+    };
+
+    detail::StringTable< CommandHandlers > cmdHandlers_;
+    std::vector< FilterHandler > filterHandlers_;
+    std::unordered_map< states::State, std::vector< FilterHandler > > stateFilterHandlers_;
     std::unordered_map< states::State, state_handler_t > stateHandlers_;
-    std::unordered_map< std::pair< std::string, states::State >, state_handler_t, detail::PairHasher > stateCmdHandlers_;
+    state_handler_t fallbackHandler_;
+    static_router_t staticRouter_ = nullptr;
+    std::vector< std::shared_ptr< Middleware > > middlewares_;
+    std::string botUsername_;
+
+    static bool callFilterHandlers(const std::vector< FilterHandler >& handlers, const types::Message& msg,
+      states::StateContext& state);
   };
 
   /*!
@@ -78,7 +172,16 @@ namespace handlers
   class CallbackQueryHandler
   {
     using handler_t = std::function< void(const types::CallbackQuery&) >;
+    using static_router_t = bool (*)(std::string_view, const types::CallbackQuery&);
+    using typed_handler_t = std::function< bool(const types::CallbackQuery&, const uint8_t*, size_t) >;
    public:
+    /// Which handlers are called when data matches several partial match handlers.
+    enum PartialMatchMode
+    {
+      ALL_PREFIXES,  ///< All matching handlers, from the shortest prefix to the longest
+      LONGEST_PREFIX ///< Only the handler with the longest prefix
+    };
+
     CallbackQueryHandler() = default;
 
     /*!
@@ -89,10 +192,91 @@ namespace handlers
     */
     void addHandler(const std::string& callData, handler_t handler, bool allowPartialMatch = false);
 
+    /*!
+      @brief Method for adding a new handler of typed callback data (see callback_data.hpp)
+
+      Buttons for this handler are created with handlers::encodeCallbackData(Action{...}).
+      @tparam Action Action struct
+      @param handler Function taking const types::CallbackQuery& and const Action&
+    */
+    template< class Action, class F >
+    void addHandler(F handler)
+    {
+      if (typedHandlers_.size() <= Action::ID)
+      {
+        typedHandlers_.resize(Action::ID + 1);
+      }
+      typedHandlers_[Action::ID] = [handler](const types::CallbackQuery& query, const uint8_t* data, size_t size)
+      {
+        Action action{};
+        CallbackDataReader reader(data, size);
+        action.serialize(reader);
+        if (!reader.isValid())
+        {
+          return false;
+        }
+        handler(query, static_cast< const Action& >(action));
+        return true;
+      };
+    }
+
+    /*!
+      @brief Method sets which partial match handlers are called (all of them by default).
+      @param mode Mode
+    */
+    void setPartialMatchMode(PartialMatchMode mode);
+
+    /*!
+      @brief Method sets handler of queries which don't match any other handler
+      @param handler Handler for query
+    */
+    void setFallbackHandler(handler_t handler);
+
+    /*!
+      @brief Method sets router with callback data known at compile time (see static_router.hpp).
+
+      Router is checked before handlers added with addHandler().
+      @tparam Router StaticRouter type
+    */
+    template< class Router >
+    void setStaticRouter()
+    {
+      staticRouter_ = &Router::template dispatch< const types::CallbackQuery >;
+    }
+
+    /*!
+      @brief Method for adding a middleware called around callback query handlers
+      @param middleware Middleware
+    */
+    void addMiddleware(std::shared_ptr< Middleware > middleware);
+
+    /// Method allows to get middlewares in order of calling.
+    const std::vector< std::shared_ptr< Middleware > >& middlewares() const;
+
     void processCallbackQuery(const types::CallbackQuery& query) const;
+
+    /*!
+      @brief Method allows to get key identifying the handler of a query (for statistics).
+      @param query Callback query
+      @return Registered data or prefix, "~N" for typed data with action id N or "unknown"
+    */
+    std::string routeKey(const types::CallbackQuery& query) const;
    private:
     std::unordered_map< std::string, handler_t > handlers_;
-    std::map< std::string, handler_t > partialMatchHandlers_;
+    struct PartialMatchHandler
+    {
+      std::string prefix;
+      handler_t handler;
+    };
+
+    detail::PrefixTrie< PartialMatchHandler > partialMatchHandlers_;
+    std::vector< typed_handler_t > typedHandlers_;
+    handler_t fallbackHandler_;
+    static_router_t staticRouter_ = nullptr;
+    std::vector< std::shared_ptr< Middleware > > middlewares_;
+    PartialMatchMode partialMatchMode_ = ALL_PREFIXES;
+
+    bool processTypedCallbackQuery(const types::CallbackQuery& query) const;
   };
 }
 
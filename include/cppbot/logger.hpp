@@ -0,0 +1,206 @@
+/*!
+  @file
+  @brief Header contains asynchronous logger and sinks of log records.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_LOGGER_HPP
+#define CPPBOT_LOGGER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace cppbot
+{
+  /// Level of log record.
+  enum class LogLevel: uint8_t
+  {
+    DEBUG,
+    INFO,
+    WARNING,
+    ERROR
+  };
+
+  /// Structured fields of log record (e.g. endpoint, chat_id, error_code).
+  using LogFields = std::vector< std::pair< std::string, std::string > >;
+
+  /// Log record.
+  struct LogRecord
+  {
+    LogLevel level;
+    std::chrono::system_clock::time_point time;
+    std::string message;
+    LogFields fields;
+  };
+
+  /*!
+    @brief Function allows to get name of level.
+    @param level Level
+    @return "DEBUG", "INFO", "WARNING" or "ERROR"
+  */
+  const char* levelName(LogLevel level);
+
+  /*!
+    @brief Interface of destination of log records.
+
+    Sink is called only from the thread of AsyncLogger, so it doesn't need to be thread-safe.
+  */
+  class LogSink
+  {
+   public:
+    virtual ~LogSink() = default;
+
+    /*!
+      @brief Method writes a record.
+      @param record Record
+    */
+    virtual void write(const LogRecord& record) = 0;
+
+    /// Method is called after a batch of records is written.
+    virtual void flush();
+  };
+
+  /*!
+    @brief Sink writing records as text lines: time, level, message and fields as key=value.
+  */
+  class StreamSink: public LogSink
+  {
+   public:
+    /*!
+      @param stream Stream for records (it must outlive the sink)
+    */
+    explicit StreamSink(std::ostream& stream);
+
+    void write(const LogRecord& record) override;
+    void flush() override;
+   private:
+    std::ostream& stream_;
+    std::string line_;
+  };
+
+  /*!
+    @brief Logger passing records to a sink from a background thread.
+
+    Records are put into a bounded lock-free ring, so logging threads never wait for the sink.
+    When the ring is full, new records are dropped and counted. Records with the same message
+    are rate limited: after a burst of them in a window the rest are suppressed, and the number
+    of suppressed ones is added to the next passed record as "suppressed" field.
+  */
+  class AsyncLogger
+  {
+   public:
+    /*!
+      @param sink Destination of records (by default they are written to std::cerr)
+      @param level Minimum level of written records
+      @param capacity Number of records in the ring (rounded up to a power of 2)
+      @param flushInterval Period of passing records to the sink
+    */
+    explicit AsyncLogger(std::shared_ptr< LogSink > sink = nullptr, LogLevel level = LogLevel::INFO,
+      size_t capacity = 4096, std::chrono::milliseconds flushInterval = std::chrono::milliseconds(100));
+
+    /// Destructor passes all queued records to the sink.
+    ~AsyncLogger();
+
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+    /*!
+      @brief Method queues a record.
+      @param level Level of the record
+      @param message Message, it should be constant while details go to fields
+      @param fields Structured fields
+    */
+    void log(LogLevel level, const std::string& message, LogFields fields = {});
+
+    /*!
+      @brief Method checks if records of a level are written.
+      @param level Level
+    */
+    bool isEnabled(LogLevel level) const
+    {
+      return level >= level_.load(std::memory_order_relaxed);
+    }
+
+    /*!
+      @brief Method changes minimum level of written records.
+      @param level Level
+    */
+    void setLevel(LogLevel level);
+
+    /*!
+      @brief Method changes rate limiting of records with the same message.
+      @param burst Number of records passed in a window, 0 disables limiting
+      @param window Length of the window
+    */
+    void setRateLimit(size_t burst, std::chrono::milliseconds window);
+
+    /// Method waits until all queued records are passed to the sink.
+    void flush();
+
+    /// Method allows to get number of records dropped because the ring was full.
+    size_t dropped() const;
+   private:
+    struct Slot
+    {
+      std::atomic< size_t > sequence;
+      LogRecord record;
+    };
+
+    struct alignas(64) Limit
+    {
+      std::atomic< int64_t > windowStart;
+      std::atomic< uint32_t > count;
+      std::atomic< uint32_t > suppressed;
+    };
+
+    std::shared_ptr< LogSink > sink_;
+    std::atomic< LogLevel > level_;
+    std::atomic< size_t > burst_;
+    std::atomic< int64_t > window_; ///< In milliseconds
+    std::unique_ptr< Slot[] > slots_;
+    size_t mask_;
+    alignas(64) std::atomic< size_t > enqueuePos_;
+    alignas(64) std::atomic< size_t > dequeuePos_;
+    std::atomic< size_t > dropped_;
+    size_t reportedDrops_; ///< Used only by the logger thread
+    std::vector< Limit > limits_;
+    std::chrono::milliseconds flushInterval_;
+    bool isStopped_;
+    bool isFlushRequested_;
+    std::mutex mutex_;
+    std::condition_variable wakeCondition_;
+    std::condition_variable flushedCondition_;
+    std::thread thread_;
+
+    bool isLimited(const std::string& message, uint32_t& suppressed);
+    bool pop(LogRecord& record);
+    void drain();
+    void work();
+  };
+
+  /*!
+    @brief Function passes a record to a logger or writes it to std::cerr at once if there is no logger.
+
+    It's used by parts of the library working without a bot, so their errors aren't lost when no logger is set.
+    @param logger Logger, may be nullptr
+    @param level Level of the record
+    @param message Message
+    @param fields Structured fields
+  */
+  void log(const std::shared_ptr< AsyncLogger >& logger, LogLevel level, const std::string& message,
+    LogFields fields = {});
+}
+
+#endif
@@ -0,0 +1,273 @@
+/*!
+  @file
+  @brief Header contains registry of bot metrics and exporter of them in Prometheus text format.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_METRICS_HPP
+#define CPPBOT_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include "logger.hpp"
+
+namespace cppbot
+{
+  namespace detail
+  {
+    /// Number of cells of every metric, threads are spread between them.
+    constexpr size_t METRIC_SHARDS = 16;
+
+    /// Function allows to get cell of the calling thread.
+    inline size_t threadShard()
+    {
+      static std::atomic< size_t > nextShard(0);
+      thread_local size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+      return shard;
+    }
+  }
+
+  /*!
+    @brief Monotonic counter.
+
+    Every thread increments its own cell, so counting doesn't take locks and threads don't share cache lines.
+    Cells are summed only when the value is read.
+  */
+  class Counter
+  {
+   public:
+    Counter();
+
+    Counter(const Counter&) = delete;
+    Counter& operator=(const Counter&) = delete;
+
+    /*!
+      @brief Method increases the counter.
+      @param n Increment
+    */
+    void increment(uint64_t n = 1)
+    {
+      cells_[detail::threadShard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    /// Method allows to get current value.
+    uint64_t value() const;
+   private:
+    struct alignas(64) Cell
+    {
+      std::atomic< uint64_t > value;
+    };
+
+    std::array< Cell, detail::METRIC_SHARDS > cells_;
+  };
+
+  /*!
+    @brief Histogram of observed values with fixed bucket bounds.
+
+    As Counter, keeps a separate set of buckets for every cell, so observing doesn't take locks.
+  */
+  class Histogram
+  {
+   public:
+    /// Summed state of the histogram.
+    struct Snapshot
+    {
+      std::vector< double > bounds;
+      std::vector< uint64_t > counts; ///< Not cumulative, the last one is for values above all bounds
+      double sum;
+      uint64_t count;
+    };
+
+    /*!
+      @param bounds Upper bounds of buckets in ascending order
+    */
+    explicit Histogram(std::vector< double > bounds);
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    /*!
+      @brief Method adds a value to the histogram.
+      @param value Observed value
+    */
+    void observe(double value);
+
+    /*!
+      @brief Method adds duration in seconds to the histogram.
+      @param duration Observed duration
+    */
+    template< class Rep, class Period >
+    void observe(std::chrono::duration< Rep, Period > duration)
+    {
+      observe(std::chrono::duration< double >(duration).count());
+    }
+
+    /// Method allows to get summed state of the histogram.
+    Snapshot snapshot() const;
+   private:
+    static constexpr size_t COUNTS_PER_LINE = 64 / sizeof(std::atomic< uint64_t >);
+
+    /// Counts of buckets are allocated by whole cache lines, so buckets of different cells don't share them.
+    struct alignas(64) CountLine
+    {
+      std::array< std::atomic< uint64_t >, COUNTS_PER_LINE > counts;
+    };
+
+    struct alignas(64) Cell
+    {
+      std::unique_ptr< CountLine[] > lines;
+      std::atomic< double > sum;
+
+      std::atomic< uint64_t >& count(size_t bucket) const
+      {
+        return lines[bucket / COUNTS_PER_LINE].counts[bucket % COUNTS_PER_LINE];
+      }
+    };
+
+    std::vector< double > bounds_;
+    std::array< Cell, detail::METRIC_SHARDS > cells_;
+  };
+
+  /*!
+    @brief Registry of named metrics.
+
+    Metrics are identified by name and labels. Getting a metric takes a shared lock, so it's better
+    to keep the returned reference, but the metric itself is updated without locks. Gauges are
+    read with a callback only when metrics are exported, so they cost nothing between scrapes.
+  */
+  class Metrics
+  {
+   public:
+    using labels_t = std::vector< std::pair< std::string, std::string > >;
+    using gauge_t = std::function< double() >;
+
+    Metrics();
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    /// Function allows to get default bounds of latency histograms (in seconds).
+    static std::vector< double > latencyBounds();
+
+    /*!
+      @brief Method allows to get a counter, it's created on the first call.
+      @param name Name of the metric
+      @param help Description of the metric
+      @param labels Labels of the counter
+      @return Reference to counter valid while the registry exists
+      @throw std::invalid_argument if metric with this name has other type
+    */
+    Counter& counter(const std::string& name, const std::string& help, const labels_t& labels = {});
+
+    /*!
+      @brief Method allows to get a histogram, it's created on the first call.
+      @param name Name of the metric
+      @param help Description of the metric
+      @param labels Labels of the histogram
+      @param bounds Upper bounds of buckets, used only when the histogram is created
+      @return Reference to histogram valid while the registry exists
+      @throw std::invalid_argument if metric with this name has other type
+    */
+    Histogram& histogram(const std::string& name, const std::string& help, const labels_t& labels = {},
+      const std::vector< double >& bounds = latencyBounds());
+
+    /*!
+      @brief Method adds a gauge or replaces callback of existing one.
+      @param name Name of the metric
+      @param help Description of the metric
+      @param read Callback returning current value, NaN skips the gauge
+      @param labels Labels of the gauge
+      @throw std::invalid_argument if metric with this name has other type
+    */
+    void gauge(const std::string& name, const std::string& help, gauge_t read, const labels_t& labels = {});
+
+    /*!
+      @brief Method exports all metrics.
+      @return Metrics in Prometheus text exposition format (version 0.0.4)
+    */
+    std::string exposition() const;
+   private:
+    enum Type
+    {
+      COUNTER,
+      GAUGE,
+      HISTOGRAM
+    };
+
+    struct Series
+    {
+      std::string labels; ///< Formatted labels without braces
+      std::unique_ptr< Counter > counter;
+      std::unique_ptr< Histogram > histogram;
+      gauge_t gauge;
+    };
+
+    struct Family
+    {
+      std::string help;
+      Type type;
+      std::map< std::string, Series > series;
+    };
+
+    std::map< std::string, Family > families_;
+    mutable std::shared_mutex mutex_;
+
+    Series* find(const std::string& name, Type type, const std::string& labels);
+    Series& insert(const std::string& name, const std::string& help, Type type, const std::string& labels);
+  };
+
+  /*!
+    @brief HTTP server answering GET /metrics with exported metrics.
+
+    Server works in the thread running the context, so scraping doesn't stop handling updates.
+  */
+  class MetricsServer
+  {
+   public:
+    /*!
+      @param ioContext Context running the server
+      @param metrics Exported metrics
+      @param port Port to listen, 0 chooses a free one
+      @param address Address to listen
+    */
+    MetricsServer(boost::asio::io_context& ioContext, std::shared_ptr< Metrics > metrics, unsigned short port,
+      const std::string& address = "0.0.0.0");
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    /// Method allows to get port the server listens.
+    unsigned short port() const;
+
+    /*!
+      @brief Method sets logger for errors of the server. Call it before running the context.
+      @param logger Shared pointer to AsyncLogger (nullptr writes errors to std::cerr)
+    */
+    void setLogger(std::shared_ptr< AsyncLogger > logger);
+   private:
+    class Session;
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::shared_ptr< Metrics > metrics_;
+    std::shared_ptr< AsyncLogger > logger_;
+
+    void accept();
+  };
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*!
+  @file
+  @brief Header contains base class for middlewares called around handlers.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_MIDDLEWARE_HPP
+#define CPPBOT_MIDDLEWARE_HPP
+
+#include "types.hpp"
+#include "states.hpp"
+
+namespace handlers
+{
+  /*!
+    @brief Base class for logic called before and after handlers of every update (auth, throttling, timing...).
+
+    Middlewares are called in order of adding, "after" hooks are called in reverse order. When a handler
+    or a "before" hook throws, "after" hooks of middlewares whose "before" already passed are still called.
+    Override only methods you need, by default update is passed further.
+  */
+  class Middleware
+  {
+   public:
+    virtual ~Middleware() = default;
+
+    /*!
+      @brief Method is called before message handlers.
+      @param msg Message
+      @param state State context of the chat
+      @return false to stop processing (next middlewares and handlers are not called)
+    */
+    virtual bool before(const types::Message& msg, states::StateContext& state);
+
+    /*!
+      @brief Method is called after message handlers (or after next middleware stopped processing).
+      @param msg Message
+      @param state State context of the chat
+    */
+    virtual void after(const types::Message& msg, states::StateContext& state);
+
+    /*!
+      @brief Method is called before callback query handlers.
+      @param query Callback query
+      @return false to stop processing (next middlewares and handlers are not called)
+    */
+    virtual bool before(const types::CallbackQuery& query);
+
+    /*!
+      @brief Method is called after callback query handlers (or after next middleware stopped processing).
+      @param query Callback query
+    */
+    virtual void after(const types::CallbackQuery& query);
+  };
+}
+
+#endif
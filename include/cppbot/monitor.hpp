@@ -0,0 +1,152 @@
+/*!
+  @file
+  @brief Header contains monitor of handlers latency.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_MONITOR_HPP
+#define CPPBOT_MONITOR_HPP
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "logger.hpp"
+
+namespace cppbot
+{
+  /*!
+    @brief Class measures time of handler invocations and finds slow handlers.
+
+    Invocations are grouped by key of the handler (command, state or callback data).
+    Watchdog thread reports invocations which are still running after the time budget.
+  */
+  class Monitor
+  {
+   public:
+    using duration_t = std::chrono::microseconds;
+    using slow_handler_t = std::function< void(const std::string& key, duration_t elapsed, std::thread::id thread) >;
+
+    /// Latency statistics of one handler.
+    struct Stats
+    {
+      std::string key;
+      size_t count;
+      size_t slowCount; ///< Number of invocations exceeded the budget
+      duration_t total;
+      duration_t max;
+
+      /// Number of invocations by latency: bucket i holds latencies in [2^(i-1), 2^i) microseconds.
+      std::array< size_t, 40 > histogram;
+
+      /// Method allows to get mean latency.
+      duration_t mean() const;
+
+      /*!
+        @brief Method allows to estimate latency percentile from histogram.
+        @param q Quantile from 0 to 1 (e.g. 0.99)
+        @return Upper bound of histogram bucket containing the percentile
+      */
+      duration_t percentile(double q) const;
+    };
+
+    /*!
+      @brief RAII object measuring one invocation.
+    */
+    class Scope
+    {
+     public:
+      /*!
+        @param monitor Monitor, nullptr disables measuring
+        @param key Key of the handler
+      */
+      Scope(Monitor* monitor, const std::string& key);
+      ~Scope();
+
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+     private:
+      Monitor* monitor_;
+      size_t token_;
+    };
+
+    /*!
+      @param budget Time after which invocation is reported as slow
+      @param onSlow Callback called from watchdog thread for slow invocations (by default they are logged, see setLogger)
+    */
+    Monitor(duration_t budget = std::chrono::seconds(1), slow_handler_t onSlow = nullptr);
+    ~Monitor();
+
+    Monitor(const Monitor&) = delete;
+    Monitor& operator=(const Monitor&) = delete;
+
+    /*!
+      @brief Method starts measuring an invocation.
+      @param key Key of the handler
+      @return Token for finish()
+    */
+    size_t start(const std::string& key);
+
+    /*!
+      @brief Method finishes measuring an invocation.
+      @param token Token returned by start()
+    */
+    void finish(size_t token);
+
+    /*!
+      @brief Method allows to get statistics of a handler.
+      @param key Key of the handler
+      @return Statistics (with zero count if handler wasn't called)
+    */
+    Stats stats(const std::string& key) const;
+
+    /*!
+      @brief Method allows to get the slowest handlers.
+      @param n Maximum number of handlers
+      @return Statistics sorted by 99th percentile of latency (descending)
+    */
+    std::vector< Stats > slowest(size_t n) const;
+
+    /// Method clears all statistics.
+    void reset();
+
+    /*!
+      @brief Method sets logger for reports of the default callback. Call it before measuring.
+      @param logger Shared pointer to AsyncLogger (nullptr writes reports to std::cerr)
+    */
+    void setLogger(std::shared_ptr< AsyncLogger > logger);
+   private:
+    struct Invocation
+    {
+      std::string key;
+      std::chrono::steady_clock::time_point start;
+      std::thread::id thread;
+      bool isActive;
+      bool isReported;
+    };
+
+    duration_t budget_;
+    slow_handler_t onSlow_;
+    std::vector< Invocation > invocations_;
+    std::vector< size_t > freeTokens_;
+    std::unordered_map< std::string, Stats > stats_;
+    bool isStopped_;
+    mutable std::mutex mutex_;
+    std::condition_variable stopCondition_;
+    std::thread watchdog_;
+    std::shared_ptr< AsyncLogger > logger_;
+
+    void watch();
+  };
+}
+
+#endif
@@ -0,0 +1,140 @@
+/*!
+  @file
+  @brief Header contains multipart/form-data body streamed to the socket in chunks.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_MULTIPART_HPP
+#define CPPBOT_MULTIPART_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/optional.hpp>
+#include <nlohmann/json.hpp>
+
+#include "types.hpp"
+
+namespace cppbot
+{
+  namespace multipart
+  {
+    /*!
+      @brief Class describes multipart/form-data content without loading files into memory.
+
+      Text parts are kept as strings, file parts only remember a path and a size,
+      so the total length of the body is known before anything is read from disk.
+      In-memory files are referenced without copying, generators are called while sending.
+    */
+    class Form
+    {
+     public:
+      /// Piece of the body: text in data, file on disk, shared buffer or generator of file content.
+      struct Segment
+      {
+        std::string data;
+        std::string path;
+        std::uint64_t size;
+        types::InputFile::buffer_t buffer;
+        types::InputFile::generator_t generator;
+      };
+
+      Form() = default;
+
+      /*!
+        @param boundary Boundary separating parts of the form
+      */
+      explicit Form(const std::string& boundary);
+
+      /*!
+        @brief Method adds a text field to the form.
+        @param name Field name
+        @param value Field value
+      */
+      void addField(const std::string& name, const std::string& value);
+
+      /*!
+        @brief Method adds every item of json object as a text field.
+        @param fields Json object with fields
+      */
+      void addFields(const nlohmann::json& fields);
+
+      /*!
+        @brief Method adds a file to the form. File content is read only while sending.
+        @param name Field name
+        @param file File to be uploaded
+      */
+      void addFile(const std::string& name, const types::InputFile& file);
+
+      /*!
+        @brief Method closes the form. No parts can be added after that.
+      */
+      void finish();
+
+      /// Method allows to get value for the Content-Type header.
+      std::string contentType() const;
+
+      /// Method allows to get the total size of the body in bytes.
+      std::uint64_t size() const;
+
+      /// Method returns false if some file is produced by generator of unknown size.
+      bool hasKnownSize() const;
+
+      /// Method returns false if some file is produced by generator, such form can be sent only once.
+      bool isReplayable() const;
+
+      const std::vector< Segment >& segments() const;
+     private:
+      std::string boundary_;
+      std::vector< Segment > segments_;
+      std::uint64_t size_ = 0;
+      bool hasKnownSize_ = true;
+
+      void append(const std::string& text);
+    };
+
+    /*!
+      @brief Beast body type which writes a Form reading files in fixed-size chunks.
+    */
+    struct Body
+    {
+      using value_type = Form;
+
+      static std::uint64_t size(const value_type& form);
+
+      class writer
+      {
+       public:
+        using const_buffers_type = boost::asio::const_buffer;
+
+        template< bool isRequest, class Fields >
+        writer(const boost::beast::http::header< isRequest, Fields >&, const value_type& form):
+          form_(form),
+          segment_(0),
+          offset_(0),
+          isStarted_(false)
+        {}
+
+        void init(boost::system::error_code& ec);
+        boost::optional< std::pair< const_buffers_type, bool > > get(boost::system::error_code& ec);
+       private:
+        const Form& form_;
+        size_t segment_;
+        std::uint64_t offset_;
+        bool isStarted_;
+        std::ifstream file_;
+        std::vector< char > buffer_;
+      };
+    };
+  }
+}
+
+#endif
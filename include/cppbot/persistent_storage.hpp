@@ -0,0 +1,99 @@
+/*!
+  @file
+  @brief Header contains storage of states saving them on disk.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_PERSISTENT_STORAGE_HPP
+#define CPPBOT_PERSISTENT_STORAGE_HPP
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include "serializing_storage.hpp"
+
+namespace states
+{
+  /*!
+    @brief Storage keeping states and data of chats between restarts.
+
+    Changes of a chat are appended to a write-ahead log after every handled update (see commit()).
+    When the log grows, it is put aside and a new one is started, and a background thread merges
+    the old log into the snapshot, so handlers don't wait for it. On start the snapshot is mapped
+    into memory and the logs are replayed over it, damaged tail of the log (after a crash) is discarded.
+
+    Values are saved with registered codecs (see SerializingStorage).
+    @warning Expired and evicted chats are deleted from disk too.
+  */
+  class PersistentStorage: public SerializingStorage
+  {
+   public:
+    /*!
+      @param directory Directory for log and snapshot files (created if doesn't exist)
+      @param maxLogSize Size of the log in bytes after which a snapshot is made
+      @param shards Number of shards (see Storage)
+    */
+    PersistentStorage(const std::string& directory, size_t maxLogSize = 64 * 1024 * 1024, size_t shards = 64);
+    ~PersistentStorage() override;
+
+    PersistentStorage(const PersistentStorage&) = delete;
+    PersistentStorage& operator=(const PersistentStorage&) = delete;
+
+    State state(size_t chatId) const override;
+    void setState(size_t chatId, const State& state) override;
+    StatesForm::Data& data(size_t chatId) override;
+    Value& value(size_t chatId, const State& state) override;
+    void remove(size_t chatId) override;
+
+    /*!
+      @brief Method writes changes of the chat to the log.
+      @param chatId Chat id
+    */
+    void commit(size_t chatId) override;
+
+    /// Method writes changes of all chats to the log.
+    void flush();
+
+    /// Method writes all saved chats to a new snapshot and clears the logs.
+    void snapshot();
+   protected:
+    void evicted(size_t chatId) override;
+   private:
+    std::string directory_;
+    size_t maxLogSize_;
+    std::unordered_map< size_t, std::string > records_; ///< Last saved record of every chat
+    std::unordered_set< size_t > dirtyChats_;
+    std::FILE* log_;
+    size_t logSize_;
+    bool isCompacting_; ///< Old log is waiting for merging into the snapshot
+    bool isStopped_;
+    mutable std::once_flag loadFlag_;
+    mutable std::mutex mutex_;
+    std::mutex compactionMutex_; ///< Serializes writing of snapshots, taken before mutex_
+    std::condition_variable compactionCondition_;
+    std::thread compactor_;
+
+    void ensureLoaded() const;
+    void load();
+    void loadSnapshot();
+    void replayLog(const std::string& name, bool isCurrent);
+    void rotateLog();
+    void compact();
+    void runCompactor();
+    void applyRecord(const std::string& record);
+    void forget(size_t chatId);
+    void markDirty(size_t chatId);
+    std::string encodeRecord(size_t chatId);
+    bool save(size_t chatId, std::string body);
+    void appendToLog(const std::string& body);
+  };
+}
+
+#endif
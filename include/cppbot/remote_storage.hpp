@@ -0,0 +1,156 @@
+/*!
+  @file
+  @brief Header contains storage of states shared by several bot processes through a state server.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_REMOTE_STORAGE_HPP
+#define CPPBOT_REMOTE_STORAGE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/io_context.hpp>
+#include "serializing_storage.hpp"
+
+namespace states
+{
+  namespace detail
+  {
+    /*!
+      @brief Operations of the state server protocol.
+
+      Every frame is: u32 size of the rest, u8 operation, u64 chat id, payload.
+      Client sends GET, PUT (payload is encoded chat) and REMOVE. Server answers GET with VALUE
+      or NOT_FOUND in order of requests and sends INVALIDATE to other clients when a chat is changed.
+    */
+    enum RemoteOperation: uint8_t
+    {
+      GET = 1,
+      PUT = 2,
+      REMOVE = 3,
+      VALUE = 16,
+      NOT_FOUND = 17,
+      INVALIDATE = 18
+    };
+
+    /// Size of frame header (size, operation and chat id).
+    constexpr size_t FRAME_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint64_t);
+
+    /// Maximum size of frame payload, peers sending bigger frames are disconnected.
+    constexpr size_t MAX_PAYLOAD_SIZE = 16 * 1024 * 1024;
+
+    /*!
+      @brief Function makes frame of the state server protocol.
+      @param operation Operation
+      @param chatId Chat id
+      @param payload Payload
+      @return Frame
+      @throw std::length_error if payload is bigger than MAX_PAYLOAD_SIZE
+    */
+    std::string makeFrame(RemoteOperation operation, size_t chatId, const std::string& payload = {});
+
+    /*!
+      @brief Function parses address of the state server.
+      @param ioContext Context used for resolving
+      @param address "tcp://host:port" or "unix:///path/to/socket"
+      @return Endpoint
+      @throw std::invalid_argument if address has unknown scheme
+    */
+    boost::asio::generic::stream_protocol::endpoint makeEndpoint(boost::asio::io_context& ioContext,
+      const std::string& address);
+  }
+
+  /*!
+    @brief Storage keeping states and data of chats on a state server shared by several bot processes.
+
+    Chats are read from the server on the first access and cached. Changes of a chat are sent to the
+    server after every handled update (see commit()) without waiting for an answer. When other process
+    changes the chat, the server invalidates the cached copy and it is read again on the next access.
+    Invalidations are received before reading state of the chat, so a chat handled by different processes
+    one after another is seen up to date if the previous change reached the server.
+
+    Chat being changed by a handler (accessed but not committed yet) keeps its cached copy when it's
+    invalidated, so the handler doesn't see its data replaced. On commit its changes are sent and overwrite
+    the other change (the last writer wins), and if the handler changed nothing, the copy is read again
+    on the next access.
+
+    Chats are spread among several connections, each with its own lock, so handlers of chats of different
+    connections access the server in parallel. Every access checks the socket for invalidations,
+    a missing chat is read with a blocking round trip.
+
+    Values are sent with registered codecs (see SerializingStorage).
+    @warning If connection to the server is lost, cache of its chats is cleared (except chats being changed)
+    and the connection is restored on the next access.
+  */
+  class RemoteStorage: public SerializingStorage
+  {
+   public:
+    /*!
+      @param address Address of the state server ("tcp://host:port" or "unix:///path/to/socket")
+      @param shards Number of shards (see Storage)
+      @param connections Number of connections to the server (not more than shards)
+    */
+    RemoteStorage(const std::string& address, size_t shards = 64, size_t connections = 4);
+
+    RemoteStorage(const RemoteStorage&) = delete;
+    RemoteStorage& operator=(const RemoteStorage&) = delete;
+
+    State state(size_t chatId) const override;
+    void setState(size_t chatId, const State& state) override;
+    StatesForm::Data& data(size_t chatId) override;
+    Value& value(size_t chatId, const State& state) override;
+    void remove(size_t chatId) override;
+
+    /*!
+      @brief Method sends changes of the chat to the server.
+      @param chatId Chat id
+    */
+    void commit(size_t chatId) override;
+
+    /*!
+      @brief Method reads several chats from the server with one round trip per connection.
+      @param chatIds Chat ids
+    */
+    void prefetch(const std::vector< size_t >& chatIds);
+   protected:
+    void evicted(size_t chatId) override;
+   private:
+    struct Connection
+    {
+      explicit Connection(boost::asio::io_context& ioContext);
+
+      boost::asio::generic::stream_protocol::socket socket;
+      std::unordered_set< size_t > cached;
+      std::unordered_set< size_t > dirtyChats;
+      std::unordered_map< size_t, std::string > sent; ///< Last sent value of every cached chat
+      std::unordered_set< size_t > staleChats; ///< Dirty chats invalidated while being changed
+      std::recursive_mutex mutex; ///< Recursive, since decoding can evict chats of the same shard
+    };
+
+    std::string address_;
+    boost::asio::io_context ioContext_;
+    std::vector< std::unique_ptr< Connection > > connections_;
+
+    Connection& connectionOf(size_t chatId);
+    void fetch(Connection& connection, const std::vector< size_t >& chatIds);
+    void connect(Connection& connection);
+    void disconnect(Connection& connection);
+    void send(Connection& connection, const std::string& frames);
+    void receiveInvalidations(Connection& connection);
+    std::pair< detail::RemoteOperation, size_t > receive(Connection& connection, std::string& payload);
+    void invalidate(Connection& connection, size_t chatId);
+    void dropCache(Connection& connection);
+    void markDirty(size_t chatId);
+  };
+}
+
+#endif
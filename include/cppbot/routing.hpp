@@ -0,0 +1,345 @@
+/*!
+  @file
+  @brief Header contains lookup structures used by handlers for routing updates.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_ROUTING_HPP
+#define CPPBOT_ROUTING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace handlers
+{
+  /*!
+    @brief Class represents command arguments (words of a message after the command).
+
+    Arguments are not copied: they are views into the message text, split by whitespaces on demand.
+  */
+  class CommandArgs
+  {
+   public:
+    /*!
+      @brief Forward iterator over arguments.
+    */
+    class Iterator
+    {
+     public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::string_view;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const std::string_view*;
+      using reference = const std::string_view&;
+
+      Iterator() = default;
+      explicit Iterator(std::string_view rest);
+
+      reference operator*() const;
+      pointer operator->() const;
+      Iterator& operator++();
+      Iterator operator++(int);
+      bool operator==(const Iterator& other) const;
+      bool operator!=(const Iterator& other) const;
+     private:
+      std::string_view current_;
+      std::string_view rest_;
+    };
+
+    CommandArgs() = default;
+
+    /*!
+      @param text Part of a message after the command
+    */
+    explicit CommandArgs(std::string_view text);
+
+    /// Method allows to get all arguments as one string (without leading and trailing whitespaces).
+    std::string_view text() const;
+
+    /// Method checks if there are no arguments.
+    bool empty() const;
+
+    /// Method allows to get number of arguments.
+    size_t size() const;
+
+    /*!
+      @brief Method allows to get argument by index.
+      @param i Index of argument
+      @return Argument or empty string if there are less arguments
+    */
+    std::string_view operator[](size_t i) const;
+
+    Iterator begin() const;
+    Iterator end() const;
+   private:
+    std::string_view text_;
+  };
+
+  namespace detail
+  {
+    /*!
+      @brief Splits message text into command and arguments.
+      @param text Message text
+      @param botUsername Username of the bot (without '@'), may be empty
+      @param cmd Command without bot mention ("/start@MyBot" -> "/start")
+      @param args Rest of the text
+      @return false if the command is addressed to another bot
+    */
+    bool splitCommand(std::string_view text, std::string_view botUsername, std::string_view& cmd,
+      std::string_view& args);
+
+    /*!
+      @brief Hash table with string keys and open addressing.
+
+      Keys are hashed once on insertion, lookup takes std::string_view and never allocates.
+      References to values are invalidated by insertion of a new key.
+    */
+    template< class T >
+    class StringTable
+    {
+     public:
+      StringTable():
+        entries_(),
+        slots_(MIN_CAPACITY, EMPTY)
+      {}
+
+      /*!
+        @brief Method allows to get value by key, value is created if key doesn't exist.
+        @param key Key
+        @return Reference to value
+      */
+      T& operator[](const std::string& key)
+      {
+        size_t h = hash(key);
+        size_t slot = findSlot(key, h);
+        if (slots_[slot] != EMPTY)
+        {
+          return entries_[slots_[slot]].value;
+        }
+        entries_.push_back({key, h, T()});
+        if (entries_.size() * 2 > slots_.size())
+        {
+          rehash(slots_.size() * 2);
+        }
+        else
+        {
+          slots_[slot] = static_cast< uint32_t >(entries_.size() - 1);
+        }
+        return entries_.back().value;
+      }
+
+      /*!
+        @brief Method allows to find value by key.
+        @param key Key
+        @return Pointer to value or nullptr if key doesn't exist
+      */
+      const T* find(std::string_view key) const noexcept
+      {
+        uint32_t index = slots_[findSlot(key, hash(key))];
+        return (index == EMPTY) ? nullptr : &entries_[index].value;
+      }
+
+      /// Method allows to get number of keys.
+      size_t size() const noexcept
+      {
+        return entries_.size();
+      }
+     private:
+      struct Entry
+      {
+        std::string key;
+        size_t hash;
+        T value;
+      };
+
+      static constexpr uint32_t EMPTY = UINT32_MAX;
+      static constexpr size_t MIN_CAPACITY = 16;
+
+      std::vector< Entry > entries_;
+      std::vector< uint32_t > slots_;
+
+      static size_t hash(std::string_view key) noexcept
+      {
+        // FNV-1a
+        uint64_t h = 14695981039346656037ULL;
+        for (char c : key)
+        {
+          h ^= static_cast< unsigned char >(c);
+          h *= 1099511628211ULL;
+        }
+        return static_cast< size_t >(h);
+      }
+
+      size_t findSlot(std::string_view key, size_t h) const noexcept
+      {
+        size_t mask = slots_.size() - 1;
+        size_t slot = h & mask;
+        while (slots_[slot] != EMPTY)
+        {
+          const Entry& entry = entries_[slots_[slot]];
+          if ((entry.hash == h) && (entry.key == key))
+          {
+            break;
+          }
+          slot = (slot + 1) & mask;
+        }
+        return slot;
+      }
+
+      void rehash(size_t capacity)
+      {
+        slots_.assign(capacity, EMPTY);
+        for (size_t i = 0; i < entries_.size(); ++i)
+        {
+          size_t slot = entries_[i].hash & (capacity - 1);
+          while (slots_[slot] != EMPTY)
+          {
+            slot = (slot + 1) & (capacity - 1);
+          }
+          slots_[slot] = static_cast< uint32_t >(i);
+        }
+      }
+    };
+
+    /*!
+      @brief Radix tree with string keys allowing to find all keys which are prefixes of a string.
+
+      Lookup takes O(length of string) time, doesn't allocate and doesn't throw.
+    */
+    template< class T >
+    class PrefixTrie
+    {
+     public:
+      PrefixTrie():
+        root_(),
+        size_(0)
+      {}
+
+      /*!
+        @brief Method allows to get value by key, value is created if key doesn't exist.
+        @param key Key
+        @return Reference to value
+      */
+      T& operator[](const std::string& key)
+      {
+        Node* node = &root_;
+        std::string_view rest = key;
+        while (!rest.empty())
+        {
+          auto it = findChild(*node, rest.front());
+          if ((it == node->children.end()) || ((*it)->label.front() != rest.front()))
+          {
+            auto child = std::make_unique< Node >();
+            child->label = std::string(rest);
+            node = node->children.insert(it, std::move(child))->get();
+            break;
+          }
+          const std::string& label = (*it)->label;
+          size_t common = 1;
+          while ((common < label.size()) && (common < rest.size()) && (label[common] == rest[common]))
+          {
+            ++common;
+          }
+          if (common < label.size())
+          {
+            auto middle = std::make_unique< Node >();
+            middle->label = label.substr(0, common);
+            (*it)->label.erase(0, common);
+            middle->children.push_back(std::move(*it));
+            *it = std::move(middle);
+          }
+          node = it->get();
+          rest.remove_prefix(common);
+        }
+        if (!node->value)
+        {
+          node->value.emplace();
+          ++size_;
+        }
+        return *node->value;
+      }
+
+      /*!
+        @brief Method calls function for values of all keys which are prefixes of a string.
+        @param str String
+        @param function Function taking const T&, it is called from the shortest prefix to the longest
+      */
+      template< class F >
+      void forEachPrefix(std::string_view str, F&& function) const
+      {
+        const Node* node = &root_;
+        while (true)
+        {
+          if (node->value)
+          {
+            function(*node->value);
+          }
+          if (str.empty())
+          {
+            return;
+          }
+          auto it = findChild(*node, str.front());
+          if ((it == node->children.end()) || (str.compare(0, (*it)->label.size(), (*it)->label) != 0))
+          {
+            return;
+          }
+          str.remove_prefix((*it)->label.size());
+          node = it->get();
+        }
+      }
+
+      /*!
+        @brief Method allows to find value of the longest key which is a prefix of a string.
+        @param str String
+        @return Pointer to value or nullptr if there is no such key
+      */
+      const T* findLongestPrefix(std::string_view str) const noexcept
+      {
+        const T* result = nullptr;
+        forEachPrefix(str, [&result](const T& value)
+        {
+          result = &value;
+        });
+        return result;
+      }
+
+      /// Method allows to get number of keys.
+      size_t size() const noexcept
+      {
+        return size_;
+      }
+     private:
+      struct Node
+      {
+        std::string label;
+        std::optional< T > value;
+        std::vector< std::unique_ptr< Node > > children; ///< Sorted by the first character of label
+      };
+
+      Node root_;
+      size_t size_;
+
+      template< class NodeT >
+      static auto findChild(NodeT& node, char c) noexcept
+      {
+        return std::lower_bound(node.children.begin(), node.children.end(), c,
+          [](const std::unique_ptr< Node >& child, char value)
+          {
+            return child->label.front() < value;
+          });
+      }
+    };
+  }
+}
+
+#endif
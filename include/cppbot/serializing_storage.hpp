@@ -0,0 +1,200 @@
+/*!
+  @file
+  @brief Header contains base class of storages converting states and data to bytes.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_SERIALIZING_STORAGE_HPP
+#define CPPBOT_SERIALIZING_STORAGE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <unordered_set>
+#include "states.hpp"
+#include "logger.hpp"
+
+namespace states
+{
+  namespace detail
+  {
+    /*!
+      @brief Function appends value to binary record.
+      @param out Record
+      @param value Trivially copyable value
+    */
+    template< class T >
+    void put(std::string& out, T value)
+    {
+      char bytes[sizeof(T)];
+      std::memcpy(bytes, &value, sizeof(T));
+      out.append(bytes, sizeof(T));
+    }
+
+    /*!
+      @brief Function appends string with its size to binary record.
+      @param out Record
+      @param value String
+    */
+    inline void putString(std::string& out, const std::string& value)
+    {
+      put< uint32_t >(out, static_cast< uint32_t >(value.size()));
+      out += value;
+    }
+
+    /*!
+      @brief Class reading values written by put() and putString().
+      @throw std::out_of_range if record is shorter than expected
+    */
+    class RecordReader
+    {
+     public:
+      RecordReader(const char* data, size_t size):
+        data_(data),
+        size_(size)
+      {}
+
+      template< class T >
+      T get()
+      {
+        T value;
+        std::memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+      }
+
+      std::string getString()
+      {
+        uint32_t size = get< uint32_t >();
+        const char* data = take(size);
+        return std::string(data, size);
+      }
+     private:
+      const char* data_;
+      size_t size_;
+
+      const char* take(size_t size)
+      {
+        if (size > size_)
+        {
+          throw std::out_of_range("Record is truncated");
+        }
+        const char* data = data_;
+        data_ += size;
+        size_ -= size;
+        return data;
+      }
+    };
+  }
+
+  /*!
+    @brief Base class of storages saving states and data of chats somewhere else.
+
+    Data values and values of fields are converted with codecs registered for their types (std::string,
+    integers, double and bool are registered by default). Values of other types are skipped.
+    @warning States are saved by their numbers, so they must be created in the same order in every
+    process using saved data. Register all codecs before the first access to the storage.
+  */
+  class SerializingStorage: public Storage
+  {
+   public:
+    using encoder_t = std::function< std::string(const boost::any&) >;
+    using decoder_t = std::function< boost::any(const std::string&) >;
+    using value_encoder_t = std::function< std::string(const Value&) >;
+    using value_decoder_t = std::function< Value(const std::string&) >;
+
+    /*!
+      @param shards Number of shards (see Storage)
+    */
+    SerializingStorage(size_t shards = 64);
+
+    /*!
+      @brief Method registers codec for values of some type.
+      @param name Unique name of the type written with values
+      @param encode Function converting value to bytes
+      @param decode Function restoring value from bytes
+    */
+    template< class T >
+    void registerType(const std::string& name, std::function< std::string(const T&) > encode,
+      std::function< T(const std::string&) > decode)
+    {
+      Codec codec{name, [encode](const boost::any& value)
+      {
+        return encode(boost::any_cast< const T& >(value));
+      }, [encode](const Value& value)
+      {
+        return encode(*value.find< T >());
+      }};
+      Decoder decoder{[decode](const std::string& bytes)
+      {
+        return boost::any(decode(bytes));
+      }, [decode](const std::string& bytes)
+      {
+        Value value;
+        value.emplace< T >(decode(bytes));
+        return value;
+      }};
+      registerCodec(typeid(T), codec, decoder);
+    }
+
+    /*!
+      @brief Method sets logger for warnings and errors of the storage. Call it before the first access.
+      @param logger Shared pointer to cppbot::AsyncLogger (nullptr writes them to std::cerr)
+    */
+    void setLogger(std::shared_ptr< cppbot::AsyncLogger > logger);
+   protected:
+    /*!
+      @brief Method writes a record to the logger of the storage.
+      @param level Level of the record
+      @param message Message
+      @param fields Structured fields
+    */
+    void log(cppbot::LogLevel level, const std::string& message, cppbot::LogFields fields = {}) const;
+
+    /*!
+      @brief Method converts state, data and values of fields of the chat to bytes.
+      @param chatId Chat id
+      @return Encoded chat
+    */
+    std::string encodeChat(size_t chatId);
+
+    /*!
+      @brief Method replaces state, data and values of fields of the chat with decoded ones.
+      @param chatId Chat id
+      @param reader Reader of a record written by encodeChat()
+    */
+    void decodeChat(size_t chatId, detail::RecordReader& reader);
+   private:
+    struct Codec
+    {
+      std::string name;
+      encoder_t encode;
+      value_encoder_t encodeValue;
+    };
+
+    struct Decoder
+    {
+      decoder_t decode;
+      value_decoder_t decodeValue;
+    };
+
+    std::unordered_map< std::type_index, Codec > encoders_;
+    std::unordered_map< std::string, Decoder > decoders_;
+    std::unordered_set< std::string > unknownTypes_;
+    std::mutex codecMutex_;
+    std::shared_ptr< cppbot::AsyncLogger > logger_;
+
+    void registerCodec(std::type_index type, const Codec& codec, const Decoder& decoder);
+    void warnUnknownType(const std::string& name);
+  };
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*!
+  @file
+  @brief Header contains server keeping states for RemoteStorage clients.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_STATE_SERVER_HPP
+#define CPPBOT_STATE_SERVER_HPP
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <boost/asio/basic_socket_acceptor.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/io_context.hpp>
+#include "logger.hpp"
+
+namespace states
+{
+  /*!
+    @brief Server keeping encoded chats in memory for RemoteStorage clients.
+
+    Server doesn't decode chats, so it doesn't need codecs of bot types. When a client changes
+    a chat, other clients receive invalidation of it. All work is done in the thread running the context.
+  */
+  class StateServer
+  {
+   public:
+    /*!
+      @param ioContext Context running the server
+      @param address Address to listen ("tcp://host:port" or "unix:///path/to/socket")
+    */
+    StateServer(boost::asio::io_context& ioContext, const std::string& address);
+    ~StateServer();
+
+    StateServer(const StateServer&) = delete;
+    StateServer& operator=(const StateServer&) = delete;
+
+    /// Method allows to get number of kept chats.
+    size_t size() const;
+
+    /*!
+      @brief Method sets logger for errors of the server. Call it before running the context.
+      @param logger Shared pointer to cppbot::AsyncLogger (nullptr writes errors to std::cerr)
+    */
+    void setLogger(std::shared_ptr< cppbot::AsyncLogger > logger);
+   private:
+    class Connection;
+
+    boost::asio::basic_socket_acceptor< boost::asio::generic::stream_protocol > acceptor_;
+    std::unordered_map< size_t, std::string > chats_;
+    std::unordered_set< std::shared_ptr< Connection > > connections_;
+    std::shared_ptr< cppbot::AsyncLogger > logger_;
+
+    void accept();
+    void handle(const std::shared_ptr< Connection >& connection, uint8_t operation, size_t chatId,
+      std::string& payload);
+  };
+}
+
+#endif
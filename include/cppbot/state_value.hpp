@@ -0,0 +1,256 @@
+/*!
+  @file
+  @brief Header contains container for typed values of state fields.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_STATE_VALUE_HPP
+#define CPPBOT_STATE_VALUE_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+namespace states
+{
+  /*!
+    @brief Class keeping one value of any copyable type.
+
+    Values not greater than BUFFER_SIZE bytes are kept inside the object without heap allocation.
+    Type of the value is checked by comparing of pointers, so access doesn't use RTTI.
+  */
+  class Value
+  {
+   public:
+    /// Maximum size of values kept without heap allocation.
+    static constexpr size_t BUFFER_SIZE = 32;
+
+    Value() noexcept:
+      ops_(nullptr)
+    {}
+
+    Value(const Value& other):
+      ops_(nullptr)
+    {
+      if (other.ops_)
+      {
+        other.ops_->copy(other, *this);
+        ops_ = other.ops_;
+      }
+    }
+
+    Value(Value&& other) noexcept:
+      ops_(nullptr)
+    {
+      if (other.ops_)
+      {
+        other.ops_->move(other, *this);
+        ops_ = other.ops_;
+        other.ops_ = nullptr;
+      }
+    }
+
+    ~Value()
+    {
+      reset();
+    }
+
+    Value& operator=(const Value& other)
+    {
+      if (this != &other)
+      {
+        Value copy(other);
+        *this = std::move(copy);
+      }
+      return *this;
+    }
+
+    Value& operator=(Value&& other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        if (other.ops_)
+        {
+          other.ops_->move(other, *this);
+          ops_ = other.ops_;
+          other.ops_ = nullptr;
+        }
+      }
+      return *this;
+    }
+
+    /*!
+      @brief Method replaces kept value with a new one.
+      @param args Arguments of T constructor
+      @return Reference to the new value
+    */
+    template< class T, class... Args >
+    T& emplace(Args&&... args)
+    {
+      reset();
+      if constexpr (isInline< T >())
+      {
+        ::new (static_cast< void* >(buffer_)) T(std::forward< Args >(args)...);
+      }
+      else
+      {
+        heap_ = new T(std::forward< Args >(args)...);
+      }
+      ops_ = &opsOf< T >;
+      return *ptr< T >();
+    }
+
+    /*!
+      @brief Method allows to get value of certain type.
+      @return Pointer to the value or nullptr if the value is empty or has other type
+    */
+    template< class T >
+    T* find() noexcept
+    {
+      return (ops_ == &opsOf< T >) ? ptr< T >() : nullptr;
+    }
+
+    template< class T >
+    const T* find() const noexcept
+    {
+      return const_cast< Value* >(this)->find< T >();
+    }
+
+    /*!
+      @brief Method allows to get and change value of certain type.
+
+      Empty value is replaced with default constructed T.
+      @return Reference to the value
+      @throw std::bad_cast if the value has other type
+    */
+    template< class T >
+    T& get()
+    {
+      if (!ops_)
+      {
+        return emplace< T >();
+      }
+      if (ops_ != &opsOf< T >)
+      {
+        throw std::bad_cast();
+      }
+      return *ptr< T >();
+    }
+
+    /// Method checks if there is no value.
+    bool empty() const noexcept
+    {
+      return !ops_;
+    }
+
+    /// Method allows to get type of the value (typeid(void) for empty value).
+    const std::type_info& type() const noexcept
+    {
+      return ops_ ? ops_->type() : typeid(void);
+    }
+
+    /// Method destroys kept value.
+    void reset() noexcept
+    {
+      if (ops_)
+      {
+        ops_->destroy(*this);
+        ops_ = nullptr;
+      }
+    }
+   private:
+    struct Ops
+    {
+      void (*destroy)(Value&);
+      void (*copy)(const Value&, Value&);
+      void (*move)(Value&, Value&);
+      const std::type_info& (*type)();
+    };
+
+    const Ops* ops_;
+    union
+    {
+      alignas(std::max_align_t) unsigned char buffer_[BUFFER_SIZE];
+      void* heap_;
+    };
+
+    template< class T >
+    static constexpr bool isInline()
+    {
+      return (sizeof(T) <= BUFFER_SIZE) && (alignof(T) <= alignof(std::max_align_t))
+        && std::is_nothrow_move_constructible< T >::value;
+    }
+
+    template< class T >
+    T* ptr() noexcept
+    {
+      if constexpr (isInline< T >())
+      {
+        return std::launder(reinterpret_cast< T* >(buffer_));
+      }
+      else
+      {
+        return static_cast< T* >(heap_);
+      }
+    }
+
+    template< class T >
+    static void destroy(Value& value)
+    {
+      if constexpr (isInline< T >())
+      {
+        value.ptr< T >()->~T();
+      }
+      else
+      {
+        delete value.ptr< T >();
+      }
+    }
+
+    template< class T >
+    static void copy(const Value& from, Value& to)
+    {
+      const T& source = *const_cast< Value& >(from).ptr< T >();
+      if constexpr (isInline< T >())
+      {
+        ::new (static_cast< void* >(to.buffer_)) T(source);
+      }
+      else
+      {
+        to.heap_ = new T(source);
+      }
+    }
+
+    template< class T >
+    static void move(Value& from, Value& to)
+    {
+      // Heap values are moved by the pointer, the source is left without value
+      if constexpr (isInline< T >())
+      {
+        ::new (static_cast< void* >(to.buffer_)) T(std::move(*from.ptr< T >()));
+        from.ptr< T >()->~T();
+      }
+      else
+      {
+        to.heap_ = from.heap_;
+      }
+    }
+
+    template< class T >
+    static const std::type_info& typeOf()
+    {
+      return typeid(T);
+    }
+
+    template< class T >
+    static constexpr Ops opsOf = {&destroy< T >, &copy< T >, &move< T >, &typeOf< T >};
+  };
+}
+
+#endif
@@ -10,10 +10,16 @@
 #ifndef CPPBOT_STATES_HPP
 #define CPPBOT_STATES_HPP
 
+#include <chrono>
+#include <functional>
+#include <iterator>
 #include <string>
 #include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include <boost/any.hpp>
+#include "state_value.hpp"
 
 namespace states
 {
@@ -28,9 +34,180 @@ namespace states
     State();
     bool operator==(const State& other) const;
     bool operator!=(const State& other) const;
+
+    /// Method allows to get number of the state (states are numbered in order of creation).
+    size_t id() const;
+
+    /*!
+      @brief Method allows to get state by its number (used by storages restoring saved states).
+      @param id Number of the state
+    */
+    static State fromId(size_t id);
+
+    /// Method allows to get number of created states.
+    static size_t count();
    private:
     size_t id_;
     static size_t lastId_;
+
+    struct IdTag
+    {};
+    State(size_t id, IdTag);
+  };
+}
+
+namespace std
+{
+  template<>
+  struct hash< states::State >
+  {
+    size_t operator()(const states::State& obj) const
+    {
+      return obj.id_;
+    }
+  };
+}
+
+namespace states
+{
+  /*!
+    @brief State with typed value in data of the chat.
+
+    Values of fields are kept in an array of the chat indexed by number of the state and are
+    accessed without boost::any_cast (see StateContext::get()).
+    @warning Create all fields before handling updates, array of a chat is sized by number of states.
+  */
+  template< class T >
+  class Field: public State
+  {
+   public:
+    using value_type = T;
+  };
+
+  /*!
+    @brief Class keeping data of chat states in an array indexed by number of the state.
+
+    Interface is similar to std::unordered_map< State, boost::any >, empty values are treated as absent.
+    @warning Adding value of a state created after the first access can move other values,
+    so references to them become invalid.
+  */
+  class StateData
+  {
+   public:
+    template< class Any >
+    class BasicIterator
+    {
+     public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::pair< State, Any& >;
+      using difference_type = std::ptrdiff_t;
+      using pointer = void;
+      using reference = value_type;
+
+      struct Proxy
+      {
+        value_type pair;
+
+        const value_type* operator->() const
+        {
+          return &pair;
+        }
+      };
+
+      BasicIterator(Any* values, size_t index, size_t size):
+        values_(values),
+        index_(index),
+        size_(size)
+      {
+        skipEmpty();
+      }
+
+      value_type operator*() const
+      {
+        return {State::fromId(index_), values_[index_]};
+      }
+
+      Proxy operator->() const
+      {
+        return {**this};
+      }
+
+      BasicIterator& operator++()
+      {
+        ++index_;
+        skipEmpty();
+        return *this;
+      }
+
+      BasicIterator operator++(int)
+      {
+        BasicIterator copy = *this;
+        ++(*this);
+        return copy;
+      }
+
+      bool operator==(const BasicIterator& other) const
+      {
+        return index_ == other.index_;
+      }
+
+      bool operator!=(const BasicIterator& other) const
+      {
+        return index_ != other.index_;
+      }
+     private:
+      Any* values_;
+      size_t index_;
+      size_t size_;
+
+      void skipEmpty()
+      {
+        while ((index_ < size_) && values_[index_].empty())
+        {
+          ++index_;
+        }
+      }
+    };
+
+    using iterator = BasicIterator< boost::any >;
+    using const_iterator = BasicIterator< const boost::any >;
+
+    /*!
+      @brief Operator allows to get and change value of the state, empty value is added if absent.
+      @param state State
+      @return boost::any
+    */
+    boost::any& operator[](const State& state);
+
+    /*!
+      @brief Method allows to get value of the state.
+      @param state State
+      @return boost::any
+      @throw std::out_of_range if there is no value
+    */
+    boost::any& at(const State& state);
+    const boost::any& at(const State& state) const;
+
+    /*!
+      @brief Method allows to find value of the state.
+      @param state State
+      @return Iterator to the value or end()
+    */
+    iterator find(const State& state);
+    const_iterator find(const State& state) const;
+
+    size_t count(const State& state) const;
+    void erase(const State& state);
+    void clear();
+    size_t size() const;
+    bool empty() const;
+
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+   private:
+    std::vector< boost::any > values_;
   };
 
   /*!
@@ -39,26 +216,53 @@ namespace states
   class StatesForm
   {
    public:
-    using Data = std::unordered_map< State, boost::any >;
+    using Data = StateData;
   };
 
   /*!
     @brief Class storing states data.
+
+    Chats are distributed among shards, each shard has its own lock, so chats of different shards
+    are accessed in parallel and reading of states doesn't block other readers. State and data of
+    a chat are kept together in one session found by a single lookup in a flat hash table.
+    Data of one chat must not be changed from several threads at the same time.
+
+    Chats that were not accessed for some time can be expired (see setExpiration()) and number of
+    kept chats can be limited (see setMaxChats()). Chats of every shard are kept in order of access,
+    so only the oldest ones are checked and eviction doesn't scan the whole storage.
   */
   class Storage
   {
    public:
-    friend class StateMachine;
-    friend class StateContext;
+    using duration_t = std::chrono::steady_clock::duration;
+    using eviction_handler_t = std::function< void(size_t chatId) >;
 
-    Storage();
+    /*!
+      @param shards Number of shards (rounded up to a power of two)
+    */
+    Storage(size_t shards = 64);
+    virtual ~Storage();
+
+    /*!
+      @brief Method allows to get current state of user.
+      @param chatId Chat id
+      @return Current state or StateMachine::DEFAULT_STATE
+    */
+    virtual State state(size_t chatId) const;
+
+    /*!
+      @brief Method allows to set current state of user.
+      @param chatId Chat id
+      @param state State to set
+    */
+    virtual void setState(size_t chatId, const State& state);
 
     /*!
       @brief Method allows to get and change current states data.
       @param chatId Chat id
       @return Hash map where key is a state object, value is boost::any
     */
-    StatesForm::Data& data(size_t chatId);
+    virtual StatesForm::Data& data(size_t chatId);
 
     /*!
       @brief Method allows to get and change data of certain state.
@@ -66,16 +270,109 @@ namespace states
       @param state State for gain access to it's data
       @return boost::any
     */
-    boost::any& data(size_t chatId, const State& state);
+    virtual boost::any& data(size_t chatId, const State& state);
+
+    /*!
+      @brief Method allows to get and change typed value of certain state (see Field).
+      @param chatId Chat id
+      @param state State for gain access to it's value
+      @return Value kept separately from boost::any data
+    */
+    virtual Value& value(size_t chatId, const State& state);
+
+    /*!
+      @brief Method allows to delete state and all states data of certain user.
+      @param chatId Chat id
+    */
+    virtual void remove(size_t chatId);
+
+    /*!
+      @brief Method sets time after which state and data of a chat not accessed are deleted.
+      @param ttl Time to live, zero disables expiration
+    */
+    void setExpiration(duration_t ttl);
+
+    /*!
+      @brief Method limits number of kept chats, least recently used chats are deleted.
+      @param maxChats Maximum number of chats, zero disables the limit
+      @warning Data got by reference stays valid only while its chat is kept, so the limit must be much
+      greater than number of chats handled at the same time.
+    */
+    void setMaxChats(size_t maxChats);
+
+    /*!
+      @brief Method sets function called for every chat deleted because of expiration or the limit.
+      @param handler Function taking chat id
+    */
+    void setEvictionHandler(eviction_handler_t handler);
+
+    /*!
+      @brief Method deletes expired chats of all shards.
+
+      Expired chats of a shard are also deleted when a new chat is added to it.
+    */
+    void expire();
+
+    /*!
+      @brief Method is called by the bot after an update of the chat was handled.
+
+      Storages saving data somewhere override it to save changes of the chat.
+      @param chatId Chat id
+    */
+    virtual void commit(size_t chatId);
+   protected:
+    /*!
+      @brief Method is called for every chat deleted because of expiration or the limit.
+      @param chatId Chat id
+    */
+    virtual void evicted(size_t chatId);
+
+    /*!
+      @brief Method calls function for every not empty typed value of the chat.
+      @param chatId Chat id
+      @param visit Function taking number of the state and its value
+    */
+    void forEachValue(size_t chatId, const std::function< void(size_t, const Value&) >& visit) const;
+
+    /*!
+      @brief Method deletes the chat if it's expired, otherwise marks it as accessed now.
+
+      Storages keeping a copy of chats elsewhere call it before using their copy, so an expired chat
+      is reported to evicted() before it's read again, not in the middle of changing it.
+      @param chatId Chat id
+    */
+    void refresh(size_t chatId);
 
     /*!
-      @brief Method allows to delete all states data of certain user.
+      @brief Method resets state of the chat to default and clears its data keeping references valid.
+      @param chatId Chat id
+    */
+    void reset(size_t chatId);
+
+    /*!
+      @brief Method allows to get number of the shard keeping the chat.
+
+      Chats evicted while a chat is added belong to its shard.
       @param chatId Chat id
     */
-    void remove(size_t chatId);
+    size_t shardIndex(size_t chatId) const;
    private:
-    std::unordered_map< size_t, State > currentStates_;
-    std::unordered_map< size_t, StatesForm::Data > data_;
+    struct Session;
+    struct Shard;
+
+    std::unique_ptr< Shard[] > shards_;
+    size_t shardMask_;
+    duration_t::rep ttl_;
+    size_t maxChatsPerShard_;
+    eviction_handler_t evictionHandler_;
+
+    Shard& shardOf(size_t chatId) const;
+    bool isExpired(const Session& session, duration_t::rep now) const;
+    Session* find(const Shard& shard, size_t chatId, duration_t::rep now) const;
+    Session& acquire(Shard& shard, size_t chatId, std::vector< size_t >& evictedChats);
+    void expire(Shard& shard, duration_t::rep now, std::vector< size_t >& evictedChats);
+    void erase(Shard& shard, Session& session);
+    void notifyEvicted(const std::vector< size_t >& evictedChats);
   };
 
   /*!
@@ -106,6 +403,12 @@ namespace states
       @return User current state
     */
     State getState(size_t chatId) const;
+
+    /*!
+      @brief Method saves changes of user states (see Storage::commit()).
+      @param chatId Chat id
+    */
+    void commit(size_t chatId) const;
    private:
     std::shared_ptr< Storage > storage_;
   };
@@ -154,21 +457,30 @@ namespace states
       @return boost::any
     */
     boost::any& data(const State& state);
-   private:
-    size_t chatId_;
-    StateMachine* stateMachine_;
-  };
-}
 
-namespace std
-{
-  template<>
-  struct hash< states::State >
-  {
-    size_t operator()(const states::State& obj) const
+    /*!
+      @brief Method allows to get and change value of the field.
+
+      Value that wasn't set is default constructed.
+      @param field Field of a form
+      @return Reference to the value
+      @throw std::bad_cast if the value was set through value() with other type
+    */
+    template< class T >
+    T& get(const Field< T >& field)
     {
-      return obj.id_;
+      return value(field).template get< T >();
     }
+
+    /*!
+      @brief Method allows to get and change typed value of certain state.
+      @param state State for gain access to it's value
+      @return Value object
+    */
+    Value& value(const State& state);
+   private:
+    size_t chatId_;
+    StateMachine* stateMachine_;
   };
 }
 
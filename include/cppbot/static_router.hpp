@@ -0,0 +1,124 @@
+/*!
+  @file
+  @brief Header contains router with commands and handlers known at compile time.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_STATIC_ROUTER_HPP
+#define CPPBOT_STATIC_ROUTER_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+namespace handlers
+{
+  namespace detail
+  {
+    constexpr uint64_t staticHash(std::string_view key) noexcept
+    {
+      // FNV-1a
+      uint64_t h = 14695981039346656037ULL;
+      for (char c : key)
+      {
+        h ^= static_cast< unsigned char >(c);
+        h *= 1099511628211ULL;
+      }
+      return h;
+    }
+
+    template< size_t N >
+    constexpr bool areUnique(const std::array< std::string_view, N >& keys)
+    {
+      for (size_t i = 0; i < N; ++i)
+      {
+        for (size_t j = i + 1; j < N; ++j)
+        {
+          if (keys[i] == keys[j])
+          {
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+
+    template< auto Handler, class First, class... Rest >
+    void callHandler(First& first, Rest&... rest)
+    {
+      if constexpr (std::is_invocable_v< decltype(Handler), First&, Rest&... >)
+      {
+        Handler(first, rest...);
+      }
+      else
+      {
+        static_assert(std::is_invocable_v< decltype(Handler), First& >, "Handler has unsupported signature");
+        Handler(first);
+      }
+    }
+  }
+
+  /*!
+    @brief Route binding compile-time key (command or callback data) to a handler.
+
+    Key must be a constant with static storage:
+    @code
+    static constexpr char START[] = "/start";
+    using StartRoute = handlers::Route< START, &onStart >;
+    @endcode
+    @tparam Key Command or callback data
+    @tparam Handler Pointer to a function (or a constexpr function object) called for the key
+  */
+  template< const char* Key, auto Handler >
+  struct Route
+  {
+    static constexpr std::string_view key = Key;
+    static constexpr uint64_t hash = detail::staticHash(key);
+    static constexpr auto handler = Handler;
+  };
+
+  /*!
+    @brief Router dispatching keys to handlers without hash tables and std::function.
+
+    Comparisons with all keys are generated at compile time, so handlers can be inlined.
+    Set it to MessageHandler or CallbackQueryHandler with setStaticRouter(); keys which are
+    not found here are looked up among handlers added with addHandler().
+    @tparam Routes Route types
+  */
+  template< class... Routes >
+  class StaticRouter
+  {
+    static_assert(detail::areUnique< sizeof...(Routes) >({Routes::key...}), "Keys of routes must be unique");
+   public:
+    /*!
+      @brief Method calls handler of key.
+      @param key Command or callback data
+      @param args Arguments of handler (handler may take only the first one)
+      @return false if there is no route for the key
+    */
+    template< class... Args >
+    static bool dispatch(std::string_view key, Args&... args)
+    {
+      uint64_t h = detail::staticHash(key);
+      return (tryRoute< Routes >(h, key, args...) || ...);
+    }
+   private:
+    template< class R, class... Args >
+    static bool tryRoute(uint64_t h, std::string_view key, Args&... args)
+    {
+      if ((h != R::hash) || (key != R::key))
+      {
+        return false;
+      }
+      detail::callHandler< R::handler >(args...);
+      return true;
+    }
+  };
+}
+
+#endif
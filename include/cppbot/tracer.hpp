@@ -0,0 +1,154 @@
+/*!
+  @file
+  @brief Header contains tracer recording spans of update handling.
+  @author sbabinov92
+  @version 1.0
+  @date April 2025
+  @warning The project is still in development
+*/
+
+#ifndef CPPBOT_TRACER_HPP
+#define CPPBOT_TRACER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cppbot
+{
+  /*!
+    @brief Class keeps spans of sampled updates in a ring buffer.
+
+    Spans of one update share its update_id: ingest, queue wait, handler and every request sent
+    by the handler with its phases (resolve, connect, handshake, write, read). When the buffer is full,
+    the oldest spans are overwritten. Recording doesn't allocate after the buffer is warmed up
+    and doesn't take locks except a spin flag of the slot.
+  */
+  class Tracer
+  {
+   public:
+    using clock_t = std::chrono::steady_clock;
+
+    /// Recorded span.
+    struct Span
+    {
+      uint64_t traceId; ///< update_id
+      std::string category;
+      std::string name;
+      std::string detail; ///< Endpoint, handler key or type of the update
+      clock_t::time_point start;
+      clock_t::duration duration;
+      uint32_t thread; ///< Number of the recording thread
+    };
+
+    /*!
+      @brief Trace of one update, empty if the update isn't sampled.
+    */
+    struct Context
+    {
+      std::shared_ptr< Tracer > tracer;
+      uint64_t traceId = 0;
+
+      explicit operator bool() const
+      {
+        return static_cast< bool >(tracer);
+      }
+
+      /*!
+        @brief Method records a span finished now, does nothing for empty context.
+        @param category Category of the span
+        @param name Name of the span
+        @param detail Details of the span
+        @param start Start of the span
+      */
+      void record(const char* category, const char* name, const std::string& detail, clock_t::time_point start) const;
+    };
+
+    /*!
+      @brief RAII object making trace current for the calling thread.
+
+      Requests sent while the scope exists belong to its trace.
+    */
+    class Scope
+    {
+     public:
+      explicit Scope(Context context);
+      ~Scope();
+
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+     private:
+      Context previous_;
+    };
+
+    /*!
+      @param sampleRate Part of updates to be traced (from 0 to 1)
+      @param capacity Number of kept spans
+    */
+    explicit Tracer(double sampleRate = 1.0, size_t capacity = 65536);
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    /// Function allows to get trace of the calling thread.
+    static const Context& current();
+
+    /*!
+      @brief Function starts trace of an update if it's sampled.
+      @param tracer Tracer, nullptr disables tracing
+      @param traceId update_id
+      @return Context, empty if the update isn't sampled
+    */
+    static Context start(const std::shared_ptr< Tracer >& tracer, uint64_t traceId);
+
+    /*!
+      @brief Method checks if an update is sampled. Result is the same for the same update.
+      @param traceId update_id
+    */
+    bool isSampled(uint64_t traceId) const;
+
+    /*!
+      @brief Method records a span.
+      @param traceId update_id
+      @param category Category of the span
+      @param name Name of the span
+      @param detail Details of the span
+      @param start Start of the span
+      @param end End of the span
+    */
+    void record(uint64_t traceId, const char* category, const char* name, const std::string& detail,
+      clock_t::time_point start, clock_t::time_point end);
+
+    /// Method allows to get kept spans from the oldest one.
+    std::vector< Span > spans() const;
+
+    /*!
+      @brief Method exports kept spans in Chrome trace event format.
+
+      Result can be opened in chrome://tracing or Perfetto, spans of every update are shown in its own row.
+      @return JSON text
+    */
+    std::string chromeTrace() const;
+
+    /// Method removes all kept spans.
+    void clear();
+   private:
+    struct Slot
+    {
+      mutable std::atomic< bool > isBusy;
+      bool isSet;
+      Span span;
+    };
+
+    uint64_t threshold_; ///< Updates with hash below it are sampled
+    clock_t::time_point origin_;
+    std::unique_ptr< Slot[] > slots_;
+    size_t capacity_;
+    std::atomic< size_t > next_;
+  };
+}
+
+#endif
@@ -10,6 +10,8 @@
 #ifndef CPPBOT_TYPES_HPP
 #define CPPBOT_TYPES_HPP
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -185,6 +187,13 @@ namespace types
   void to_json(json& j, const Message& msg);
   void from_json(const json& j, Message& msg);
 
+  /// Struct represents a unique message identifier.
+  struct MessageId
+  {
+    size_t id;
+  };
+  void from_json(const json& j, MessageId& messageId);
+
   /// Struct represents an incoming callback query from a callback button in an InlineKeyboard.
   struct CallbackQuery
   {
@@ -200,6 +209,22 @@ namespace types
   class InputFile
   {
    public:
+    /// Where the content of a file is taken from.
+    enum Source
+    {
+      PATH,     ///< File on disk
+      BUFFER,   ///< Bytes in memory
+      GENERATOR ///< Callback producing bytes while sending
+    };
+
+    /// Immutable bytes which can be shared between several files without copying.
+    using buffer_t = std::shared_ptr< const std::string >;
+
+    /// Callback writes at most {size} bytes to {buffer} and returns their count, 0 means the end of a file.
+    using generator_t = std::function< size_t(char* buffer, size_t size) >;
+
+    static constexpr size_t UNKNOWN_SIZE = static_cast< size_t >(-1);
+
     InputFile() = default;
 
     /*!
@@ -207,13 +232,53 @@ namespace types
     */
     InputFile(const std::string& path);
 
+    /*!
+      @param name File name shown to the user
+      @param content Bytes of a file (file takes ownership of them)
+    */
+    InputFile(const std::string& name, std::string content);
+
+    /*!
+      @param name File name shown to the user
+      @param content Bytes of a file, the same buffer can be sent to many chats
+    */
+    InputFile(const std::string& name, buffer_t content);
+
+    /*!
+      @param name File name shown to the user
+      @param generator Callback producing bytes of a file, it is called only while sending
+      @param size File size if it is known beforehand
+      @warning File with generator can be sent only once
+    */
+    InputFile(const std::string& name, generator_t generator, size_t size = UNKNOWN_SIZE);
+
     /// Method allows to get file name (without full path).
     std::string name() const;
 
     /// Method allows to get a file as a string of bytes.
     std::string bytes() const;
+
+    /// Method allows to get a path to the file (empty if file is not on disk).
+    std::string path() const;
+
+    /// Method allows to get a file size in bytes (UNKNOWN_SIZE for generator without size).
+    size_t size() const;
+
+    /// Method allows to get a source of file content.
+    Source source() const;
+
+    /// Method allows to get file bytes if file is stored in memory.
+    buffer_t buffer() const;
+
+    /// Method allows to get callback producing file bytes.
+    generator_t generator() const;
    private:
+    Source source_ = PATH;
     std::string path_;
+    std::string name_;
+    buffer_t buffer_;
+    generator_t generator_;
+    size_t size_ = UNKNOWN_SIZE;
   };
 
   enum MediaType
@@ -237,6 +302,13 @@ namespace types
     */
     InputMedia(MediaType mediaType, const std::string& path, const std::string& caption = "");
 
+    /*!
+      @param mediaType Type of media
+      @param file File to be sent
+      @param caption Caption for a media
+    */
+    InputMedia(MediaType mediaType, const InputFile& file, const std::string& caption = "");
+
     /// Method allows to get a media type.
     std::string type() const;
 
@@ -261,11 +333,22 @@ namespace types
     */
     InputMediaPhoto(const std::string& path);
 
+    /*!
+      @param file File to be sent
+    */
+    InputMediaPhoto(const InputFile& file);
+
     /*!
       @param path Path to a file
       @param hasSpoiler If true, photo will be covered with a spoiler animation
     */
     InputMediaPhoto(const std::string& path, bool hasSpoiler);
+
+    /*!
+      @param file File to be sent
+      @param hasSpoiler If true, photo will be covered with a spoiler animation
+    */
+    InputMediaPhoto(const InputFile& file, bool hasSpoiler);
   };
 
   /// Class represents a document to be sent.
@@ -276,6 +359,11 @@ namespace types
       @param path Path to a file
     */
     InputMediaDocument(const std::string& path);
+
+    /*!
+      @param file File to be sent
+    */
+    InputMediaDocument(const InputFile& file);
   };
 
   /// Class represents an audio to be sent.
@@ -286,6 +374,11 @@ namespace types
       @param path Path to a file
     */
     InputMediaAudio(const std::string& path);
+
+    /*!
+      @param file File to be sent
+    */
+    InputMediaAudio(const InputFile& file);
   };
 
   /// Class represents a video to be sent.
@@ -297,11 +390,22 @@ namespace types
     */
     InputMediaVideo(const std::string& path);
 
+    /*!
+      @param file File to be sent
+    */
+    InputMediaVideo(const InputFile& file);
+
     /*!
       @param path Path to a file
       @param hasSpoiler If true, video will be covered with a spoiler animation
     */
     InputMediaVideo(const std::string& path, bool hasSpoiler);
+
+    /*!
+      @param file File to be sent
+      @param hasSpoiler If true, video will be covered with a spoiler animation
+    */
+    InputMediaVideo(const InputFile& file, bool hasSpoiler);
   };
 }
 
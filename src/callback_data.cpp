@@ -0,0 +1,170 @@
+#include "cppbot/callback_data.hpp"
+#include <stdexcept>
+
+namespace
+{
+  constexpr char BASE64_URL_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+  int decodeBase64UrlChar(char c)
+  {
+    if ((c >= 'A') && (c <= 'Z'))
+    {
+      return c - 'A';
+    }
+    if ((c >= 'a') && (c <= 'z'))
+    {
+      return c - 'a' + 26;
+    }
+    if ((c >= '0') && (c <= '9'))
+    {
+      return c - '0' + 52;
+    }
+    if (c == '-')
+    {
+      return 62;
+    }
+    if (c == '_')
+    {
+      return 63;
+    }
+    return -1;
+  }
+}
+
+std::string handlers::detail::encodeBase64Url(const uint8_t* data, size_t size)
+{
+  std::string result;
+  result.reserve((size * 4 + 2) / 3);
+  uint32_t bits = 0;
+  int bitCount = 0;
+  for (size_t i = 0; i < size; ++i)
+  {
+    bits = (bits << 8) | data[i];
+    bitCount += 8;
+    while (bitCount >= 6)
+    {
+      bitCount -= 6;
+      result += BASE64_URL_ALPHABET[(bits >> bitCount) & 0x3F];
+    }
+  }
+  if (bitCount > 0)
+  {
+    result += BASE64_URL_ALPHABET[(bits << (6 - bitCount)) & 0x3F];
+  }
+  return result;
+}
+
+size_t handlers::detail::decodeBase64Url(std::string_view data, uint8_t* buffer, size_t capacity)
+{
+  uint32_t bits = 0;
+  int bitCount = 0;
+  size_t size = 0;
+  for (char c : data)
+  {
+    int value = decodeBase64UrlChar(c);
+    if (value < 0)
+    {
+      return 0;
+    }
+    bits = (bits << 6) | static_cast< uint32_t >(value);
+    bitCount += 6;
+    if (bitCount >= 8)
+    {
+      bitCount -= 8;
+      if (size == capacity)
+      {
+        return 0;
+      }
+      buffer[size++] = static_cast< uint8_t >(bits >> bitCount);
+    }
+  }
+  return size;
+}
+
+handlers::CallbackDataWriter::CallbackDataWriter(uint8_t actionId):
+  bytes_(1, static_cast< char >(actionId))
+{}
+
+std::string handlers::CallbackDataWriter::str() const
+{
+  if (bytes_.size() > detail::MAX_CALLBACK_PAYLOAD_SIZE)
+  {
+    throw std::length_error("Callback data is longer than 64 bytes");
+  }
+  return detail::CALLBACK_DATA_PREFIX
+    + detail::encodeBase64Url(reinterpret_cast< const uint8_t* >(bytes_.data()), bytes_.size());
+}
+
+void handlers::CallbackDataWriter::writeVarint(uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    bytes_ += static_cast< char >((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  bytes_ += static_cast< char >(value);
+}
+
+void handlers::CallbackDataWriter::writeSigned(int64_t value)
+{
+  writeVarint((static_cast< uint64_t >(value) << 1) ^ static_cast< uint64_t >(value >> 63));
+}
+
+void handlers::CallbackDataWriter::writeString(const std::string& value)
+{
+  writeVarint(value.size());
+  bytes_ += value;
+}
+
+handlers::CallbackDataReader::CallbackDataReader(const uint8_t* data, size_t size):
+  data_(data),
+  size_(size),
+  isValid_(true)
+{}
+
+bool handlers::CallbackDataReader::isValid() const
+{
+  return isValid_ && (size_ == 0);
+}
+
+bool handlers::CallbackDataReader::readVarint(uint64_t& value)
+{
+  value = 0;
+  for (int shift = 0; isValid_ && (size_ > 0) && (shift < 64); shift += 7)
+  {
+    uint8_t byte = *data_++;
+    --size_;
+    value |= static_cast< uint64_t >(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  isValid_ = false;
+  return false;
+}
+
+bool handlers::CallbackDataReader::readSigned(int64_t& value)
+{
+  uint64_t raw = 0;
+  if (!readVarint(raw))
+  {
+    return false;
+  }
+  value = static_cast< int64_t >(raw >> 1) ^ -static_cast< int64_t >(raw & 1);
+  return true;
+}
+
+bool handlers::CallbackDataReader::readString(std::string& value)
+{
+  uint64_t size = 0;
+  if (!readVarint(size) || (size > size_))
+  {
+    isValid_ = false;
+    return false;
+  }
+  value.assign(reinterpret_cast< const char* >(data_), size);
+  data_ += size;
+  size_ -= size;
+  return true;
+}
@@ -0,0 +1,154 @@
+#include "cppbot/connection_pool.hpp"
+#include <boost/asio/connect.hpp>
+
+namespace asio = boost::asio;
+
+namespace
+{
+  // Telegram closes idle connections by itself, so old ones are not worth trying
+  constexpr std::chrono::seconds MAX_IDLE_TIME(30);
+}
+
+cppbot::ConnectionPool::ConnectionPool(asio::io_context& ioContext, asio::ssl::context& sslContext,
+  const std::string& host, const std::string& port, size_t maxIdle):
+  ioContext_(ioContext),
+  sslContext_(sslContext),
+  host_(host),
+  port_(port),
+  maxIdle_(maxIdle),
+  idle_(),
+  active_(0),
+  mutex_()
+{}
+
+void cppbot::ConnectionPool::acquire(handler_t handler, bool allowReuse, phase_handler_t onPhase)
+{
+  connection_t connection;
+  {
+    std::lock_guard< std::mutex > lock(mutex_);
+    ++active_;
+    auto now = std::chrono::steady_clock::now();
+    while (allowReuse && !idle_.empty() && !connection)
+    {
+      IdleConnection candidate = idle_.back();
+      idle_.pop_back();
+      if ((now - candidate.since < MAX_IDLE_TIME) && candidate.connection->next_layer().is_open())
+      {
+        connection = candidate.connection;
+      }
+    }
+  }
+  if (connection)
+  {
+    handler({}, connection, true);
+    return;
+  }
+  connect(handler, onPhase);
+}
+
+void cppbot::ConnectionPool::release(connection_t connection)
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  if (active_ > 0)
+  {
+    --active_;
+  }
+  if (!connection->next_layer().is_open())
+  {
+    return;
+  }
+  if (idle_.size() >= maxIdle_)
+  {
+    idle_.pop_front();
+  }
+  idle_.push_back({connection, std::chrono::steady_clock::now()});
+}
+
+void cppbot::ConnectionPool::discard(connection_t connection)
+{
+  if (connection)
+  {
+    boost::system::error_code ec;
+    connection->next_layer().close(ec);
+  }
+  std::lock_guard< std::mutex > lock(mutex_);
+  if (active_ > 0)
+  {
+    --active_;
+  }
+}
+
+size_t cppbot::ConnectionPool::idle() const
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  return idle_.size();
+}
+
+size_t cppbot::ConnectionPool::active() const
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  return active_;
+}
+
+void cppbot::ConnectionPool::clear()
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  idle_.clear();
+}
+
+void cppbot::ConnectionPool::connect(handler_t handler, phase_handler_t onPhase)
+{
+  auto resolver = std::make_shared< asio::ip::tcp::resolver >(ioContext_);
+  auto connection = std::make_shared< stream_t >(ioContext_, sslContext_);
+  auto fail = [this, handler](const boost::system::error_code& ec)
+  {
+    {
+      std::lock_guard< std::mutex > lock(mutex_);
+      --active_;
+    }
+    handler(ec, nullptr, false);
+  };
+
+  if (!SSL_set_tlsext_host_name(connection->native_handle(), host_.c_str()))
+  {
+    fail(boost::system::error_code(static_cast< int >(::ERR_get_error()), asio::error::get_ssl_category()));
+    return;
+  }
+  auto phaseStart = std::make_shared< std::chrono::steady_clock::time_point >(std::chrono::steady_clock::now());
+  auto finishPhase = [onPhase, phaseStart](const char* phase)
+  {
+    if (onPhase)
+    {
+      onPhase(phase, *phaseStart);
+      *phaseStart = std::chrono::steady_clock::now();
+    }
+  };
+  resolver->async_resolve(host_, port_, [resolver, connection, handler, fail, finishPhase](auto ec, auto endpoints)
+  {
+    if (ec)
+    {
+      fail(ec);
+      return;
+    }
+    finishPhase("resolve");
+    asio::async_connect(connection->next_layer(), endpoints, [connection, handler, fail, finishPhase](auto ec, auto)
+    {
+      if (ec)
+      {
+        fail(ec);
+        return;
+      }
+      finishPhase("connect");
+      connection->async_handshake(asio::ssl::stream_base::client, [connection, handler, fail, finishPhase](auto ec)
+      {
+        if (ec)
+        {
+          fail(ec);
+          return;
+        }
+        finishPhase("handshake");
+        handler(ec, connection, false);
+      });
+    });
+  });
+}
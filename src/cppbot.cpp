@@ -2,37 +2,97 @@
 #include <iostream>
 #include <functional>
 #include <future>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
 #include <utility>
 #include "cppbot/types.hpp"
+#include "cppbot/multipart.hpp"
+#include "ktls.hpp"
 
 namespace asio = boost::asio;
 namespace beast = boost::beast;
 namespace http = beast::http;
 
+// Telegram accepts at most 100 message ids in one bulk request
+constexpr size_t MAX_BATCH_SIZE = 100;
+// Zero-copy uploads are blocking, they run on own threads
+constexpr size_t UPLOAD_THREADS = 4;
+constexpr std::chrono::seconds UPLOAD_TIMEOUT(60);
+
 std::string generateBoundary()
 {
   return "----CppbotBoundary" + std::to_string(rand());
 }
 
-std::string createMultipartBody(const std::string& boundary, const nlohmann::json& fields,
-  const std::string& formDataName, const types::InputFile& file, bool isEditing = false)
+std::string extractFileId(const nlohmann::json& message, const std::string& fileType)
 {
-  std::string body = "";
+  if (!message.is_object() || !message.contains(fileType))
+  {
+    return "";
+  }
+  const nlohmann::json& media = message[fileType];
+  if (media.is_array())
+  {
+    // Photos are returned in several sizes, the biggest one is the last
+    return media.empty() ? "" : media.back().value("file_id", "");
+  }
+  return media.value("file_id", "");
+}
 
-  for (const auto& [field, value] : fields.items())
+// Allows to describe exception caught by catch (...)
+std::string currentError()
+{
+  try
+  {
+    throw;
+  }
+  catch (const std::exception& e)
   {
-    body += "--" + boundary + "\r\n";
-    body += "Content-Disposition: form-data; name=\"" + field + "\"\r\n\r\n";
-    body += value.dump() + "\r\n";
+    return e.what();
   }
+  catch (...)
+  {
+    return "unknown exception";
+  }
+}
 
-  body += "--" + boundary + "\r\n";
-  body += "Content-Disposition: form-data; name=\"" + formDataName + "\"; filename=\"" + file.name() + "\"\r\n";
-  body += "Content-type: application/octet-stream\r\n\r\n";
-  body += file.bytes() + "\r\n";
+// Request target is "/bot<token>/method", token must not get into metrics
+std::string endpointOf(boost::beast::string_view target)
+{
+  size_t slash = target.rfind('/');
+  return std::string((slash == boost::beast::string_view::npos) ? target : target.substr(slash));
+}
 
-  body += "--" + boundary + "--\r\n";
-  return body;
+// Calls "before" hooks until one of them stops processing, then handler and "after" hooks in reverse order
+template< class Handler, class... Update >
+void runMiddlewares(const std::vector< std::shared_ptr< handlers::Middleware > >& chain, Handler handler,
+  Update&... update)
+{
+  size_t passed = 0;
+  try
+  {
+    while ((passed < chain.size()) && chain[passed]->before(update...))
+    {
+      ++passed;
+    }
+    if (passed == chain.size())
+    {
+      handler();
+    }
+  }
+  catch (...)
+  {
+    for (size_t i = passed; i > 0; --i)
+    {
+      chain[i - 1]->after(update...);
+    }
+    throw;
+  }
+  for (size_t i = passed; i > 0; --i)
+  {
+    chain[i - 1]->after(update...);
+  }
 }
 
 cppbot::Bot::Bot(const std::string& token, std::shared_ptr< handlers::MessageHandler > mh,
@@ -42,11 +102,29 @@ cppbot::Bot::Bot(const std::string& token, std::shared_ptr< handlers::MessageHan
   qh_(qh),
   sslContext_(asio::ssl::context::tlsv12_client),
   stateMachine_(storage),
-  isRunning_(false)
+  pool_(ioContext_, sslContext_, "api.telegram.org", "443"),
+  isRunning_(false),
+  zeroCopyUploads_(false),
+  fileCache_(),
+  dispatcher_(),
+  monitor_(),
+  instruments_(),
+  metricsServer_(),
+  tracer_(),
+  logger_(std::make_shared< AsyncLogger >()),
+  deleteBatchWindow_(0),
+  pendingDeletes_(),
+  deleteMutex_(),
+  uploadPool_()
 {
   sslContext_.set_default_verify_paths();
 }
 
+cppbot::Bot::~Bot()
+{
+  stop();
+}
+
 void cppbot::Bot::startPolling()
 {
   isRunning_ = true;
@@ -55,14 +133,145 @@ void cppbot::Bot::startPolling()
   processUpdates();
 }
 
+void cppbot::Bot::setZeroCopyUploads(bool enable)
+{
+  zeroCopyUploads_ = enable;
+  if (enable && !uploadPool_)
+  {
+    uploadPool_ = std::make_unique< asio::thread_pool >(UPLOAD_THREADS);
+  }
+}
+
+void cppbot::Bot::setFileCache(std::shared_ptr< FileIdCache > cache)
+{
+  fileCache_ = cache;
+}
+
+void cppbot::Bot::setWorkers(size_t workers, size_t maxQueued, size_t maxQueuedPerChat)
+{
+  if (dispatcher_ && dispatcher_->isWorker())
+  {
+    // Destroying the dispatcher would destroy the worker running this handler
+    throw std::logic_error("Workers can't be changed from a handler running on a worker");
+  }
+  dispatcher_.reset();
+  if (workers > 0)
+  {
+    dispatcher_ = std::make_unique< Dispatcher >(workers, maxQueued, maxQueuedPerChat);
+    dispatcher_->setLogger(logger_);
+  }
+}
+
+void cppbot::Bot::setMonitor(std::shared_ptr< Monitor > monitor)
+{
+  monitor_ = monitor;
+}
+
+struct cppbot::Bot::Instruments
+{
+  Bot* bot;
+  std::shared_ptr< Metrics > metrics;
+  Counter& messages;
+  Counter& queries;
+  Histogram& messageHandlers;
+  Histogram& queryHandlers;
+};
+
+void cppbot::Bot::setMetrics(std::shared_ptr< Metrics > metrics)
+{
+  instruments_.reset();
+  if (!metrics)
+  {
+    return;
+  }
+  const std::string updatesHelp = "Updates received from Telegram";
+  const std::string handlersHelp = "Time of handling an update with middlewares";
+  instruments_ = std::make_shared< Instruments >(Instruments{this, metrics,
+    metrics->counter("cppbot_updates_total", updatesHelp, {{"type", "message"}}),
+    metrics->counter("cppbot_updates_total", updatesHelp, {{"type", "callback_query"}}),
+    metrics->histogram("cppbot_handler_duration_seconds", handlersHelp, {{"type", "message"}}),
+    metrics->histogram("cppbot_handler_duration_seconds", handlersHelp, {{"type", "callback_query"}})});
+
+  // Gauges are read while scraping, they must not outlive the bot
+  std::weak_ptr< Instruments > weak = instruments_;
+  auto gauge = [weak](std::function< double(Bot&) > read)
+  {
+    return [weak, read]()
+    {
+      std::shared_ptr< Instruments > instruments = weak.lock();
+      return instruments ? read(*instruments->bot) : std::numeric_limits< double >::quiet_NaN();
+    };
+  };
+  const std::string queueHelp = "Updates waiting for handling";
+  metrics->gauge("cppbot_queue_depth", queueHelp, gauge([](Bot& bot)
+  {
+    std::lock_guard< std::mutex > lock(bot.updateMutex_);
+    return static_cast< double >(bot.messageQueue_.size());
+  }), {{"queue", "message"}});
+  metrics->gauge("cppbot_queue_depth", queueHelp, gauge([](Bot& bot)
+  {
+    std::lock_guard< std::mutex > lock(bot.updateMutex_);
+    return static_cast< double >(bot.queryQueue_.size());
+  }), {{"queue", "callback_query"}});
+  metrics->gauge("cppbot_queue_depth", queueHelp, gauge([](Bot& bot)
+  {
+    return bot.dispatcher_ ? static_cast< double >(bot.dispatcher_->queued()) : 0.0;
+  }), {{"queue", "dispatcher"}});
+  const std::string poolHelp = "Connections to Telegram in the pool";
+  metrics->gauge("cppbot_pool_connections", poolHelp, gauge([](Bot& bot)
+  {
+    return static_cast< double >(bot.pool_.active());
+  }), {{"state", "active"}});
+  metrics->gauge("cppbot_pool_connections", poolHelp, gauge([](Bot& bot)
+  {
+    return static_cast< double >(bot.pool_.idle());
+  }), {{"state", "idle"}});
+}
+
+void cppbot::Bot::serveMetrics(unsigned short port, const std::string& address)
+{
+  if (!instruments_)
+  {
+    setMetrics(std::make_shared< Metrics >());
+  }
+  metricsServer_ = std::make_unique< MetricsServer >(ioContext_, instruments_->metrics, port, address);
+  metricsServer_->setLogger(logger_);
+}
+
+void cppbot::Bot::setTracer(std::shared_ptr< Tracer > tracer)
+{
+  tracer_ = tracer;
+}
+
+void cppbot::Bot::setLogger(std::shared_ptr< AsyncLogger > logger)
+{
+  logger_ = logger;
+  if (dispatcher_)
+  {
+    dispatcher_->setLogger(logger_);
+  }
+  if (metricsServer_)
+  {
+    metricsServer_->setLogger(logger_);
+  }
+}
+
 void cppbot::Bot::stop()
 {
   isRunning_ = false;
+  if (dispatcher_)
+  {
+    dispatcher_->stop();
+  }
   ioContext_.stop();
   if (ioThread_.joinable())
   {
     ioThread_.join();
   }
+  if (uploadPool_)
+  {
+    uploadPool_->join();
+  }
 }
 
 cppbot::Bot::futureMessage cppbot::Bot::sendMessage(size_t chatId, const std::string& text,
@@ -82,6 +291,34 @@ cppbot::Bot::futureMessage cppbot::Bot::sendMessage(size_t chatId, const std::st
 
 cppbot::Bot::futureBool cppbot::Bot::deleteMessage(size_t chatId, size_t messageId)
 {
+  if (deleteBatchWindow_.count() > 0)
+  {
+    auto promise = std::make_shared< std::promise< bool > >();
+    futureBool future = promise->get_future();
+    std::lock_guard< std::mutex > lock(deleteMutex_);
+    PendingDeletes& pending = pendingDeletes_[chatId];
+    pending.messageIds.push_back(messageId);
+    pending.promises.push_back(promise);
+    if (pending.messageIds.size() >= MAX_BATCH_SIZE)
+    {
+      asio::post(ioContext_, [this, chatId]()
+      {
+        flushDeletes(chatId);
+      });
+    }
+    else if (!pending.timer)
+    {
+      pending.timer = std::make_shared< asio::steady_timer >(ioContext_, deleteBatchWindow_);
+      pending.timer->async_wait([this, chatId](const boost::system::error_code& ec)
+      {
+        if (ec != asio::error::operation_aborted)
+        {
+          flushDeletes(chatId);
+        }
+      });
+    }
+    return future;
+  }
   nlohmann::json body = {
     {"chat_id", chatId},
     {"message_id", messageId}
@@ -89,6 +326,173 @@ cppbot::Bot::futureBool cppbot::Bot::deleteMessage(size_t chatId, size_t message
   return sendRequest< bool >(body.dump(), "/deleteMessage");
 }
 
+cppbot::Bot::futureBool cppbot::Bot::deleteMessages(size_t chatId, const std::vector< size_t >& messageIds)
+{
+  auto promise = std::make_shared< std::promise< bool > >();
+  futureBool future = promise->get_future();
+  if (messageIds.empty())
+  {
+    promise->set_exception(std::make_exception_ptr(std::invalid_argument("No messages to delete")));
+    return future;
+  }
+  sendInBatches("/deleteMessages", {{"chat_id", chatId}}, messageIds, [promise](bool isOk, const nlohmann::json& result)
+  {
+    completePromise(*promise, isOk, result);
+  });
+  return future;
+}
+
+cppbot::Bot::futureMessageIds cppbot::Bot::forwardMessages(size_t chatId, size_t fromChatId,
+  const std::vector< size_t >& messageIds)
+{
+  auto promise = std::make_shared< std::promise< std::vector< types::MessageId > > >();
+  futureMessageIds future = promise->get_future();
+  if (messageIds.empty())
+  {
+    promise->set_exception(std::make_exception_ptr(std::invalid_argument("No messages to forward")));
+    return future;
+  }
+  nlohmann::json fields = {
+    {"chat_id", chatId},
+    {"from_chat_id", fromChatId}
+  };
+  sendInBatches("/forwardMessages", fields, messageIds, [promise](bool isOk, const nlohmann::json& result)
+  {
+    completePromise(*promise, isOk, result);
+  });
+  return future;
+}
+
+cppbot::Bot::futureMessageIds cppbot::Bot::copyMessages(size_t chatId, size_t fromChatId,
+  const std::vector< size_t >& messageIds)
+{
+  auto promise = std::make_shared< std::promise< std::vector< types::MessageId > > >();
+  futureMessageIds future = promise->get_future();
+  if (messageIds.empty())
+  {
+    promise->set_exception(std::make_exception_ptr(std::invalid_argument("No messages to copy")));
+    return future;
+  }
+  nlohmann::json fields = {
+    {"chat_id", chatId},
+    {"from_chat_id", fromChatId}
+  };
+  sendInBatches("/copyMessages", fields, messageIds, [promise](bool isOk, const nlohmann::json& result)
+  {
+    completePromise(*promise, isOk, result);
+  });
+  return future;
+}
+
+void cppbot::Bot::setDeleteBatching(std::chrono::milliseconds window)
+{
+  deleteBatchWindow_ = window;
+}
+
+void cppbot::Bot::sendInBatches(const std::string& endpoint, const nlohmann::json& fields,
+  std::vector< size_t > messageIds, response_handler_t handler)
+{
+  // Telegram requires ids in strictly increasing order
+  std::sort(messageIds.begin(), messageIds.end());
+  messageIds.erase(std::unique(messageIds.begin(), messageIds.end()), messageIds.end());
+
+  struct BatchResults
+  {
+    std::vector< nlohmann::json > results;
+    size_t left;
+    bool isOk;
+    std::mutex mutex;
+  };
+  size_t batches = (messageIds.size() + MAX_BATCH_SIZE - 1) / MAX_BATCH_SIZE;
+  auto state = std::make_shared< BatchResults >();
+  state->results.resize(batches);
+  state->left = batches;
+  state->isOk = true;
+
+  for (size_t batch = 0; batch < batches; ++batch)
+  {
+    auto begin = messageIds.begin() + batch * MAX_BATCH_SIZE;
+    auto end = messageIds.begin() + std::min(messageIds.size(), (batch + 1) * MAX_BATCH_SIZE);
+    nlohmann::json body = fields;
+    body["message_ids"] = std::vector< size_t >(begin, end);
+    auto req = makeRequest< http::string_body >(endpoint, "application/json");
+    req->body() = body.dump();
+    req->prepare_payload();
+    performRequest(req, [state, batch, handler](bool isOk, const nlohmann::json& result)
+    {
+      {
+        std::lock_guard< std::mutex > lock(state->mutex);
+        state->results[batch] = result;
+        state->isOk = state->isOk && isOk;
+        if (--state->left != 0)
+        {
+          return;
+        }
+      }
+      if (!state->isOk)
+      {
+        handler(false, nullptr);
+        return;
+      }
+      // Results of all batches are merged: booleans with "and", arrays are concatenated
+      nlohmann::json merged = state->results.front();
+      for (size_t i = 1; i < state->results.size(); ++i)
+      {
+        if (merged.is_boolean())
+        {
+          merged = merged.get< bool >() && state->results[i].get< bool >();
+        }
+        else
+        {
+          merged.insert(merged.end(), state->results[i].begin(), state->results[i].end());
+        }
+      }
+      handler(true, merged);
+    });
+  }
+}
+
+void cppbot::Bot::flushDeletes(size_t chatId)
+{
+  PendingDeletes pending;
+  {
+    std::lock_guard< std::mutex > lock(deleteMutex_);
+    auto it = pendingDeletes_.find(chatId);
+    if (it == pendingDeletes_.end())
+    {
+      return;
+    }
+    pending = std::move(it->second);
+    pendingDeletes_.erase(it);
+  }
+  if (pending.timer)
+  {
+    pending.timer->cancel();
+  }
+  auto promises = std::make_shared< std::vector< std::shared_ptr< std::promise< bool > > > >(
+    std::move(pending.promises));
+  auto resolve = [promises](bool isOk, const nlohmann::json& result)
+  {
+    for (const auto& promise : *promises)
+    {
+      completePromise(*promise, isOk, result);
+    }
+  };
+  if (pending.messageIds.size() == 1)
+  {
+    nlohmann::json body = {
+      {"chat_id", chatId},
+      {"message_id", pending.messageIds.front()}
+    };
+    auto req = makeRequest< http::string_body >("/deleteMessage", "application/json");
+    req->body() = body.dump();
+    req->prepare_payload();
+    performRequest(req, resolve);
+    return;
+  }
+  sendInBatches("/deleteMessages", {{"chat_id", chatId}}, pending.messageIds, resolve);
+}
+
 cppbot::Bot::futureBool cppbot::Bot::answerCallbackQuery(const std::string& queryId, const std::string& text,
   bool showAlert, const std::string& url, size_t cacheTime)
 {
@@ -184,6 +588,122 @@ cppbot::Bot::futureMessage cppbot::Bot::sendVideo(size_t chatId, const types::In
   return sendFile(video, "/sendVideo", fields);
 }
 
+cppbot::Bot::futureMessages cppbot::Bot::sendMediaGroup(size_t chatId, const std::vector< types::InputMedia >& media)
+{
+  auto promise = std::make_shared< std::promise< std::vector< types::Message > > >();
+  futureMessages future = promise->get_future();
+  if ((media.size() < 2) || (media.size() > 10))
+  {
+    promise->set_exception(std::make_exception_ptr(std::invalid_argument("Media group must contain 2-10 items")));
+    return future;
+  }
+
+  std::shared_ptr< FileIdCache > cache = fileCache_;
+  std::vector< std::string > cacheKeys(media.size());
+  std::vector< std::string > mediaTypes(media.size());
+  for (size_t i = 0; i < media.size(); ++i)
+  {
+    mediaTypes[i] = media[i].type();
+    if (cache && (media[i].file().source() != types::InputFile::GENERATOR))
+    {
+      cacheKeys[i] = cache->key(mediaTypes[i], media[i].file());
+    }
+  }
+
+  uploadMediaGroup(chatId, media, cacheKeys, true, [cache, cacheKeys, mediaTypes, promise](bool isOk,
+    const nlohmann::json& result)
+  {
+    if (isOk && cache && result.is_array())
+    {
+      for (size_t i = 0; (i < result.size()) && (i < cacheKeys.size()); ++i)
+      {
+        if (!cacheKeys[i].empty())
+        {
+          cache->store(cacheKeys[i], extractFileId(result[i], mediaTypes[i]));
+        }
+      }
+    }
+    completePromise(*promise, isOk, result);
+  });
+  return future;
+}
+
+void cppbot::Bot::uploadMediaGroup(size_t chatId, const std::vector< types::InputMedia >& media,
+  const std::vector< std::string >& cacheKeys, bool useCache, response_handler_t handler)
+{
+  std::shared_ptr< FileIdCache > cache = fileCache_;
+  nlohmann::json items = nlohmann::json::array();
+  std::vector< std::string > usedKeys;
+  std::vector< std::pair< std::string, types::InputFile > > files;
+  for (size_t i = 0; i < media.size(); ++i)
+  {
+    nlohmann::json item = media[i];
+    std::string fileId = (useCache && cache && !cacheKeys[i].empty()) ? cache->find(cacheKeys[i]) : "";
+    if (!fileId.empty())
+    {
+      item["media"] = fileId;
+      usedKeys.push_back(cacheKeys[i]);
+    }
+    else
+    {
+      // File names may repeat, so parts are named by their position
+      std::string partName = "file" + std::to_string(i);
+      item["media"] = "attach://" + partName;
+      files.emplace_back(partName, media[i].file());
+    }
+    items.push_back(item);
+  }
+
+  // Content of generators is consumed by this request, such group can't be uploaded again
+  bool isReplayable = std::none_of(files.begin(), files.end(), [](const auto& file)
+  {
+    return file.second.source() == types::InputFile::GENERATOR;
+  });
+  auto onResponse = [this, chatId, media, cacheKeys, usedKeys, cache, isReplayable, handler](bool isOk,
+    const nlohmann::json& result)
+  {
+    if (isOk || usedKeys.empty())
+    {
+      handler(isOk, result);
+      return;
+    }
+    // Telegram may refuse an old file_id, so all files are uploaded again
+    for (const std::string& key : usedKeys)
+    {
+      cache->remove(key);
+    }
+    if (!isReplayable)
+    {
+      handler(isOk, result);
+      return;
+    }
+    uploadMediaGroup(chatId, media, cacheKeys, false, handler);
+  };
+
+  if (files.empty())
+  {
+    nlohmann::json body = {
+      {"chat_id", chatId},
+      {"media", items}
+    };
+    auto req = makeRequest< http::string_body >("/sendMediaGroup", "application/json");
+    req->body() = body.dump();
+    req->prepare_payload();
+    performRequest(req, onResponse);
+    return;
+  }
+
+  multipart::Form form(generateBoundary());
+  form.addField("chat_id", std::to_string(chatId));
+  form.addField("media", items.dump());
+  for (const auto& [partName, file] : files)
+  {
+    form.addFile(partName, file);
+  }
+  form.finish();
+  sendMultipart(makeMultipartRequest("/sendMediaGroup", std::move(form)), onResponse);
+}
+
 cppbot::Bot::futureMessage cppbot::Bot::editMessageText(size_t chatId, size_t messageId, const std::string& text,
   const types::InlineKeyboardMarkup& replyMarkup)
 {
@@ -249,6 +769,181 @@ cppbot::Bot::futureFile cppbot::Bot::getFile(const std::string& fileId)
   return sendRequest< types::File >(body.dump(), "/getFile");
 }
 
+struct cppbot::Bot::DownloadData
+{
+  DownloadSink sink;
+  std::shared_ptr< http::request< http::empty_body > > req;
+  ConnectionPool::connection_t connection;
+  beast::flat_buffer buffer;
+  http::response_parser< http::buffer_body > parser;
+  std::vector< char > chunk;
+  size_t skip;
+  size_t received;
+  std::promise< size_t > promise;
+
+  DownloadData(const DownloadSink& sink):
+    sink(sink),
+    skip(0),
+    received(0)
+  {}
+};
+
+cppbot::Bot::futureSize cppbot::Bot::downloadFile(const types::File& file, DownloadSink sink)
+{
+  auto download = std::make_shared< DownloadData >(sink);
+  futureSize future = download->promise.get_future();
+  if (file.filePath.empty())
+  {
+    download->promise.set_exception(std::make_exception_ptr(std::invalid_argument("File has no path, use getFile")));
+    return future;
+  }
+
+  download->req = std::make_shared< http::request< http::empty_body > >(http::verb::get,
+    "/file/bot" + token_ + "/" + file.filePath, 11);
+  download->req->set(http::field::host, "api.telegram.org");
+  download->req->set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+  if (sink.offset() > 0)
+  {
+    download->req->set(http::field::range, "bytes=" + std::to_string(sink.offset()) + "-");
+  }
+  startDownload(download, true);
+  return future;
+}
+
+void cppbot::Bot::startDownload(std::shared_ptr< DownloadData > download, bool allowReuse)
+{
+  pool_.acquire([this, download](const boost::system::error_code& ec, ConnectionPool::connection_t connection,
+    bool isReused)
+  {
+    if (ec)
+    {
+      finishDownload(download, ec.message());
+      return;
+    }
+    download->connection = connection;
+    http::async_write(*connection, *(download->req), [this, download, isReused](auto ec, auto)
+    {
+      if (ec)
+      {
+        pool_.discard(download->connection);
+        download->connection = nullptr;
+        if (isReused)
+        {
+          startDownload(download, false);
+          return;
+        }
+        finishDownload(download, ec.message());
+        return;
+      }
+      download->parser.body_limit((std::numeric_limits< std::uint64_t >::max)());
+      http::async_read_header(*(download->connection), download->buffer, download->parser,
+        [this, download, isReused](auto ec, auto)
+      {
+        if (ec)
+        {
+          pool_.discard(download->connection);
+          download->connection = nullptr;
+          if (isReused && (ec == http::error::end_of_stream))
+          {
+            startDownload(download, false);
+            return;
+          }
+          finishDownload(download, ec.message());
+          return;
+        }
+        http::status status = download->parser.get().result();
+        if ((status == http::status::range_not_satisfiable) && (download->sink.offset() > 0))
+        {
+          // File was completely downloaded before
+          download->parser.skip(true);
+          finishDownload(download, "");
+          return;
+        }
+        if ((status != http::status::ok) && (status != http::status::partial_content))
+        {
+          pool_.discard(download->connection);
+          download->connection = nullptr;
+          finishDownload(download, "File download failed with status " + std::to_string(static_cast< int >(status)));
+          return;
+        }
+        if (status == http::status::ok)
+        {
+          // Server ignored Range header, already saved bytes are skipped
+          download->skip = download->sink.offset();
+        }
+        download->chunk.resize(64 * 1024);
+        readDownloadChunk(download);
+      });
+    });
+  }, allowReuse);
+}
+
+void cppbot::Bot::readDownloadChunk(std::shared_ptr< DownloadData > download)
+{
+  if (download->parser.is_done())
+  {
+    finishDownload(download, "");
+    return;
+  }
+  auto& body = download->parser.get().body();
+  body.data = download->chunk.data();
+  body.size = download->chunk.size();
+  http::async_read(*(download->connection), download->buffer, download->parser, [this, download](auto ec, auto)
+  {
+    if (ec == http::error::need_buffer)
+    {
+      ec = {};
+    }
+    if (ec)
+    {
+      pool_.discard(download->connection);
+      download->connection = nullptr;
+      finishDownload(download, ec.message());
+      return;
+    }
+    size_t size = download->chunk.size() - download->parser.get().body().size;
+    const char* data = download->chunk.data();
+    size_t skipped = std::min(size, download->skip);
+    download->skip -= skipped;
+    try
+    {
+      download->sink.write(data + skipped, size - skipped);
+    }
+    catch (const std::exception& e)
+    {
+      pool_.discard(download->connection);
+      download->connection = nullptr;
+      finishDownload(download, e.what());
+      return;
+    }
+    download->received += size - skipped;
+    readDownloadChunk(download);
+  });
+}
+
+void cppbot::Bot::finishDownload(std::shared_ptr< DownloadData > download, const std::string& error)
+{
+  if (download->connection)
+  {
+    if (download->parser.is_done() && download->parser.keep_alive())
+    {
+      pool_.release(download->connection);
+    }
+    else
+    {
+      pool_.discard(download->connection);
+    }
+    download->connection = nullptr;
+  }
+  if (!error.empty())
+  {
+    log(LogLevel::ERROR, "Download failed", {{"error", error}});
+    download->promise.set_exception(std::make_exception_ptr(std::runtime_error(error)));
+    return;
+  }
+  download->promise.set_value(download->received);
+}
+
 states::StateContext cppbot::Bot::getStateContext(size_t chatId)
 {
   return states::StateContext(chatId, &stateMachine_);
@@ -292,27 +987,46 @@ void cppbot::Bot::fetchUpdates()
       beast::flat_buffer buffer;
       http::response< http::string_body > res;
       http::read(socket, buffer, res);
+      auto received = std::chrono::steady_clock::now();
       auto updates = nlohmann::json::parse(res.body());
+      std::shared_ptr< Instruments > instruments = instruments_;
+      std::shared_ptr< Tracer > tracer = tracer_;
       for (const auto& update : updates["result"])
       {
         lastUpdateId = update["update_id"];
+        Tracer::Context trace = Tracer::start(tracer, lastUpdateId);
         if (update.contains("message"))
         {
+          if (instruments)
+          {
+            instruments->messages.increment();
+          }
+          QueuedUpdate< types::Message > queued{update["message"].template get< types::Message >(), lastUpdateId,
+            std::chrono::steady_clock::now()};
+          trace.record("update", "ingest", "message", received);
           std::lock_guard< std::mutex > lock(updateMutex_);
-          messageQueue_.push(update["message"].template get< types::Message >());
+          messageQueue_.push(std::move(queued));
           updateCondition_.notify_one();
         }
         if (update.contains("callback_query"))
         {
+          if (instruments)
+          {
+            instruments->queries.increment();
+          }
+          QueuedUpdate< types::CallbackQuery > queued{
+            update["callback_query"].template get< types::CallbackQuery >(), lastUpdateId,
+            std::chrono::steady_clock::now()};
+          trace.record("update", "ingest", "callback_query", received);
           std::lock_guard< std::mutex > lock(updateMutex_);
-          queryQueue_.push(update["callback_query"].template get< types::CallbackQuery >());
+          queryQueue_.push(std::move(queued));
           updateCondition_.notify_one();
         }
       }
     }
     catch (std::exception const& e)
     {
-      std::cerr << "Error: " << e.what() << std::endl;
+      log(LogLevel::ERROR, "Cannot get updates", {{"error", e.what()}});
       std::this_thread::sleep_for(std::chrono::seconds(10));
     }
 
@@ -341,32 +1055,229 @@ cppbot::Bot::futureMessage cppbot::Bot::sendFile(const types::InputFile& file, c
     fileType = "video";
   }
 
-  std::string boundary = generateBoundary();
-  std::string body = createMultipartBody(boundary, fields, fileType, file);
-  return sendRequest< types::Message >(
-    body,
-    endpoint,
-    {{http::field::content_length, std::to_string(body.size())}, {http::field::connection, "close"}},
-    "multipart/form-data; boundary=" + boundary
-  );
+  auto promise = std::make_shared< std::promise< types::Message > >();
+  futureMessage future = promise->get_future();
+  sendCachedFile(endpoint, fileType, fileType, file, fields, nlohmann::json::json_pointer("/" + fileType),
+    [promise](bool isOk, const nlohmann::json& result)
+    {
+      completePromise(*promise, isOk, result);
+    });
+  return future;
 }
 
 cppbot::Bot::futureMessage cppbot::Bot::updateFile(const types::InputMedia& media, const nlohmann::json& fields)
 {
-  std::string boundary = generateBoundary();
+  auto promise = std::make_shared< std::promise< types::Message > >();
+  futureMessage future = promise->get_future();
+  sendCachedFile("/editMessageMedia", media.type(), media.file().name(), media.file(), fields,
+    nlohmann::json::json_pointer("/media/media"), [promise](bool isOk, const nlohmann::json& result)
+    {
+      completePromise(*promise, isOk, result);
+    });
+  return future;
+}
+
+void cppbot::Bot::sendCachedFile(const std::string& endpoint, const std::string& fileType,
+  const std::string& partName, const types::InputFile& file, const nlohmann::json& fields,
+  const nlohmann::json::json_pointer& idField, response_handler_t handler)
+{
+  std::shared_ptr< FileIdCache > cache = fileCache_;
+  if (!cache || (file.source() == types::InputFile::GENERATOR))
+  {
+    uploadFile(endpoint, partName, file, fields, handler);
+    return;
+  }
+
+  std::string key = cache->key(fileType, file);
+  auto onUploaded = [cache, key, fileType, handler](bool isOk, const nlohmann::json& result)
+  {
+    if (isOk)
+    {
+      cache->store(key, extractFileId(result, fileType));
+    }
+    handler(isOk, result);
+  };
+
+  std::string fileId = cache->find(key);
+  if (fileId.empty())
+  {
+    uploadFile(endpoint, partName, file, fields, onUploaded);
+    return;
+  }
+
+  nlohmann::json body = fields;
+  body[idField] = fileId;
+  auto req = makeRequest< http::string_body >(endpoint, "application/json");
+  req->body() = body.dump();
+  req->prepare_payload();
+  performRequest(req, [this, cache, key, endpoint, partName, file, fields, handler, onUploaded](bool isOk,
+    const nlohmann::json& result)
+  {
+    if (isOk)
+    {
+      handler(isOk, result);
+      return;
+    }
+    // Telegram may refuse an old file_id, so the file is uploaded again
+    cache->remove(key);
+    uploadFile(endpoint, partName, file, fields, onUploaded);
+  });
+}
 
-  std::string body = createMultipartBody(boundary, fields, media.file().name(), media.file());
-  return sendRequest< types::Message >(
-    body,
-    "/editMessageMedia",
-    {{http::field::content_length, std::to_string(body.size())}, {http::field::connection, "close"}},
-    "multipart/form-data; boundary=" + boundary
-  );
+void cppbot::Bot::uploadFile(const std::string& endpoint, const std::string& partName, const types::InputFile& file,
+  const nlohmann::json& fields, response_handler_t handler)
+{
+  multipart::Form form(generateBoundary());
+  form.addFields(fields);
+  form.addFile(partName, file);
+  form.finish();
+  sendMultipart(makeMultipartRequest(endpoint, std::move(form)), handler);
+}
+
+std::shared_ptr< http::request< cppbot::multipart::Body > > cppbot::Bot::makeMultipartRequest(
+  const std::string& endpoint, multipart::Form form)
+{
+  auto req = makeRequest< multipart::Body >(endpoint, form.contentType());
+  bool hasKnownSize = form.hasKnownSize();
+  req->body() = std::move(form);
+  if (hasKnownSize)
+  {
+    req->prepare_payload();
+  }
+  else
+  {
+    req->chunked(true);
+  }
+  return req;
+}
+
+void cppbot::Bot::sendMultipart(std::shared_ptr< http::request< multipart::Body > > req, response_handler_t handler)
+{
+  if (!zeroCopyUploads_ || !detail::isKtlsAvailable() || !req->body().hasKnownSize())
+  {
+    performRequest(req, handler);
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  Tracer::Context trace = Tracer::current();
+  asio::post(*uploadPool_, [this, req, handler, start, trace]()
+  {
+    http::response< http::string_body > res;
+    try
+    {
+      res = detail::sendWithKtls(sslContext_.native_handle(), "api.telegram.org", "443", *req, UPLOAD_TIMEOUT);
+    }
+    catch (const std::exception& e)
+    {
+      observeFailure(req->target(), e.what());
+      handler(false, nullptr);
+      return;
+    }
+    observeSent(req->target(), req->body().size());
+    traceRequest(trace, "request", req->target(), start);
+    handleResponse(req->target(), start, res.result_int(), res.body(), handler);
+  });
+}
+
+void cppbot::Bot::handleResponse(boost::beast::string_view target, std::chrono::steady_clock::time_point start,
+  unsigned status, const std::string& body, const response_handler_t& handler) const
+{
+  nlohmann::json response = nlohmann::json::parse(body, nullptr, false);
+  std::shared_ptr< Instruments > instruments = instruments_;
+  if (instruments)
+  {
+    Metrics& metrics = *instruments->metrics;
+    std::string endpoint = endpointOf(target);
+    metrics.histogram("cppbot_request_duration_seconds", "Time from sending a request to Telegram to its answer",
+      {{"endpoint", endpoint}}).observe(std::chrono::steady_clock::now() - start);
+    if (status != 0)
+    {
+      metrics.counter("cppbot_responses_total", "Answers of Telegram by HTTP status",
+        {{"endpoint", endpoint}, {"status", std::to_string(status)}}).increment();
+    }
+    if (!response.is_discarded() && !response.value("ok", false))
+    {
+      metrics.counter("cppbot_telegram_errors_total", "Errors returned by Telegram by error_code",
+        {{"endpoint", endpoint}, {"error_code", std::to_string(response.value("error_code", 0))}}).increment();
+    }
+  }
+  if (response.is_discarded())
+  {
+    log(LogLevel::ERROR, "Invalid response of Telegram", {{"endpoint", endpointOf(target)},
+      {"status", std::to_string(status)}});
+    handler(false, nullptr);
+    return;
+  }
+  if (!response.value("ok", false))
+  {
+    LogFields fields = {
+      {"endpoint", endpointOf(target)},
+      {"error_code", std::to_string(response.value("error_code", 0))},
+      {"description", response.value("description", "")}
+    };
+    if (response.contains("parameters") && response["parameters"].contains("retry_after"))
+    {
+      fields.emplace_back("retry_after", response["parameters"]["retry_after"].dump());
+    }
+    log(LogLevel::ERROR, "Telegram returned error", std::move(fields));
+    handler(false, nullptr);
+    return;
+  }
+  handler(true, response["result"]);
+}
+
+void cppbot::Bot::observeSent(boost::beast::string_view target, size_t bytes) const
+{
+  std::shared_ptr< Instruments > instruments = instruments_;
+  if (instruments)
+  {
+    instruments->metrics->counter("cppbot_sent_bytes_total", "Bytes of requests sent to Telegram (with uploaded files)",
+      {{"endpoint", endpointOf(target)}}).increment(bytes);
+  }
+}
+
+void cppbot::Bot::traceRequest(const Tracer::Context& trace, const char* phase, boost::beast::string_view target,
+  std::chrono::steady_clock::time_point start) const
+{
+  if (trace)
+  {
+    trace.record("request", phase, endpointOf(target), start);
+  }
+}
+
+cppbot::ConnectionPool::phase_handler_t cppbot::Bot::tracePhases(const Tracer::Context& trace,
+  boost::beast::string_view target) const
+{
+  if (!trace)
+  {
+    return nullptr;
+  }
+  std::string endpoint = endpointOf(target);
+  return [trace, endpoint](const char* phase, std::chrono::steady_clock::time_point start)
+  {
+    trace.record("request", phase, endpoint, start);
+  };
+}
+
+void cppbot::Bot::observeFailure(boost::beast::string_view target, const std::string& error) const
+{
+  std::string endpoint = endpointOf(target);
+  std::shared_ptr< Instruments > instruments = instruments_;
+  if (instruments)
+  {
+    instruments->metrics->counter("cppbot_request_failures_total", "Requests to Telegram failed without an answer",
+      {{"endpoint", endpoint}}).increment();
+  }
+  log(LogLevel::ERROR, "Request failed", {{"endpoint", endpoint}, {"error", error}});
 }
 
-void cppbot::Bot::printError(const std::string& errorMessage) const
+void cppbot::Bot::log(LogLevel level, const std::string& message, LogFields fields) const
 {
-  std::cerr << "Request Error: " << errorMessage << '\n';
+  std::shared_ptr< AsyncLogger > logger = logger_;
+  if (logger)
+  {
+    logger->log(level, message, std::move(fields));
+  }
 }
 
 void cppbot::Bot::processUpdates()
@@ -382,23 +1293,121 @@ void cppbot::Bot::processUpdates()
     {
       if (!messageQueue_.empty())
       {
-        types::Message msg = messageQueue_.front();
+        QueuedUpdate< types::Message > queued = std::move(messageQueue_.front());
         messageQueue_.pop();
         lock.unlock();
-        states::StateContext state(msg.chat.id, &stateMachine_);
-        (*mh_).processMessage(msg, state);
+        size_t chatId = queued.update.chat.id;
+        if (!dispatcher_)
+        {
+          handleMessage(queued);
+        }
+        else if (!dispatcher_->submit(chatId, [this, queued]()
+        {
+          handleMessage(queued);
+        }))
+        {
+          log(LogLevel::WARNING, "Update dropped: too many updates from chat", {{"chat_id", std::to_string(chatId)}});
+        }
       }
       else
       {
-        types::CallbackQuery query = queryQueue_.front();
+        QueuedUpdate< types::CallbackQuery > queued = std::move(queryQueue_.front());
         queryQueue_.pop();
         lock.unlock();
-        (*qh_).processCallbackQuery(query);
+        const types::CallbackQuery& query = queued.update;
+        size_t chatId = (query.message.chat.id != 0) ? query.message.chat.id : query.from.id;
+        if (!dispatcher_)
+        {
+          handleCallbackQuery(queued);
+        }
+        else if (!dispatcher_->submit(chatId, [this, queued]()
+        {
+          handleCallbackQuery(queued);
+        }))
+        {
+          log(LogLevel::WARNING, "Update dropped: too many updates from chat", {{"chat_id", std::to_string(chatId)}});
+        }
       }
     }
-    catch (const std::exception& e)
+    catch (...)
     {
-      std::cerr << e.what() << '\n';
+      log(LogLevel::ERROR, "Update handling failed", {{"error", currentError()}});
     }
   }
 }
+
+void cppbot::Bot::handleMessage(const QueuedUpdate< types::Message >& queued)
+{
+  const types::Message& msg = queued.update;
+  auto start = std::chrono::steady_clock::now();
+  Tracer::Context trace = Tracer::start(tracer_, queued.updateId);
+  trace.record("update", "queue", "message", queued.since);
+  states::StateContext state(msg.chat.id, &stateMachine_);
+  std::shared_ptr< Monitor > monitor = monitor_;
+  std::string key = (monitor || trace) ? (*mh_).routeKey(msg, state.current()) : std::string();
+  Monitor::Scope scope(monitor.get(), key);
+  std::shared_ptr< Instruments > instruments = instruments_;
+  // State changed before a failure is saved too, and failed handlers are measured as well
+  auto finish = [this, &msg, &instruments, &trace, &key, start]()
+  {
+    stateMachine_.commit(msg.chat.id);
+    if (instruments)
+    {
+      instruments->messageHandlers.observe(std::chrono::steady_clock::now() - start);
+    }
+    trace.record("update", "handler", key, start);
+  };
+  try
+  {
+    Tracer::Scope traceScope(trace);
+    runMiddlewares((*mh_).middlewares(), [this, &msg, &state]()
+    {
+      (*mh_).processMessage(msg, state);
+    }, msg, state);
+  }
+  catch (...)
+  {
+    finish();
+    log(LogLevel::ERROR, "Message handler failed", {{"chat_id", std::to_string(msg.chat.id)},
+      {"update_id", std::to_string(queued.updateId)}, {"error", currentError()}});
+    return;
+  }
+  finish();
+}
+
+void cppbot::Bot::handleCallbackQuery(const QueuedUpdate< types::CallbackQuery >& queued)
+{
+  const types::CallbackQuery& query = queued.update;
+  auto start = std::chrono::steady_clock::now();
+  Tracer::Context trace = Tracer::start(tracer_, queued.updateId);
+  trace.record("update", "queue", "callback_query", queued.since);
+  std::shared_ptr< Monitor > monitor = monitor_;
+  std::string key = (monitor || trace) ? (*qh_).routeKey(query) : std::string();
+  Monitor::Scope scope(monitor.get(), key);
+  std::shared_ptr< Instruments > instruments = instruments_;
+  auto finish = [this, &query, &instruments, &trace, &key, start]()
+  {
+    stateMachine_.commit((query.message.chat.id != 0) ? query.message.chat.id : query.from.id);
+    if (instruments)
+    {
+      instruments->queryHandlers.observe(std::chrono::steady_clock::now() - start);
+    }
+    trace.record("update", "handler", key, start);
+  };
+  try
+  {
+    Tracer::Scope traceScope(trace);
+    runMiddlewares((*qh_).middlewares(), [this, &query]()
+    {
+      (*qh_).processCallbackQuery(query);
+    }, query);
+  }
+  catch (...)
+  {
+    finish();
+    log(LogLevel::ERROR, "Callback query handler failed", {{"query_id", query.id},
+      {"update_id", std::to_string(queued.updateId)}, {"error", currentError()}});
+    return;
+  }
+  finish();
+}
@@ -0,0 +1,180 @@
+#include "cppbot/dispatcher.hpp"
+#include <exception>
+#include <stdexcept>
+
+cppbot::Dispatcher::Dispatcher(size_t workers, size_t maxQueued, size_t maxQueuedPerChat):
+  maxQueued_(maxQueued),
+  maxQueuedPerChat_(maxQueuedPerChat),
+  chats_(),
+  readyChats_(),
+  queued_(0),
+  active_(0),
+  running_(workers),
+  stopping_(0),
+  isStopped_(false),
+  mutex_(),
+  taskCondition_(),
+  spaceCondition_(),
+  exitCondition_(),
+  workers_(),
+  logger_()
+{
+  if (workers == 0)
+  {
+    throw std::invalid_argument("Dispatcher requires at least one worker");
+  }
+  for (size_t i = 0; i < workers; ++i)
+  {
+    workers_.emplace_back(&cppbot::Dispatcher::work, this);
+  }
+}
+
+cppbot::Dispatcher::~Dispatcher()
+{
+  if (isWorker())
+  {
+    log(logger_, LogLevel::ERROR, "Dispatcher is destroyed from its own handler");
+    std::terminate();
+  }
+  stop();
+  for (std::thread& worker : workers_)
+  {
+    worker.join();
+  }
+}
+
+bool cppbot::Dispatcher::submit(size_t chatId, task_t task)
+{
+  std::unique_lock< std::mutex > lock(mutex_);
+  spaceCondition_.wait(lock, [this]
+  {
+    return isStopped_ || (queued_ < maxQueued_);
+  });
+  if (isStopped_)
+  {
+    return false;
+  }
+  ChatQueue& chat = chats_[chatId];
+  if (chat.tasks.size() >= maxQueuedPerChat_)
+  {
+    return false;
+  }
+  chat.tasks.push_back(std::move(task));
+  ++queued_;
+  if (!chat.isRunning && (chat.tasks.size() == 1))
+  {
+    readyChats_.push_back(chatId);
+    taskCondition_.notify_one();
+  }
+  return true;
+}
+
+void cppbot::Dispatcher::stop()
+{
+  bool isCalledByHandler = isWorker();
+  std::unique_lock< std::mutex > lock(mutex_);
+  isStopped_ = true;
+  taskCondition_.notify_all();
+  spaceCondition_.notify_all();
+  if (isCalledByHandler)
+  {
+    // Handler can't wait for itself, and handlers stopping at the same time can't wait for each other
+    ++stopping_;
+    exitCondition_.notify_all();
+  }
+  exitCondition_.wait(lock, [this]
+  {
+    return running_ <= stopping_;
+  });
+  if (isCalledByHandler)
+  {
+    --stopping_;
+  }
+}
+
+bool cppbot::Dispatcher::isWorker() const
+{
+  for (const std::thread& worker : workers_)
+  {
+    if (worker.get_id() == std::this_thread::get_id())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t cppbot::Dispatcher::queued() const
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  return queued_;
+}
+
+size_t cppbot::Dispatcher::active() const
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  return active_;
+}
+
+void cppbot::Dispatcher::setLogger(std::shared_ptr< AsyncLogger > logger)
+{
+  logger_ = logger;
+}
+
+void cppbot::Dispatcher::work()
+{
+  std::unique_lock< std::mutex > lock(mutex_);
+  while (true)
+  {
+    taskCondition_.wait(lock, [this]
+    {
+      return isStopped_ || !readyChats_.empty();
+    });
+    if (isStopped_)
+    {
+      --running_;
+      exitCondition_.notify_all();
+      return;
+    }
+    size_t chatId = readyChats_.front();
+    readyChats_.pop_front();
+    ChatQueue& chat = chats_[chatId];
+    task_t task = std::move(chat.tasks.front());
+    chat.tasks.pop_front();
+    chat.isRunning = true;
+    --queued_;
+    ++active_;
+    spaceCondition_.notify_one();
+    lock.unlock();
+
+    try
+    {
+      task();
+    }
+    catch (const std::exception& e)
+    {
+      log(logger_, LogLevel::ERROR, "Update handler failed", {{"chat_id", std::to_string(chatId)},
+        {"error", e.what()}});
+    }
+    catch (...)
+    {
+      // Worker must survive any handler, otherwise the chat stays running forever
+      log(logger_, LogLevel::ERROR, "Update handler failed", {{"chat_id", std::to_string(chatId)},
+        {"error", "unknown exception"}});
+    }
+
+    lock.lock();
+    --active_;
+    auto it = chats_.find(chatId);
+    it->second.isRunning = false;
+    if (it->second.tasks.empty())
+    {
+      chats_.erase(it);
+    }
+    else
+    {
+      readyChats_.push_back(chatId);
+      taskCondition_.notify_one();
+    }
+  }
+}
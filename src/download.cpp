@@ -0,0 +1,96 @@
+#include "cppbot/download.hpp"
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+cppbot::DownloadSink::DownloadSink(const std::string& path, bool resume):
+  handler_(),
+  offset_(0)
+{
+  std::error_code ec;
+  if (resume && std::filesystem::exists(path, ec))
+  {
+    offset_ = static_cast< size_t >(std::filesystem::file_size(path, ec));
+  }
+  auto file = std::make_shared< std::ofstream >(path, std::ios::binary | (resume ? std::ios::app : std::ios::trunc));
+  if (!*file)
+  {
+    throw std::runtime_error("Cannot open file: " + path);
+  }
+  handler_ = [file, path](const char* data, size_t size)
+  {
+    if (!file->write(data, size))
+    {
+      throw std::runtime_error("Cannot write to file: " + path);
+    }
+  };
+}
+
+cppbot::DownloadSink::DownloadSink(int fd, size_t offset):
+  handler_(),
+  offset_(offset)
+{
+  handler_ = [fd](const char* data, size_t size)
+  {
+    while (size > 0)
+    {
+#ifdef _WIN32
+      int written = ::_write(fd, data, static_cast< unsigned int >(size));
+#else
+      ssize_t written = ::write(fd, data, size);
+#endif
+      if (written < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        throw std::system_error(errno, std::generic_category(), "Cannot write to file descriptor");
+      }
+      data += written;
+      size -= static_cast< size_t >(written);
+    }
+  };
+}
+
+cppbot::DownloadSink::DownloadSink(std::shared_ptr< std::string > buffer):
+  handler_(),
+  offset_(0)
+{
+  if (!buffer)
+  {
+    throw std::invalid_argument("Download buffer is null");
+  }
+  handler_ = [buffer](const char* data, size_t size)
+  {
+    buffer->append(data, size);
+  };
+}
+
+cppbot::DownloadSink::DownloadSink(chunk_handler_t handler, size_t offset):
+  handler_(handler),
+  offset_(offset)
+{
+  if (!handler_)
+  {
+    throw std::invalid_argument("Download handler is empty");
+  }
+}
+
+size_t cppbot::DownloadSink::offset() const
+{
+  return offset_;
+}
+
+void cppbot::DownloadSink::write(const char* data, size_t size)
+{
+  handler_(data, size);
+}
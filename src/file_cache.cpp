@@ -0,0 +1,200 @@
+#include "cppbot/file_cache.hpp"
+#include <filesystem>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include <openssl/evp.h>
+
+namespace
+{
+  constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+  class Sha256
+  {
+   public:
+    Sha256():
+      ctx_(EVP_MD_CTX_new(), EVP_MD_CTX_free)
+    {
+      EVP_DigestInit_ex(ctx_.get(), EVP_sha256(), nullptr);
+    }
+
+    void update(const char* data, size_t size)
+    {
+      EVP_DigestUpdate(ctx_.get(), data, size);
+    }
+
+    std::string hex()
+    {
+      unsigned char digest[EVP_MAX_MD_SIZE];
+      unsigned int digestSize = 0;
+      EVP_DigestFinal_ex(ctx_.get(), digest, &digestSize);
+      std::ostringstream result;
+      for (unsigned int i = 0; i < digestSize; ++i)
+      {
+        result << std::hex << std::setw(2) << std::setfill('0') << static_cast< int >(digest[i]);
+      }
+      return result.str();
+    }
+   private:
+    std::unique_ptr< EVP_MD_CTX, decltype(&EVP_MD_CTX_free) > ctx_;
+  };
+
+  std::string hashFile(const std::string& path)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+      throw std::runtime_error("Cannot open file: " + path);
+    }
+    Sha256 sha;
+    std::vector< char > buffer(CHUNK_SIZE);
+    while (file)
+    {
+      file.read(buffer.data(), buffer.size());
+      sha.update(buffer.data(), static_cast< size_t >(file.gcount()));
+    }
+    return sha.hex();
+  }
+
+  std::string hashBuffer(const std::string& content)
+  {
+    Sha256 sha;
+    sha.update(content.data(), content.size());
+    return sha.hex();
+  }
+}
+
+cppbot::FileIdCache::FileIdCache(KeyMode mode, const std::string& persistencePath):
+  mode_(mode),
+  persistencePath_(persistencePath),
+  journal_(),
+  fileIds_(),
+  mutex_()
+{
+  if (!persistencePath_.empty())
+  {
+    load();
+  }
+}
+
+std::string cppbot::FileIdCache::key(const std::string& fileType, const types::InputFile& file) const
+{
+  if (file.source() == types::InputFile::GENERATOR)
+  {
+    throw std::invalid_argument("Generated file can't be cached: " + file.name());
+  }
+  if (file.source() == types::InputFile::BUFFER)
+  {
+    // Buffers have no metadata, so they are always identified by content
+    return fileType + ':' + hashBuffer(*file.buffer());
+  }
+  if (mode_ == CONTENT_HASH)
+  {
+    return fileType + ':' + hashFile(file.path());
+  }
+  std::error_code ec;
+  std::filesystem::path path = std::filesystem::absolute(file.path(), ec);
+  auto modified = std::filesystem::last_write_time(path, ec);
+  if (ec)
+  {
+    throw std::runtime_error("Cannot get info of file: " + file.path());
+  }
+  return fileType + ':' + path.string() + ':' + std::to_string(modified.time_since_epoch().count()) + ':'
+    + std::to_string(file.size());
+}
+
+std::string cppbot::FileIdCache::find(const std::string& key) const
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  auto it = fileIds_.find(key);
+  return (it != fileIds_.end()) ? it->second : "";
+}
+
+void cppbot::FileIdCache::store(const std::string& key, const std::string& fileId)
+{
+  if (fileId.empty())
+  {
+    return;
+  }
+  std::lock_guard< std::mutex > lock(mutex_);
+  fileIds_[key] = fileId;
+  append(key, fileId);
+}
+
+void cppbot::FileIdCache::remove(const std::string& key)
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  if (fileIds_.erase(key) != 0)
+  {
+    append(key, "");
+  }
+}
+
+void cppbot::FileIdCache::clear()
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  fileIds_.clear();
+  if (!persistencePath_.empty())
+  {
+    journal_.close();
+    journal_.open(persistencePath_, std::ios::trunc);
+  }
+}
+
+void cppbot::FileIdCache::load()
+{
+  std::ifstream input(persistencePath_);
+  std::string line;
+  while (std::getline(input, line))
+  {
+    nlohmann::json record = nlohmann::json::parse(line, nullptr, false);
+    if (!record.is_array() || (record.size() != 2) || !record[0].is_string() || !record[1].is_string())
+    {
+      // Last line may be incomplete if the process was killed while writing it
+      continue;
+    }
+    std::string fileId = record[1];
+    if (fileId.empty())
+    {
+      fileIds_.erase(record[0].get< std::string >());
+    }
+    else
+    {
+      fileIds_[record[0]] = fileId;
+    }
+  }
+  input.close();
+
+  // Journal without removed and overwritten records replaces the old one only when it is written completely
+  std::string tmpPath = persistencePath_ + ".tmp";
+  journal_.open(tmpPath, std::ios::trunc);
+  for (const auto& [key, fileId] : fileIds_)
+  {
+    append(key, fileId);
+  }
+  bool isWritten = static_cast< bool >(journal_);
+  journal_.close();
+  std::error_code ec;
+  if (isWritten)
+  {
+    std::filesystem::rename(tmpPath, persistencePath_, ec);
+  }
+  if (!isWritten || ec)
+  {
+    std::filesystem::remove(tmpPath, ec);
+  }
+  journal_.open(persistencePath_, std::ios::app);
+}
+
+void cppbot::FileIdCache::append(const std::string& key, const std::string& fileId)
+{
+  if (!journal_.is_open())
+  {
+    return;
+  }
+  journal_ << nlohmann::json::array({key, fileId}).dump() << '\n';
+  journal_.flush();
+}
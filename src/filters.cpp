@@ -0,0 +1,187 @@
+#include "cppbot/filters.hpp"
+#include <regex>
+#include <unordered_set>
+#include <utility>
+
+namespace
+{
+  // Chat types take bits after content ones
+  constexpr uint32_t CHAT_TYPE_SHIFT = 16;
+
+  uint32_t chatTypeBit(types::Chat::Type type)
+  {
+    return 1u << (CHAT_TYPE_SHIFT + static_cast< uint32_t >(type));
+  }
+}
+
+handlers::Filter::Filter(Term term):
+  terms_({std::move(term)})
+{}
+
+handlers::Filter handlers::Filter::content(uint32_t content)
+{
+  Filter filter;
+  for (uint32_t bit = 1; bit != 0 && bit <= content; bit <<= 1)
+  {
+    if (content & bit)
+    {
+      filter.terms_.push_back({bit, 0, {}});
+    }
+  }
+  return filter;
+}
+
+handlers::Filter handlers::Filter::chatType(types::Chat::Type type)
+{
+  return Filter(Term{chatTypeBit(type), 0, {}});
+}
+
+handlers::Filter handlers::Filter::regex(const std::string& pattern)
+{
+  auto expression = std::make_shared< const std::regex >(pattern, std::regex::ECMAScript | std::regex::optimize);
+  return predicate([expression](const types::Message& msg)
+  {
+    return std::regex_search(msg.text, *expression);
+  });
+}
+
+handlers::Filter handlers::Filter::fromUsers(const std::vector< size_t >& userIds)
+{
+  auto ids = std::make_shared< const std::unordered_set< size_t > >(userIds.cbegin(), userIds.cend());
+  return predicate([ids](const types::Message& msg)
+  {
+    return ids->count(msg.from.id) != 0;
+  });
+}
+
+handlers::Filter handlers::Filter::inChats(const std::vector< size_t >& chatIds)
+{
+  auto ids = std::make_shared< const std::unordered_set< size_t > >(chatIds.cbegin(), chatIds.cend());
+  return predicate([ids](const types::Message& msg)
+  {
+    return ids->count(msg.chat.id) != 0;
+  });
+}
+
+handlers::Filter handlers::Filter::predicate(predicate_t predicate)
+{
+  return Filter(Term{0, 0, {std::make_shared< const predicate_t >(std::move(predicate))}});
+}
+
+handlers::Filter handlers::Filter::any()
+{
+  return Filter(Term{0, 0, {}});
+}
+
+uint32_t handlers::Filter::features(const types::Message& msg)
+{
+  uint32_t result = chatTypeBit(msg.chat.type);
+  if (!msg.text.empty())
+  {
+    result |= TEXT;
+    if (msg.text.front() == '/')
+    {
+      result |= COMMAND;
+    }
+  }
+  if (!msg.photo.empty())
+  {
+    result |= PHOTO;
+  }
+  if (!msg.document.fileId.empty())
+  {
+    result |= DOCUMENT;
+  }
+  if (!msg.audio.fileId.empty())
+  {
+    result |= AUDIO;
+  }
+  if (!msg.video.fileId.empty())
+  {
+    result |= VIDEO;
+  }
+  return result;
+}
+
+bool handlers::Filter::matches(const types::Message& msg, uint32_t features) const
+{
+  for (const Term& term : terms_)
+  {
+    if (((features & term.required) != term.required) || ((features & term.forbidden) != 0))
+    {
+      continue;
+    }
+    bool isMatched = true;
+    for (size_t i = 0; isMatched && (i < term.predicates.size()); ++i)
+    {
+      isMatched = (*term.predicates[i])(msg);
+    }
+    if (isMatched)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool handlers::Filter::operator()(const types::Message& msg) const
+{
+  return matches(msg, features(msg));
+}
+
+handlers::Filter handlers::operator&&(const Filter& lhs, const Filter& rhs)
+{
+  Filter result;
+  for (const Filter::Term& left : lhs.terms_)
+  {
+    for (const Filter::Term& right : rhs.terms_)
+    {
+      Filter::Term term{left.required | right.required, left.forbidden | right.forbidden, left.predicates};
+      if ((term.required & term.forbidden) != 0)
+      {
+        continue;
+      }
+      term.predicates.insert(term.predicates.end(), right.predicates.cbegin(), right.predicates.cend());
+      result.terms_.push_back(std::move(term));
+    }
+  }
+  return result;
+}
+
+handlers::Filter handlers::operator||(const Filter& lhs, const Filter& rhs)
+{
+  Filter result = lhs;
+  result.terms_.insert(result.terms_.end(), rhs.terms_.cbegin(), rhs.terms_.cend());
+  return result;
+}
+
+handlers::Filter handlers::operator!(const Filter& filter)
+{
+  // De Morgan: negation of every term is a disjunction of negated parts, all of them are joined with "and"
+  Filter result = Filter::any();
+  for (const Filter::Term& term : filter.terms_)
+  {
+    Filter negation;
+    for (uint32_t bit = 1; bit != 0; bit <<= 1)
+    {
+      if (term.required & bit)
+      {
+        negation.terms_.push_back({0, bit, {}});
+      }
+      if (term.forbidden & bit)
+      {
+        negation.terms_.push_back({bit, 0, {}});
+      }
+    }
+    for (const auto& predicate : term.predicates)
+    {
+      auto negated = std::make_shared< const Filter::predicate_t >([predicate](const types::Message& msg)
+      {
+        return !(*predicate)(msg);
+      });
+      negation.terms_.push_back({0, 0, {negated}});
+    }
+    result = result && negation;
+  }
+  return result;
+}
@@ -1,20 +1,18 @@
 #include "cppbot/handlers.hpp"
 #include <string>
-#include <utility>
+#include <string_view>
 
-std::string fetchCommand(const types::Message& msg)
+void handlers::MessageHandler::addHandler(const std::string& cmd, handler_t handler)
 {
-  std::string cmd;
-  for (size_t i = 0; (i < msg.text.size()) && (msg.text[i] != ' '); ++i)
+  cmdHandlers_[cmd].handler = [handler](const types::Message& msg, const CommandArgs&)
   {
-    cmd += msg.text[i];
-  }
-  return std::move(cmd);
+    handler(msg);
+  };
 }
 
-void handlers::MessageHandler::addHandler(const std::string& cmd, handler_t handler)
+void handlers::MessageHandler::addHandler(const std::string& cmd, args_handler_t handler)
 {
-  cmdHandlers_[cmd] = handler;
+  cmdHandlers_[cmd].handler = handler;
 }
 
 void handlers::MessageHandler::addHandler(const states::State& state, state_handler_t handler)
@@ -24,42 +22,162 @@ void handlers::MessageHandler::addHandler(const states::State& state, state_hand
 
 void handlers::MessageHandler::addHandler(const std::string& cmd, const states::State& state, state_handler_t handler)
 {
-  stateCmdHandlers_[{cmd, state}] = handler;
+  cmdHandlers_[cmd].stateHandlers[state] = [handler](const types::Message& msg, states::StateContext& context,
+    const CommandArgs&)
+  {
+    handler(msg, context);
+  };
+}
+
+void handlers::MessageHandler::addHandler(const std::string& cmd, const states::State& state,
+  state_args_handler_t handler)
+{
+  cmdHandlers_[cmd].stateHandlers[state] = handler;
+}
+
+void handlers::MessageHandler::addHandler(const Filter& filter, handler_t handler)
+{
+  filterHandlers_.push_back({filter, [handler](const types::Message& msg, states::StateContext&)
+  {
+    handler(msg);
+  }});
+}
+
+void handlers::MessageHandler::addHandler(const Filter& filter, const states::State& state, state_handler_t handler)
+{
+  stateFilterHandlers_[state].push_back({filter, handler});
+}
+
+void handlers::MessageHandler::setBotUsername(const std::string& username)
+{
+  botUsername_ = (!username.empty() && (username.front() == '@')) ? username.substr(1) : username;
+}
+
+void handlers::MessageHandler::setFallbackHandler(state_handler_t handler)
+{
+  fallbackHandler_ = handler;
+}
+
+void handlers::MessageHandler::addMiddleware(std::shared_ptr< Middleware > middleware)
+{
+  middlewares_.push_back(middleware);
+}
+
+const std::vector< std::shared_ptr< handlers::Middleware > >& handlers::MessageHandler::middlewares() const
+{
+  return middlewares_;
 }
 
 void handlers::MessageHandler::processMessage(const types::Message& msg, states::StateContext& state) const
 {
-  std::string cmd = fetchCommand(msg);
+  std::string_view cmd;
+  std::string_view argsText;
+  if (!detail::splitCommand(msg.text, botUsername_, cmd, argsText))
+  {
+    return;
+  }
+  CommandArgs args(argsText);
   states::State currentState = state.current();
-  bool isHandlerExists = false;
-  if (currentState == states::StateMachine::DEFAULT_STATE)
+  if ((currentState == states::StateMachine::DEFAULT_STATE) && staticRouter_ && staticRouter_(cmd, msg, args))
   {
-    try
-    {
-      cmdHandlers_.at(cmd)(msg);
-    }
-    catch (const std::exception&)
-    {}
     return;
   }
-  try
+  const CommandHandlers* cmdHandlers = cmdHandlers_.find(cmd);
+  if (currentState == states::StateMachine::DEFAULT_STATE)
   {
-    const handlers::MessageHandler::state_handler_t& handler = stateCmdHandlers_.at({cmd, currentState});
-    isHandlerExists = true;
-    handler(msg, state);
+    if (cmdHandlers && cmdHandlers->handler)
+    {
+      cmdHandlers->handler(msg, args);
+      return;
+    }
+    if (callFilterHandlers(filterHandlers_, msg, state))
+    {
+      return;
+    }
   }
-  catch(const std::out_of_range&)
+  else
   {
-    if (!isHandlerExists)
+    if (cmdHandlers)
     {
-      try
+      auto it = cmdHandlers->stateHandlers.find(currentState);
+      if (it != cmdHandlers->stateHandlers.cend())
       {
-        stateHandlers_.at(currentState)(msg, state);
+        it->second(msg, state, args);
+        return;
       }
-      catch(const std::exception&)
-      {}
+    }
+    auto filters = stateFilterHandlers_.find(currentState);
+    if ((filters != stateFilterHandlers_.cend()) && callFilterHandlers(filters->second, msg, state))
+    {
+      return;
+    }
+    auto it = stateHandlers_.find(currentState);
+    if (it != stateHandlers_.cend())
+    {
+      it->second(msg, state);
+      return;
     }
   }
+  if (fallbackHandler_)
+  {
+    fallbackHandler_(msg, state);
+  }
+}
+
+std::string handlers::MessageHandler::routeKey(const types::Message& msg, const states::State& state) const
+{
+  std::string_view cmd;
+  std::string_view argsText;
+  detail::splitCommand(msg.text, botUsername_, cmd, argsText);
+  if (!cmd.empty() && (cmd.front() == '/') && cmdHandlers_.find(cmd))
+  {
+    return std::string(cmd);
+  }
+  if (state != states::StateMachine::DEFAULT_STATE)
+  {
+    return "state #" + std::to_string(std::hash< states::State >{}(state));
+  }
+  uint32_t features = Filter::features(msg);
+  if (features & Filter::COMMAND)
+  {
+    return "command";
+  }
+  if (features & Filter::PHOTO)
+  {
+    return "photo";
+  }
+  if (features & Filter::DOCUMENT)
+  {
+    return "document";
+  }
+  if (features & Filter::AUDIO)
+  {
+    return "audio";
+  }
+  if (features & Filter::VIDEO)
+  {
+    return "video";
+  }
+  return (features & Filter::TEXT) ? "text" : "other";
+}
+
+bool handlers::MessageHandler::callFilterHandlers(const std::vector< FilterHandler >& handlers,
+  const types::Message& msg, states::StateContext& state)
+{
+  if (handlers.empty())
+  {
+    return false;
+  }
+  uint32_t features = Filter::features(msg);
+  for (const FilterHandler& handler : handlers)
+  {
+    if (handler.filter.matches(msg, features))
+    {
+      handler.handler(msg, state);
+      return true;
+    }
+  }
+  return false;
 }
 
 void handlers::CallbackQueryHandler::addHandler(const std::string& callData, handler_t handler, bool allowPartialMatch)
@@ -70,26 +188,97 @@ void handlers::CallbackQueryHandler::addHandler(const std::string& callData, han
   }
   else
   {
-    partialMatchHandlers_[callData] = handler;
+    partialMatchHandlers_[callData] = {callData, handler};
   }
 }
 
+void handlers::CallbackQueryHandler::setPartialMatchMode(PartialMatchMode mode)
+{
+  partialMatchMode_ = mode;
+}
+
+void handlers::CallbackQueryHandler::setFallbackHandler(handler_t handler)
+{
+  fallbackHandler_ = handler;
+}
+
+void handlers::CallbackQueryHandler::addMiddleware(std::shared_ptr< Middleware > middleware)
+{
+  middlewares_.push_back(middleware);
+}
+
+const std::vector< std::shared_ptr< handlers::Middleware > >& handlers::CallbackQueryHandler::middlewares() const
+{
+  return middlewares_;
+}
+
 void handlers::CallbackQueryHandler::processCallbackQuery(const types::CallbackQuery& query) const
 {
-  try
+  if (!query.data.empty() && (query.data.front() == detail::CALLBACK_DATA_PREFIX))
   {
-    handlers_.at(query.data)(query);
+    if (!processTypedCallbackQuery(query) && fallbackHandler_)
+    {
+      fallbackHandler_(query);
+    }
+    return;
+  }
+  if (staticRouter_ && staticRouter_(query.data, query))
+  {
+    return;
+  }
+  auto it = handlers_.find(query.data);
+  if (it != handlers_.cend())
+  {
+    it->second(query);
+    return;
   }
-  catch (const std::out_of_range&)
+  bool isHandled = false;
+  if (partialMatchMode_ == LONGEST_PREFIX)
   {
-    auto it = partialMatchHandlers_.cbegin();
-    while ((it != partialMatchHandlers_.cend()) && (query.data[0] <= (*it).first[0]))
+    const PartialMatchHandler* handler = partialMatchHandlers_.findLongestPrefix(query.data);
+    if (handler)
     {
-      if (((*it).first.size() <= query.data.size()) && (query.data.find((*it).first) == 0))
-      {
-        (*it).second(query);
-      }
-      ++it;
+      isHandled = true;
+      handler->handler(query);
     }
   }
+  else
+  {
+    partialMatchHandlers_.forEachPrefix(query.data, [&query, &isHandled](const PartialMatchHandler& handler)
+    {
+      isHandled = true;
+      handler.handler(query);
+    });
+  }
+  if (!isHandled && fallbackHandler_)
+  {
+    fallbackHandler_(query);
+  }
+}
+
+std::string handlers::CallbackQueryHandler::routeKey(const types::CallbackQuery& query) const
+{
+  if (!query.data.empty() && (query.data.front() == detail::CALLBACK_DATA_PREFIX))
+  {
+    uint8_t payload[detail::MAX_CALLBACK_PAYLOAD_SIZE];
+    size_t size = detail::decodeBase64Url(std::string_view(query.data).substr(1), payload, sizeof(payload));
+    return (size == 0) ? "unknown" : "~" + std::to_string(payload[0]);
+  }
+  if (handlers_.count(query.data) != 0)
+  {
+    return query.data;
+  }
+  const PartialMatchHandler* handler = partialMatchHandlers_.findLongestPrefix(query.data);
+  return handler ? handler->prefix : "unknown";
+}
+
+bool handlers::CallbackQueryHandler::processTypedCallbackQuery(const types::CallbackQuery& query) const
+{
+  uint8_t payload[detail::MAX_CALLBACK_PAYLOAD_SIZE];
+  size_t size = detail::decodeBase64Url(std::string_view(query.data).substr(1), payload, sizeof(payload));
+  if ((size == 0) || (payload[0] >= typedHandlers_.size()) || !typedHandlers_[payload[0]])
+  {
+    return false;
+  }
+  return typedHandlers_[payload[0]](query, payload + 1, size - 1);
 }
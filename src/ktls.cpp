@@ -0,0 +1,271 @@
+#include "ktls.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <openssl/err.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#endif
+
+#if defined(CPPBOT_ENABLE_KTLS) && defined(__linux__) && (OPENSSL_VERSION_NUMBER >= 0x30000000L) \
+  && !defined(OPENSSL_NO_KTLS)
+#define CPPBOT_KTLS_SUPPORTED
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+namespace
+{
+  constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+  struct SslDeleter
+  {
+    void operator()(SSL* ssl) const
+    {
+      SSL_free(ssl);
+    }
+  };
+
+  std::string sslErrorString(const std::string& what)
+  {
+    unsigned long error = ERR_get_error();
+    if (error == 0)
+    {
+      // Socket errors (e.g. timeouts) don't get into the queue of OpenSSL
+      return what + ": " + std::strerror(errno);
+    }
+    char buffer[256] = {};
+    ERR_error_string_n(error, buffer, sizeof(buffer));
+    return what + ": " + buffer;
+  }
+
+  void writeAll(SSL* ssl, const char* data, size_t size)
+  {
+    while (size > 0)
+    {
+      size_t written = 0;
+      if (SSL_write_ex(ssl, data, size, &written) <= 0)
+      {
+        throw std::runtime_error(sslErrorString("SSL_write failed"));
+      }
+      data += written;
+      size -= written;
+    }
+  }
+
+  // Blocking calls of OpenSSL don't know about asio, so timeouts are set on the socket itself.
+  // On Linux send timeout also limits connect()
+  void setTimeouts(asio::ip::tcp::socket& socket, std::chrono::seconds timeout)
+  {
+#ifdef _WIN32
+    DWORD value = static_cast< DWORD >(std::chrono::duration_cast< std::chrono::milliseconds >(timeout).count());
+#else
+    timeval value = {};
+    value.tv_sec = static_cast< decltype(value.tv_sec) >(timeout.count());
+#endif
+    const char* option = reinterpret_cast< const char* >(&value);
+    if ((::setsockopt(socket.native_handle(), SOL_SOCKET, SO_RCVTIMEO, option, sizeof(value)) != 0)
+      || (::setsockopt(socket.native_handle(), SOL_SOCKET, SO_SNDTIMEO, option, sizeof(value)) != 0))
+    {
+      throw std::runtime_error("Cannot set socket timeouts");
+    }
+  }
+
+  void connectSocket(asio::ip::tcp::socket& socket, const asio::ip::tcp::resolver::results_type& endpoints,
+    std::chrono::seconds timeout)
+  {
+    boost::system::error_code ec = asio::error::host_not_found;
+    for (const auto& entry : endpoints)
+    {
+      boost::system::error_code ignored;
+      socket.close(ignored);
+      socket.open(entry.endpoint().protocol());
+      setTimeouts(socket, timeout);
+      socket.connect(entry.endpoint(), ec);
+      if (!ec)
+      {
+        return;
+      }
+    }
+    throw std::runtime_error("Cannot connect: " + ec.message());
+  }
+
+  std::string serializeHeader(const http::request< cppbot::multipart::Body >& req)
+  {
+    std::string header = std::string(req.method_string()) + ' ' + std::string(req.target()) + " HTTP/1.1\r\n";
+    for (const auto& field : req)
+    {
+      header += std::string(field.name_string()) + ": " + std::string(field.value()) + "\r\n";
+    }
+    header += "\r\n";
+    return header;
+  }
+
+  void writeFileChunked(SSL* ssl, const cppbot::multipart::Form::Segment& segment)
+  {
+    std::ifstream file(segment.path, std::ios::binary);
+    if (!file)
+    {
+      throw std::runtime_error("Cannot open file: " + segment.path);
+    }
+    std::vector< char > buffer(CHUNK_SIZE);
+    std::uint64_t left = segment.size;
+    while (left > 0)
+    {
+      size_t toRead = static_cast< size_t >(std::min< std::uint64_t >(buffer.size(), left));
+      file.read(buffer.data(), toRead);
+      if (static_cast< size_t >(file.gcount()) != toRead)
+      {
+        throw std::runtime_error("File was truncated while sending: " + segment.path);
+      }
+      writeAll(ssl, buffer.data(), toRead);
+      left -= toRead;
+    }
+  }
+
+  void writeGenerated(SSL* ssl, const cppbot::multipart::Form::Segment& segment)
+  {
+    std::vector< char > buffer(CHUNK_SIZE);
+    std::uint64_t total = 0;
+    for (size_t n = segment.generator(buffer.data(), buffer.size()); n != 0;
+      n = segment.generator(buffer.data(), buffer.size()))
+    {
+      writeAll(ssl, buffer.data(), n);
+      total += n;
+    }
+    if (total != segment.size)
+    {
+      throw std::runtime_error("Generator produced wrong number of bytes");
+    }
+  }
+
+#ifdef CPPBOT_KTLS_SUPPORTED
+  void writeFileKtls(SSL* ssl, const cppbot::multipart::Form::Segment& segment)
+  {
+    int fd = ::open(segment.path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw std::runtime_error("Cannot open file: " + segment.path);
+    }
+    std::uint64_t offset = 0;
+    while (offset < segment.size)
+    {
+      size_t toSend = static_cast< size_t >(std::min< std::uint64_t >(segment.size - offset, 1 << 30));
+      ossl_ssize_t sent = SSL_sendfile(ssl, fd, static_cast< off_t >(offset), toSend, 0);
+      if (sent <= 0)
+      {
+        ::close(fd);
+        throw std::runtime_error(sslErrorString("SSL_sendfile failed"));
+      }
+      offset += static_cast< std::uint64_t >(sent);
+    }
+    ::close(fd);
+  }
+#endif
+}
+
+bool cppbot::detail::isKtlsAvailable()
+{
+#ifdef CPPBOT_KTLS_SUPPORTED
+  return true;
+#else
+  return false;
+#endif
+}
+
+http::response< http::string_body > cppbot::detail::sendWithKtls(SSL_CTX* ctx, const std::string& host,
+  const std::string& port, const http::request< multipart::Body >& req, std::chrono::seconds timeout)
+{
+  asio::io_context ioContext;
+  asio::ip::tcp::resolver resolver(ioContext);
+  asio::ip::tcp::socket socket(ioContext);
+  connectSocket(socket, resolver.resolve(host, port), timeout);
+
+  std::unique_ptr< SSL, SslDeleter > ssl(SSL_new(ctx));
+  if (!ssl)
+  {
+    throw std::runtime_error(sslErrorString("SSL_new failed"));
+  }
+#ifdef CPPBOT_KTLS_SUPPORTED
+  SSL_set_options(ssl.get(), SSL_OP_ENABLE_KTLS);
+#endif
+  if (!SSL_set_fd(ssl.get(), socket.native_handle()) || !SSL_set_tlsext_host_name(ssl.get(), host.c_str()))
+  {
+    throw std::runtime_error(sslErrorString("Problems with SSL"));
+  }
+  if (SSL_connect(ssl.get()) <= 0)
+  {
+    throw std::runtime_error(sslErrorString("SSL handshake failed"));
+  }
+
+  [[maybe_unused]] bool isOffloaded = false;
+#ifdef CPPBOT_KTLS_SUPPORTED
+  isOffloaded = BIO_get_ktls_send(SSL_get_wbio(ssl.get())) > 0;
+#endif
+
+  std::string header = serializeHeader(req);
+  writeAll(ssl.get(), header.data(), header.size());
+  for (const auto& segment : req.body().segments())
+  {
+    if (segment.buffer)
+    {
+      writeAll(ssl.get(), segment.buffer->data(), segment.buffer->size());
+    }
+    else if (segment.generator)
+    {
+      writeGenerated(ssl.get(), segment);
+    }
+    else if (segment.path.empty())
+    {
+      writeAll(ssl.get(), segment.data.data(), segment.data.size());
+    }
+#ifdef CPPBOT_KTLS_SUPPORTED
+    else if (isOffloaded)
+    {
+      writeFileKtls(ssl.get(), segment);
+    }
+#endif
+    else
+    {
+      writeFileChunked(ssl.get(), segment);
+    }
+  }
+
+  http::response_parser< http::string_body > parser;
+  parser.eager(true);
+  boost::beast::flat_buffer buffer;
+  while (!parser.is_done())
+  {
+    size_t received = 0;
+    auto space = buffer.prepare(16 * 1024);
+    if (SSL_read_ex(ssl.get(), space.data(), space.size(), &received) <= 0)
+    {
+      throw std::runtime_error(sslErrorString("SSL_read failed"));
+    }
+    buffer.commit(received);
+    boost::system::error_code ec;
+    buffer.consume(parser.put(buffer.data(), ec));
+    if (ec && (ec != http::error::need_more))
+    {
+      throw std::runtime_error(ec.message());
+    }
+  }
+  SSL_shutdown(ssl.get());
+  return parser.release();
+}
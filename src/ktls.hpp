@@ -0,0 +1,32 @@
+#ifndef CPPBOT_KTLS_HPP
+#define CPPBOT_KTLS_HPP
+
+#include <chrono>
+#include <string>
+#include <openssl/ssl.h>
+#include <boost/beast/http.hpp>
+#include "cppbot/multipart.hpp"
+
+namespace cppbot
+{
+  namespace detail
+  {
+    /// Returns true if the library was built with kernel TLS upload path.
+    bool isKtlsAvailable();
+
+    /*!
+      @brief Sends multipart request over a blocking TLS connection and returns the response.
+
+      When the kernel accepts TLS offload, file parts are passed to SSL_sendfile() straight from
+      the file descriptor. Otherwise they are read in chunks and written with SSL_write().
+      Form must have known size, chunked transfer encoding is not supported here.
+      Connecting and every send or receive fail when they don't progress for timeout.
+      Throws std::runtime_error on failure.
+    */
+    boost::beast::http::response< boost::beast::http::string_body > sendWithKtls(SSL_CTX* ctx,
+      const std::string& host, const std::string& port, const boost::beast::http::request< multipart::Body >& req,
+      std::chrono::seconds timeout);
+  }
+}
+
+#endif
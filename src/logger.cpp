@@ -0,0 +1,312 @@
+#include "cppbot/logger.hpp"
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+  // Number of rate limit counters, messages with the same hash share one
+  constexpr size_t LIMIT_SLOTS = 256;
+
+  size_t roundUpToPowerOfTwo(size_t value)
+  {
+    size_t result = 2;
+    while (result < value)
+    {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  int64_t steadyMilliseconds()
+  {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast< std::chrono::milliseconds >(now).count();
+  }
+
+  void appendValue(std::string& line, const std::string& value)
+  {
+    if (!value.empty() && (value.find_first_of(" \"=\n") == std::string::npos))
+    {
+      line += value;
+      return;
+    }
+    line += '"';
+    for (char c : value)
+    {
+      if ((c == '"') || (c == '\\'))
+      {
+        line += '\\';
+      }
+      line += (c == '\n') ? ' ' : c;
+    }
+    line += '"';
+  }
+}
+
+const char* cppbot::levelName(LogLevel level)
+{
+  static const char* names[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+  return names[static_cast< size_t >(level)];
+}
+
+void cppbot::LogSink::flush()
+{}
+
+cppbot::StreamSink::StreamSink(std::ostream& stream):
+  stream_(stream),
+  line_()
+{}
+
+void cppbot::StreamSink::write(const LogRecord& record)
+{
+  std::time_t seconds = std::chrono::system_clock::to_time_t(record.time);
+  auto milliseconds = std::chrono::duration_cast< std::chrono::milliseconds >(record.time.time_since_epoch()) % 1000;
+  std::tm utc{};
+  // cppbot::log() writes from calling threads without a logger, so the static buffer of gmtime can't be used
+#ifdef _WIN32
+  gmtime_s(&utc, &seconds);
+#else
+  gmtime_r(&seconds, &utc);
+#endif
+  std::ostringstream time;
+  time << std::put_time(&utc, "%Y-%m-%d %H:%M:%S") << '.' << std::setw(3) << std::setfill('0')
+    << milliseconds.count();
+  line_ = time.str();
+  line_ += ' ';
+  line_ += levelName(record.level);
+  line_ += ' ';
+  line_ += record.message;
+  for (const auto& field : record.fields)
+  {
+    line_ += ' ';
+    line_ += field.first;
+    line_ += '=';
+    appendValue(line_, field.second);
+  }
+  line_ += '\n';
+  stream_ << line_;
+}
+
+void cppbot::StreamSink::flush()
+{
+  stream_.flush();
+}
+
+cppbot::AsyncLogger::AsyncLogger(std::shared_ptr< LogSink > sink, LogLevel level, size_t capacity,
+  std::chrono::milliseconds flushInterval):
+  sink_(sink ? sink : std::make_shared< StreamSink >(std::cerr)),
+  level_(level),
+  burst_(10),
+  window_(1000),
+  slots_(std::make_unique< Slot[] >(roundUpToPowerOfTwo(capacity))),
+  mask_(roundUpToPowerOfTwo(capacity) - 1),
+  enqueuePos_(0),
+  dequeuePos_(0),
+  dropped_(0),
+  reportedDrops_(0),
+  limits_(LIMIT_SLOTS),
+  flushInterval_(flushInterval),
+  isStopped_(false),
+  isFlushRequested_(false),
+  mutex_(),
+  wakeCondition_(),
+  flushedCondition_(),
+  thread_()
+{
+  for (size_t i = 0; i <= mask_; ++i)
+  {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  for (Limit& limit : limits_)
+  {
+    limit.windowStart.store(0, std::memory_order_relaxed);
+    limit.count.store(0, std::memory_order_relaxed);
+    limit.suppressed.store(0, std::memory_order_relaxed);
+  }
+  thread_ = std::thread(&cppbot::AsyncLogger::work, this);
+}
+
+cppbot::AsyncLogger::~AsyncLogger()
+{
+  {
+    std::lock_guard< std::mutex > lock(mutex_);
+    isStopped_ = true;
+  }
+  wakeCondition_.notify_all();
+  thread_.join();
+}
+
+void cppbot::AsyncLogger::log(LogLevel level, const std::string& message, LogFields fields)
+{
+  if (!isEnabled(level))
+  {
+    return;
+  }
+  uint32_t suppressed = 0;
+  if (isLimited(message, suppressed))
+  {
+    return;
+  }
+  if (suppressed > 0)
+  {
+    fields.emplace_back("suppressed", std::to_string(suppressed));
+  }
+
+  // Bounded queue of D. Vyukov: a slot is free for position pos when its sequence equals pos
+  size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+  Slot* slot = nullptr;
+  while (true)
+  {
+    slot = &slots_[pos & mask_];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    auto diff = static_cast< std::ptrdiff_t >(sequence) - static_cast< std::ptrdiff_t >(pos);
+    if (diff == 0)
+    {
+      if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    else
+    {
+      pos = enqueuePos_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->record.level = level;
+  slot->record.time = std::chrono::system_clock::now();
+  slot->record.message = message;
+  slot->record.fields = std::move(fields);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void cppbot::AsyncLogger::setLevel(LogLevel level)
+{
+  level_.store(level, std::memory_order_relaxed);
+}
+
+void cppbot::AsyncLogger::setRateLimit(size_t burst, std::chrono::milliseconds window)
+{
+  burst_.store(burst, std::memory_order_relaxed);
+  window_.store(window.count(), std::memory_order_relaxed);
+}
+
+void cppbot::AsyncLogger::flush()
+{
+  size_t target = enqueuePos_.load(std::memory_order_acquire);
+  std::unique_lock< std::mutex > lock(mutex_);
+  isFlushRequested_ = true;
+  wakeCondition_.notify_all();
+  flushedCondition_.wait(lock, [this, target]()
+  {
+    return isStopped_ || (dequeuePos_.load(std::memory_order_acquire) >= target);
+  });
+}
+
+size_t cppbot::AsyncLogger::dropped() const
+{
+  return dropped_.load(std::memory_order_relaxed);
+}
+
+bool cppbot::AsyncLogger::isLimited(const std::string& message, uint32_t& suppressed)
+{
+  size_t burst = burst_.load(std::memory_order_relaxed);
+  if (burst == 0)
+  {
+    return false;
+  }
+  Limit& limit = limits_[std::hash< std::string >()(message) % LIMIT_SLOTS];
+  int64_t now = steadyMilliseconds();
+  int64_t windowStart = limit.windowStart.load(std::memory_order_relaxed);
+  if ((now - windowStart >= window_.load(std::memory_order_relaxed))
+    && limit.windowStart.compare_exchange_strong(windowStart, now, std::memory_order_relaxed))
+  {
+    // Thread starting a new window reports records suppressed in the previous one
+    limit.count.store(0, std::memory_order_relaxed);
+    suppressed = limit.suppressed.exchange(0, std::memory_order_relaxed);
+  }
+  if (limit.count.fetch_add(1, std::memory_order_relaxed) < burst)
+  {
+    return false;
+  }
+  limit.suppressed.fetch_add(1 + suppressed, std::memory_order_relaxed);
+  suppressed = 0;
+  return true;
+}
+
+bool cppbot::AsyncLogger::pop(LogRecord& record)
+{
+  size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+  Slot& slot = slots_[pos & mask_];
+  if (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+  {
+    return false;
+  }
+  std::swap(record, slot.record);
+  slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+  dequeuePos_.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+void cppbot::AsyncLogger::drain()
+{
+  LogRecord record;
+  bool isWritten = false;
+  while (pop(record))
+  {
+    sink_->write(record);
+    isWritten = true;
+  }
+  size_t dropped = dropped_.load(std::memory_order_relaxed);
+  if (dropped != reportedDrops_)
+  {
+    sink_->write({LogLevel::WARNING, std::chrono::system_clock::now(), "Log records dropped, the queue is full",
+      {{"count", std::to_string(dropped - reportedDrops_)}}});
+    reportedDrops_ = dropped;
+    isWritten = true;
+  }
+  if (isWritten)
+  {
+    sink_->flush();
+  }
+}
+
+void cppbot::AsyncLogger::work()
+{
+  bool isStopped = false;
+  while (!isStopped)
+  {
+    {
+      std::unique_lock< std::mutex > lock(mutex_);
+      wakeCondition_.wait_for(lock, flushInterval_, [this]()
+      {
+        return isStopped_ || isFlushRequested_;
+      });
+      isFlushRequested_ = false;
+      isStopped = isStopped_;
+    }
+    drain();
+    std::lock_guard< std::mutex > lock(mutex_);
+    flushedCondition_.notify_all();
+  }
+}
+
+void cppbot::log(const std::shared_ptr< AsyncLogger >& logger, LogLevel level, const std::string& message,
+  LogFields fields)
+{
+  if (logger)
+  {
+    logger->log(level, message, std::move(fields));
+    return;
+  }
+  // Line is written with one call, so lines of different threads aren't mixed
+  StreamSink sink(std::cerr);
+  sink.write({level, std::chrono::system_clock::now(), message, std::move(fields)});
+}
@@ -0,0 +1,396 @@
+#include "cppbot/metrics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+namespace
+{
+  std::string formatNumber(double value)
+  {
+    if (std::isinf(value))
+    {
+      return (value > 0) ? "+Inf" : "-Inf";
+    }
+    if (std::isnan(value))
+    {
+      return "NaN";
+    }
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.15g", value);
+    return buffer;
+  }
+
+  std::string escape(const std::string& text, bool isLabel)
+  {
+    std::string result;
+    result.reserve(text.size());
+    for (char c : text)
+    {
+      if (c == '\\')
+      {
+        result += "\\\\";
+      }
+      else if (c == '\n')
+      {
+        result += "\\n";
+      }
+      else if ((c == '"') && isLabel)
+      {
+        result += "\\\"";
+      }
+      else
+      {
+        result += c;
+      }
+    }
+    return result;
+  }
+
+  std::string formatLabels(const cppbot::Metrics::labels_t& labels)
+  {
+    std::string result;
+    for (const auto& label : labels)
+    {
+      if (!result.empty())
+      {
+        result += ',';
+      }
+      result += label.first + "=\"" + escape(label.second, true) + '"';
+    }
+    return result;
+  }
+
+  void writeSample(std::string& out, const std::string& name, const std::string& labels, const std::string& value)
+  {
+    out += name;
+    if (!labels.empty())
+    {
+      out += '{' + labels + '}';
+    }
+    out += ' ' + value + '\n';
+  }
+
+  const char* typeName(int type)
+  {
+    static const char* names[] = {"counter", "gauge", "histogram"};
+    return names[type];
+  }
+}
+
+cppbot::Counter::Counter():
+  cells_()
+{
+  for (Cell& cell : cells_)
+  {
+    cell.value.store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t cppbot::Counter::value() const
+{
+  uint64_t result = 0;
+  for (const Cell& cell : cells_)
+  {
+    result += cell.value.load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+cppbot::Histogram::Histogram(std::vector< double > bounds):
+  bounds_(std::move(bounds)),
+  cells_()
+{
+  for (Cell& cell : cells_)
+  {
+    size_t lines = (bounds_.size() + COUNTS_PER_LINE) / COUNTS_PER_LINE;
+    cell.lines = std::make_unique< CountLine[] >(lines);
+    for (size_t i = 0; i < lines * COUNTS_PER_LINE; ++i)
+    {
+      cell.count(i).store(0, std::memory_order_relaxed);
+    }
+    cell.sum.store(0.0, std::memory_order_relaxed);
+  }
+}
+
+void cppbot::Histogram::observe(double value)
+{
+  size_t bucket = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+  Cell& cell = cells_[detail::threadShard()];
+  cell.count(bucket).fetch_add(1, std::memory_order_relaxed);
+  // Cell is rarely shared by several threads, so the loop almost never repeats
+  double sum = cell.sum.load(std::memory_order_relaxed);
+  while (!cell.sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed))
+  {}
+}
+
+cppbot::Histogram::Snapshot cppbot::Histogram::snapshot() const
+{
+  Snapshot result{bounds_, std::vector< uint64_t >(bounds_.size() + 1, 0), 0.0, 0};
+  for (const Cell& cell : cells_)
+  {
+    for (size_t i = 0; i <= bounds_.size(); ++i)
+    {
+      uint64_t count = cell.count(i).load(std::memory_order_relaxed);
+      result.counts[i] += count;
+      result.count += count;
+    }
+    result.sum += cell.sum.load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+cppbot::Metrics::Metrics():
+  families_(),
+  mutex_()
+{}
+
+std::vector< double > cppbot::Metrics::latencyBounds()
+{
+  return {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0};
+}
+
+cppbot::Counter& cppbot::Metrics::counter(const std::string& name, const std::string& help, const labels_t& labels)
+{
+  std::string formatted = formatLabels(labels);
+  Series* series = find(name, COUNTER, formatted);
+  if (series)
+  {
+    return *series->counter;
+  }
+  std::unique_lock< std::shared_mutex > lock(mutex_);
+  Series& inserted = insert(name, help, COUNTER, formatted);
+  if (!inserted.counter)
+  {
+    inserted.counter = std::make_unique< Counter >();
+  }
+  return *inserted.counter;
+}
+
+cppbot::Histogram& cppbot::Metrics::histogram(const std::string& name, const std::string& help,
+  const labels_t& labels, const std::vector< double >& bounds)
+{
+  std::string formatted = formatLabels(labels);
+  Series* series = find(name, HISTOGRAM, formatted);
+  if (series)
+  {
+    return *series->histogram;
+  }
+  std::unique_lock< std::shared_mutex > lock(mutex_);
+  Series& inserted = insert(name, help, HISTOGRAM, formatted);
+  if (!inserted.histogram)
+  {
+    inserted.histogram = std::make_unique< Histogram >(bounds);
+  }
+  return *inserted.histogram;
+}
+
+void cppbot::Metrics::gauge(const std::string& name, const std::string& help, gauge_t read, const labels_t& labels)
+{
+  std::unique_lock< std::shared_mutex > lock(mutex_);
+  insert(name, help, GAUGE, formatLabels(labels)).gauge = std::move(read);
+}
+
+std::string cppbot::Metrics::exposition() const
+{
+  std::string out;
+  std::shared_lock< std::shared_mutex > lock(mutex_);
+  for (const auto& family : families_)
+  {
+    const std::string& name = family.first;
+    out += "# HELP " + name + ' ' + escape(family.second.help, false) + '\n';
+    out += "# TYPE " + name + ' ' + typeName(family.second.type) + '\n';
+    for (const auto& item : family.second.series)
+    {
+      const Series& series = item.second;
+      if (series.counter)
+      {
+        writeSample(out, name, series.labels, std::to_string(series.counter->value()));
+      }
+      else if (series.gauge)
+      {
+        double value = series.gauge();
+        if (!std::isnan(value))
+        {
+          writeSample(out, name, series.labels, formatNumber(value));
+        }
+      }
+      else if (series.histogram)
+      {
+        Histogram::Snapshot snapshot = series.histogram->snapshot();
+        std::string prefix = series.labels.empty() ? "" : series.labels + ',';
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < snapshot.counts.size(); ++i)
+        {
+          cumulative += snapshot.counts[i];
+          double bound = (i < snapshot.bounds.size()) ? snapshot.bounds[i] : INFINITY;
+          writeSample(out, name + "_bucket", prefix + "le=\"" + formatNumber(bound) + '"', std::to_string(cumulative));
+        }
+        writeSample(out, name + "_sum", series.labels, formatNumber(snapshot.sum));
+        writeSample(out, name + "_count", series.labels, std::to_string(snapshot.count));
+      }
+    }
+  }
+  return out;
+}
+
+cppbot::Metrics::Series* cppbot::Metrics::find(const std::string& name, Type type, const std::string& labels)
+{
+  std::shared_lock< std::shared_mutex > lock(mutex_);
+  auto family = families_.find(name);
+  if (family == families_.end())
+  {
+    return nullptr;
+  }
+  if (family->second.type != type)
+  {
+    throw std::invalid_argument("Metric \"" + name + "\" is already registered as " + typeName(family->second.type));
+  }
+  auto series = family->second.series.find(labels);
+  return (series != family->second.series.end()) ? &series->second : nullptr;
+}
+
+cppbot::Metrics::Series& cppbot::Metrics::insert(const std::string& name, const std::string& help, Type type,
+  const std::string& labels)
+{
+  auto family = families_.find(name);
+  if (family == families_.end())
+  {
+    family = families_.emplace(name, Family{help, type, {}}).first;
+  }
+  else if (family->second.type != type)
+  {
+    throw std::invalid_argument("Metric \"" + name + "\" is already registered as " + typeName(family->second.type));
+  }
+  Series& series = family->second.series[labels];
+  series.labels = labels;
+  return series;
+}
+
+class cppbot::MetricsServer::Session: public std::enable_shared_from_this< Session >
+{
+ public:
+  Session(asio::ip::tcp::socket socket, std::shared_ptr< Metrics > metrics):
+    socket_(std::move(socket)),
+    metrics_(metrics),
+    buffer_(),
+    req_(),
+    res_()
+  {}
+
+  void read()
+  {
+    req_ = {};
+    auto self = shared_from_this();
+    http::async_read(socket_, buffer_, req_, [this, self](const boost::system::error_code& ec, size_t)
+    {
+      if (ec)
+      {
+        close();
+        return;
+      }
+      write();
+    });
+  }
+ private:
+  asio::ip::tcp::socket socket_;
+  std::shared_ptr< Metrics > metrics_;
+  boost::beast::flat_buffer buffer_;
+  http::request< http::string_body > req_;
+  http::response< http::string_body > res_;
+
+  void write()
+  {
+    boost::beast::string_view target = req_.target();
+    target = target.substr(0, target.find('?'));
+    res_ = {};
+    res_.version(req_.version());
+    res_.keep_alive(req_.keep_alive());
+    if ((req_.method() == http::verb::get) && (target == "/metrics"))
+    {
+      res_.result(http::status::ok);
+      res_.set(http::field::content_type, "text/plain; version=0.0.4; charset=utf-8");
+      res_.body() = metrics_->exposition();
+    }
+    else
+    {
+      res_.result(http::status::not_found);
+      res_.set(http::field::content_type, "text/plain");
+      res_.body() = "Not found\n";
+    }
+    res_.prepare_payload();
+    auto self = shared_from_this();
+    http::async_write(socket_, res_, [this, self](const boost::system::error_code& ec, size_t)
+    {
+      if (ec || !res_.keep_alive())
+      {
+        close();
+        return;
+      }
+      read();
+    });
+  }
+
+  void close()
+  {
+    boost::system::error_code ec;
+    socket_.shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+    socket_.close(ec);
+  }
+};
+
+cppbot::MetricsServer::MetricsServer(asio::io_context& ioContext, std::shared_ptr< Metrics > metrics,
+  unsigned short port, const std::string& address):
+  acceptor_(ioContext),
+  metrics_(metrics),
+  logger_()
+{
+  asio::ip::tcp::endpoint endpoint(asio::ip::make_address(address), port);
+  acceptor_.open(endpoint.protocol());
+  acceptor_.set_option(asio::socket_base::reuse_address(true));
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+  accept();
+}
+
+cppbot::MetricsServer::~MetricsServer()
+{
+  boost::system::error_code ec;
+  acceptor_.close(ec);
+}
+
+unsigned short cppbot::MetricsServer::port() const
+{
+  return acceptor_.local_endpoint().port();
+}
+
+void cppbot::MetricsServer::setLogger(std::shared_ptr< AsyncLogger > logger)
+{
+  logger_ = logger;
+}
+
+void cppbot::MetricsServer::accept()
+{
+  acceptor_.async_accept([this](const boost::system::error_code& ec, asio::ip::tcp::socket socket)
+  {
+    if (ec == asio::error::operation_aborted)
+    {
+      return;
+    }
+    if (!ec)
+    {
+      std::make_shared< Session >(std::move(socket), metrics_)->read();
+    }
+    else
+    {
+      log(logger_, LogLevel::ERROR, "Metrics server cannot accept connection", {{"error", ec.message()}});
+    }
+    accept();
+  });
+}
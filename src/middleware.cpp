@@ -0,0 +1,17 @@
+#include "cppbot/middleware.hpp"
+
+bool handlers::Middleware::before(const types::Message&, states::StateContext&)
+{
+  return true;
+}
+
+void handlers::Middleware::after(const types::Message&, states::StateContext&)
+{}
+
+bool handlers::Middleware::before(const types::CallbackQuery&)
+{
+  return true;
+}
+
+void handlers::Middleware::after(const types::CallbackQuery&)
+{}
@@ -0,0 +1,204 @@
+#include "cppbot/monitor.hpp"
+#include <algorithm>
+#include <sstream>
+
+namespace
+{
+  size_t bucketOf(std::chrono::microseconds latency)
+  {
+    size_t bucket = 0;
+    for (auto value = static_cast< uint64_t >(std::max< int64_t >(latency.count(), 0)); value > 0; value >>= 1)
+    {
+      ++bucket;
+    }
+    return std::min< size_t >(bucket, std::tuple_size< decltype(cppbot::Monitor::Stats::histogram) >::value - 1);
+  }
+
+  cppbot::Monitor::Stats makeStats(const std::string& key)
+  {
+    return {key, 0, 0, cppbot::Monitor::duration_t(0), cppbot::Monitor::duration_t(0), {}};
+  }
+}
+
+cppbot::Monitor::duration_t cppbot::Monitor::Stats::mean() const
+{
+  return (count == 0) ? duration_t(0) : duration_t(total.count() / static_cast< int64_t >(count));
+}
+
+cppbot::Monitor::duration_t cppbot::Monitor::Stats::percentile(double q) const
+{
+  if (count == 0)
+  {
+    return duration_t(0);
+  }
+  size_t rank = static_cast< size_t >(q * static_cast< double >(count - 1));
+  size_t seen = 0;
+  for (size_t i = 0; i < histogram.size(); ++i)
+  {
+    seen += histogram[i];
+    if (seen > rank)
+    {
+      return std::min(duration_t((int64_t(1) << i) - 1), max);
+    }
+  }
+  return max;
+}
+
+cppbot::Monitor::Scope::Scope(Monitor* monitor, const std::string& key):
+  monitor_(monitor),
+  token_(monitor ? monitor->start(key) : 0)
+{}
+
+cppbot::Monitor::Scope::~Scope()
+{
+  if (monitor_)
+  {
+    monitor_->finish(token_);
+  }
+}
+
+cppbot::Monitor::Monitor(duration_t budget, slow_handler_t onSlow):
+  budget_(budget),
+  onSlow_(onSlow),
+  invocations_(),
+  freeTokens_(),
+  stats_(),
+  isStopped_(false),
+  mutex_(),
+  stopCondition_(),
+  watchdog_(),
+  logger_()
+{
+  if (!onSlow_)
+  {
+    onSlow_ = [this](const std::string& key, duration_t elapsed, std::thread::id thread)
+    {
+      std::ostringstream threadId;
+      threadId << thread;
+      log(logger_, LogLevel::WARNING, "Slow handler", {{"key", key},
+        {"elapsed_ms", std::to_string(elapsed.count() / 1000)}, {"thread", threadId.str()}});
+    };
+  }
+  watchdog_ = std::thread(&cppbot::Monitor::watch, this);
+}
+
+cppbot::Monitor::~Monitor()
+{
+  {
+    std::lock_guard< std::mutex > lock(mutex_);
+    isStopped_ = true;
+  }
+  stopCondition_.notify_all();
+  watchdog_.join();
+}
+
+size_t cppbot::Monitor::start(const std::string& key)
+{
+  Invocation invocation{key, std::chrono::steady_clock::now(), std::this_thread::get_id(), true, false};
+  std::lock_guard< std::mutex > lock(mutex_);
+  if (freeTokens_.empty())
+  {
+    invocations_.push_back(std::move(invocation));
+    return invocations_.size() - 1;
+  }
+  size_t token = freeTokens_.back();
+  freeTokens_.pop_back();
+  invocations_[token] = std::move(invocation);
+  return token;
+}
+
+void cppbot::Monitor::finish(size_t token)
+{
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard< std::mutex > lock(mutex_);
+  Invocation& invocation = invocations_[token];
+  auto latency = std::chrono::duration_cast< duration_t >(now - invocation.start);
+  auto it = stats_.find(invocation.key);
+  if (it == stats_.end())
+  {
+    it = stats_.emplace(invocation.key, makeStats(invocation.key)).first;
+  }
+  Stats& stats = it->second;
+  ++stats.count;
+  stats.slowCount += (latency > budget_) ? 1 : 0;
+  stats.total += latency;
+  stats.max = std::max(stats.max, latency);
+  ++stats.histogram[bucketOf(latency)];
+  invocation.isActive = false;
+  freeTokens_.push_back(token);
+}
+
+cppbot::Monitor::Stats cppbot::Monitor::stats(const std::string& key) const
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  auto it = stats_.find(key);
+  return (it != stats_.cend()) ? it->second : makeStats(key);
+}
+
+std::vector< cppbot::Monitor::Stats > cppbot::Monitor::slowest(size_t n) const
+{
+  std::vector< Stats > result;
+  {
+    std::lock_guard< std::mutex > lock(mutex_);
+    result.reserve(stats_.size());
+    for (const auto& stats : stats_)
+    {
+      result.push_back(stats.second);
+    }
+  }
+  std::sort(result.begin(), result.end(), [](const Stats& lhs, const Stats& rhs)
+  {
+    duration_t left = lhs.percentile(0.99);
+    duration_t right = rhs.percentile(0.99);
+    return (left != right) ? (left > right) : (lhs.max > rhs.max);
+  });
+  if (result.size() > n)
+  {
+    result.resize(n);
+  }
+  return result;
+}
+
+void cppbot::Monitor::reset()
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  stats_.clear();
+}
+
+void cppbot::Monitor::setLogger(std::shared_ptr< AsyncLogger > logger)
+{
+  logger_ = logger;
+}
+
+void cppbot::Monitor::watch()
+{
+  // Checking several times per budget keeps report delay small
+  auto period = std::max< duration_t >(budget_ / 4, std::chrono::milliseconds(1));
+  std::unique_lock< std::mutex > lock(mutex_);
+  while (!stopCondition_.wait_for(lock, period, [this]
+  {
+    return isStopped_;
+  }))
+  {
+    auto now = std::chrono::steady_clock::now();
+    std::vector< Invocation > slow;
+    for (Invocation& invocation : invocations_)
+    {
+      if (invocation.isActive && !invocation.isReported && (now - invocation.start > budget_))
+      {
+        invocation.isReported = true;
+        slow.push_back(invocation);
+      }
+    }
+    if (slow.empty())
+    {
+      continue;
+    }
+    lock.unlock();
+    for (const Invocation& invocation : slow)
+    {
+      onSlow_(invocation.key, std::chrono::duration_cast< duration_t >(now - invocation.start), invocation.thread);
+    }
+    lock.lock();
+  }
+}
@@ -0,0 +1,203 @@
+#include "cppbot/multipart.hpp"
+#include <algorithm>
+#include <string>
+
+namespace
+{
+  constexpr size_t CHUNK_SIZE = 64 * 1024;
+}
+
+cppbot::multipart::Form::Form(const std::string& boundary):
+  boundary_(boundary),
+  segments_(),
+  size_(0)
+{}
+
+void cppbot::multipart::Form::append(const std::string& text)
+{
+  if (segments_.empty() || !segments_.back().path.empty() || segments_.back().buffer || segments_.back().generator)
+  {
+    segments_.push_back({"", "", 0, nullptr, nullptr});
+  }
+  segments_.back().data += text;
+  segments_.back().size += text.size();
+  size_ += text.size();
+}
+
+void cppbot::multipart::Form::addField(const std::string& name, const std::string& value)
+{
+  append("--" + boundary_ + "\r\n");
+  append("Content-Disposition: form-data; name=\"" + name + "\"\r\n\r\n");
+  append(value + "\r\n");
+}
+
+void cppbot::multipart::Form::addFields(const nlohmann::json& fields)
+{
+  for (const auto& [field, value] : fields.items())
+  {
+    addField(field, value.dump());
+  }
+}
+
+void cppbot::multipart::Form::addFile(const std::string& name, const types::InputFile& file)
+{
+  append("--" + boundary_ + "\r\n");
+  append("Content-Disposition: form-data; name=\"" + name + "\"; filename=\"" + file.name() + "\"\r\n");
+  append("Content-type: application/octet-stream\r\n\r\n");
+  size_t fileSize = file.size();
+  switch (file.source())
+  {
+  case types::InputFile::PATH:
+    segments_.push_back({"", file.path(), fileSize, nullptr, nullptr});
+    break;
+  case types::InputFile::BUFFER:
+    segments_.push_back({"", "", fileSize, file.buffer(), nullptr});
+    break;
+  case types::InputFile::GENERATOR:
+    segments_.push_back({"", "", fileSize, nullptr, file.generator()});
+    break;
+  }
+  if (fileSize == types::InputFile::UNKNOWN_SIZE)
+  {
+    hasKnownSize_ = false;
+  }
+  else
+  {
+    size_ += fileSize;
+  }
+  append("\r\n");
+}
+
+void cppbot::multipart::Form::finish()
+{
+  append("--" + boundary_ + "--\r\n");
+}
+
+std::string cppbot::multipart::Form::contentType() const
+{
+  return "multipart/form-data; boundary=" + boundary_;
+}
+
+std::uint64_t cppbot::multipart::Form::size() const
+{
+  return size_;
+}
+
+bool cppbot::multipart::Form::hasKnownSize() const
+{
+  return hasKnownSize_;
+}
+
+bool cppbot::multipart::Form::isReplayable() const
+{
+  return std::none_of(segments_.begin(), segments_.end(), [](const Segment& segment)
+  {
+    return static_cast< bool >(segment.generator);
+  });
+}
+
+const std::vector< cppbot::multipart::Form::Segment >& cppbot::multipart::Form::segments() const
+{
+  return segments_;
+}
+
+std::uint64_t cppbot::multipart::Body::size(const value_type& form)
+{
+  return form.size();
+}
+
+void cppbot::multipart::Body::writer::init(boost::system::error_code& ec)
+{
+  ec = {};
+  segment_ = 0;
+  offset_ = 0;
+  isStarted_ = false;
+}
+
+boost::optional< std::pair< cppbot::multipart::Body::writer::const_buffers_type, bool > >
+  cppbot::multipart::Body::writer::get(boost::system::error_code& ec)
+{
+  ec = {};
+  const std::vector< Form::Segment >& segments = form_.segments();
+  while (segment_ < segments.size())
+  {
+    const Form::Segment& segment = segments[segment_];
+    bool isLast = (segment_ + 1 == segments.size());
+    if (segment.buffer)
+    {
+      ++segment_;
+      if (segment.buffer->empty())
+      {
+        continue;
+      }
+      return {{const_buffers_type(segment.buffer->data(), segment.buffer->size()), !isLast}};
+    }
+    if (segment.generator)
+    {
+      if (!isStarted_)
+      {
+        isStarted_ = true;
+        offset_ = 0;
+        buffer_.resize(CHUNK_SIZE);
+      }
+      size_t produced = segment.generator(buffer_.data(), buffer_.size());
+      if (produced == 0)
+      {
+        isStarted_ = false;
+        ++segment_;
+        if ((segment.size != types::InputFile::UNKNOWN_SIZE) && (offset_ != segment.size))
+        {
+          // Generator produced less bytes than it was declared
+          ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+          return boost::none;
+        }
+        continue;
+      }
+      offset_ += produced;
+      if ((segment.size != types::InputFile::UNKNOWN_SIZE) && (offset_ > segment.size))
+      {
+        ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+        return boost::none;
+      }
+      return {{const_buffers_type(buffer_.data(), produced), true}};
+    }
+    if (segment.path.empty())
+    {
+      ++segment_;
+      if (segment.data.empty())
+      {
+        continue;
+      }
+      return {{const_buffers_type(segment.data.data(), segment.data.size()), !isLast}};
+    }
+    if (!file_.is_open())
+    {
+      file_.open(segment.path, std::ios::binary);
+      if (!file_)
+      {
+        ec = boost::system::errc::make_error_code(boost::system::errc::no_such_file_or_directory);
+        return boost::none;
+      }
+      offset_ = 0;
+      buffer_.resize(CHUNK_SIZE);
+    }
+    if (offset_ == segment.size)
+    {
+      file_.close();
+      ++segment_;
+      continue;
+    }
+    size_t toRead = static_cast< size_t >(std::min< std::uint64_t >(buffer_.size(), segment.size - offset_));
+    file_.read(buffer_.data(), toRead);
+    if (static_cast< size_t >(file_.gcount()) != toRead)
+    {
+      // File was truncated after Content-Length had been computed
+      ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+      return boost::none;
+    }
+    offset_ += toRead;
+    bool more = (offset_ < segment.size) || !isLast;
+    return {{const_buffers_type(buffer_.data(), toRead), more}};
+  }
+  return boost::none;
+}
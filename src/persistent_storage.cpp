@@ -0,0 +1,574 @@
+#include "cppbot/persistent_storage.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <boost/crc.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  using states::detail::put;
+  using states::detail::putString;
+  using states::detail::RecordReader;
+
+  constexpr char SNAPSHOT_MAGIC[] = "CPPBOTS1";
+  constexpr size_t SNAPSHOT_MAGIC_SIZE = sizeof(SNAPSHOT_MAGIC) - 1;
+  constexpr char SNAPSHOT_NAME[] = "snapshot.bin";
+  constexpr char LOG_NAME[] = "states.log";
+  constexpr char OLD_LOG_NAME[] = "states.old.log"; ///< Log waiting for merging into the snapshot
+
+  enum RecordType: uint8_t
+  {
+    CHAT_RECORD = 1,
+    REMOVE_RECORD = 2
+  };
+
+  uint32_t crc32(const char* data, size_t size)
+  {
+    boost::crc_32_type crc;
+    crc.process_bytes(data, size);
+    return crc.checksum();
+  }
+
+  std::string readFile(const std::filesystem::path& path)
+  {
+    std::ifstream file(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator< char >(file)), std::istreambuf_iterator< char >());
+  }
+
+  // Calls apply for every record of the snapshot, returns false if it's damaged
+  template< class F >
+  bool readSnapshot(const std::filesystem::path& path, F apply)
+  {
+    namespace ipc = boost::interprocess;
+    std::error_code ec;
+    size_t size = std::filesystem::file_size(path, ec);
+    if (ec || (size < SNAPSHOT_MAGIC_SIZE + sizeof(uint64_t) + sizeof(uint32_t)))
+    {
+      return true;
+    }
+    ipc::file_mapping file(path.string().c_str(), ipc::read_only);
+    ipc::mapped_region region(file, ipc::read_only);
+    const char* data = static_cast< const char* >(region.get_address());
+    const char* content = data + SNAPSHOT_MAGIC_SIZE;
+    size_t contentSize = size - SNAPSHOT_MAGIC_SIZE - sizeof(uint32_t);
+    uint32_t checksum;
+    std::memcpy(&checksum, content + contentSize, sizeof(checksum));
+    if ((std::memcmp(data, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0) || (crc32(content, contentSize) != checksum))
+    {
+      return false;
+    }
+    RecordReader reader(content, contentSize);
+    uint64_t count = reader.get< uint64_t >();
+    for (uint64_t i = 0; i < count; ++i)
+    {
+      apply(reader.getString());
+    }
+    return true;
+  }
+
+  // Calls apply for every good record of the log, returns size of the good part
+  template< class F >
+  size_t readLog(const std::string& content, F apply)
+  {
+    size_t offset = 0;
+    const size_t headerSize = 2 * sizeof(uint32_t);
+    while (content.size() - offset >= headerSize)
+    {
+      uint32_t size;
+      uint32_t checksum;
+      std::memcpy(&size, content.data() + offset, sizeof(size));
+      std::memcpy(&checksum, content.data() + offset + sizeof(size), sizeof(checksum));
+      const char* body = content.data() + offset + headerSize;
+      if ((content.size() - offset - headerSize < size) || (crc32(body, size) != checksum))
+      {
+        break;
+      }
+      apply(std::string(body, size));
+      offset += headerSize + size;
+    }
+    return offset;
+  }
+
+  // Passes written data to the disk, so it survives power loss and not only crash of the process
+  void syncFile(std::FILE* file)
+  {
+#ifdef _WIN32
+    int result = ::_commit(::_fileno(file));
+#else
+    int result = ::fsync(::fileno(file));
+#endif
+    if (result != 0)
+    {
+      throw std::runtime_error("Cannot sync file to disk");
+    }
+  }
+
+  // Makes renaming and removing of files in the directory durable
+  void syncDirectory(const std::filesystem::path& directory)
+  {
+#ifndef _WIN32
+    int fd = ::open(directory.string().c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw std::runtime_error("Cannot open directory: " + directory.string());
+    }
+    int result = ::fsync(fd);
+    ::close(fd);
+    if (result != 0)
+    {
+      throw std::runtime_error("Cannot sync directory: " + directory.string());
+    }
+#endif
+  }
+
+  std::string encodeSnapshot(const std::unordered_map< size_t, std::string >& records)
+  {
+    std::string content;
+    put< uint64_t >(content, records.size());
+    for (const auto& record : records)
+    {
+      putString(content, record.second);
+    }
+    put< uint32_t >(content, crc32(content.data(), content.size()));
+    return content;
+  }
+
+  void writeSnapshot(const std::filesystem::path& directory, const std::string& content)
+  {
+    std::filesystem::path tmpPath = directory / "snapshot.tmp";
+    std::FILE* file = std::fopen(tmpPath.string().c_str(), "wb");
+    if (!file)
+    {
+      throw std::runtime_error("Cannot create snapshot: " + tmpPath.string());
+    }
+    bool isWritten = (std::fwrite(SNAPSHOT_MAGIC, 1, SNAPSHOT_MAGIC_SIZE, file) == SNAPSHOT_MAGIC_SIZE)
+      && (std::fwrite(content.data(), 1, content.size(), file) == content.size()) && (std::fflush(file) == 0);
+    try
+    {
+      if (!isWritten)
+      {
+        throw std::runtime_error("Cannot write snapshot: " + tmpPath.string());
+      }
+      syncFile(file);
+    }
+    catch (...)
+    {
+      std::fclose(file);
+      throw;
+    }
+    std::fclose(file);
+    // Snapshot replaces the old one atomically, logs are cleared only after the new name is on disk
+    std::filesystem::rename(tmpPath, directory / SNAPSHOT_NAME);
+    syncDirectory(directory);
+  }
+
+  uint8_t recordType(const std::string& record, size_t& chatId)
+  {
+    RecordReader reader(record.data(), record.size());
+    uint8_t type = reader.get< uint8_t >();
+    chatId = static_cast< size_t >(reader.get< uint64_t >());
+    return type;
+  }
+}
+
+states::PersistentStorage::PersistentStorage(const std::string& directory, size_t maxLogSize, size_t shards):
+  SerializingStorage(shards),
+  directory_(directory),
+  maxLogSize_(maxLogSize),
+  records_(),
+  dirtyChats_(),
+  log_(nullptr),
+  logSize_(0),
+  isCompacting_(false),
+  isStopped_(false),
+  loadFlag_(),
+  mutex_(),
+  compactionMutex_(),
+  compactionCondition_(),
+  compactor_()
+{
+  std::filesystem::create_directories(directory_);
+  compactor_ = std::thread(&states::PersistentStorage::runCompactor, this);
+}
+
+states::PersistentStorage::~PersistentStorage()
+{
+  {
+    std::lock_guard< std::mutex > lock(mutex_);
+    isStopped_ = true;
+  }
+  compactionCondition_.notify_all();
+  compactor_.join();
+  try
+  {
+    ensureLoaded();
+    flush();
+    snapshot();
+  }
+  catch (const std::exception& e)
+  {
+    log(cppbot::LogLevel::ERROR, "Cannot save states", {{"error", e.what()}});
+  }
+  if (log_)
+  {
+    std::fclose(log_);
+  }
+}
+
+states::State states::PersistentStorage::state(size_t chatId) const
+{
+  ensureLoaded();
+  return Storage::state(chatId);
+}
+
+void states::PersistentStorage::setState(size_t chatId, const State& state)
+{
+  ensureLoaded();
+  Storage::setState(chatId, state);
+  markDirty(chatId);
+}
+
+states::StatesForm::Data& states::PersistentStorage::data(size_t chatId)
+{
+  ensureLoaded();
+  StatesForm::Data& chatData = Storage::data(chatId);
+  // Data is changed through the returned reference, so the chat is checked for changes on commit.
+  // It's marked after the access, which can report the chat as expired and forget it
+  markDirty(chatId);
+  return chatData;
+}
+
+states::Value& states::PersistentStorage::value(size_t chatId, const State& state)
+{
+  ensureLoaded();
+  Value& result = Storage::value(chatId, state);
+  markDirty(chatId);
+  return result;
+}
+
+void states::PersistentStorage::remove(size_t chatId)
+{
+  ensureLoaded();
+  Storage::remove(chatId);
+  forget(chatId);
+}
+
+void states::PersistentStorage::commit(size_t chatId)
+{
+  ensureLoaded();
+  {
+    std::lock_guard< std::mutex > lock(mutex_);
+    if (dirtyChats_.erase(chatId) == 0)
+    {
+      return;
+    }
+  }
+  // Chat is encoded without the lock, since reading its data can evict other chats
+  if (save(chatId, encodeRecord(chatId)))
+  {
+    compactionCondition_.notify_one();
+  }
+}
+
+void states::PersistentStorage::flush()
+{
+  ensureLoaded();
+  std::unordered_set< size_t > chats;
+  {
+    std::lock_guard< std::mutex > lock(mutex_);
+    chats.swap(dirtyChats_);
+  }
+  for (size_t chatId : chats)
+  {
+    save(chatId, encodeRecord(chatId));
+  }
+}
+
+void states::PersistentStorage::snapshot()
+{
+  ensureLoaded();
+  std::lock_guard< std::mutex > compactionLock(compactionMutex_);
+  std::lock_guard< std::mutex > lock(mutex_);
+  std::filesystem::path directory(directory_);
+  writeSnapshot(directory, encodeSnapshot(records_));
+  // Old log is removed first: replayed over the new snapshot without the current log, it would revert chats
+  std::filesystem::remove(directory / OLD_LOG_NAME);
+  syncDirectory(directory);
+  isCompacting_ = false;
+  std::string logPath = (directory / LOG_NAME).string();
+  std::FILE* file = std::fopen(logPath.c_str(), "wb");
+  if (!file)
+  {
+    // Current log is kept, its records are already in the snapshot and are replayed harmlessly
+    throw std::runtime_error("Cannot clear states log: " + logPath);
+  }
+  std::fclose(log_);
+  log_ = file;
+  logSize_ = 0;
+}
+
+void states::PersistentStorage::evicted(size_t chatId)
+{
+  Storage::evicted(chatId);
+  forget(chatId);
+}
+
+void states::PersistentStorage::ensureLoaded() const
+{
+  std::call_once(loadFlag_, [this]()
+  {
+    const_cast< PersistentStorage* >(this)->load();
+  });
+}
+
+void states::PersistentStorage::load()
+{
+  // Other threads wait for the end of loading in ensureLoaded(), evicted() takes the mutex while loading
+  loadSnapshot();
+  replayLog(OLD_LOG_NAME, false);
+  replayLog(LOG_NAME, true);
+  std::filesystem::path directory(directory_);
+  std::string logPath = (directory / LOG_NAME).string();
+  log_ = std::fopen(logPath.c_str(), "ab");
+  if (!log_)
+  {
+    throw std::runtime_error("Cannot open states log: " + logPath);
+  }
+  std::error_code ec;
+  if (std::filesystem::exists(directory / OLD_LOG_NAME, ec))
+  {
+    // Previous process stopped before merging the old log
+    {
+      std::lock_guard< std::mutex > lock(mutex_);
+      isCompacting_ = true;
+    }
+    compactionCondition_.notify_one();
+  }
+}
+
+void states::PersistentStorage::loadSnapshot()
+{
+  std::filesystem::path path = std::filesystem::path(directory_) / SNAPSHOT_NAME;
+  bool isValid = readSnapshot(path, [this](const std::string& record)
+  {
+    applyRecord(record);
+  });
+  if (!isValid)
+  {
+    log(cppbot::LogLevel::ERROR, "States snapshot is damaged and ignored", {{"path", path.string()}});
+  }
+}
+
+void states::PersistentStorage::replayLog(const std::string& name, bool isCurrent)
+{
+  std::filesystem::path path = std::filesystem::path(directory_) / name;
+  std::error_code ec;
+  if (!std::filesystem::exists(path, ec))
+  {
+    return;
+  }
+  std::string content = readFile(path);
+  size_t offset = readLog(content, [this](const std::string& record)
+  {
+    applyRecord(record);
+  });
+  if (isCurrent)
+  {
+    logSize_ = offset;
+  }
+  if (offset == content.size())
+  {
+    return;
+  }
+  log(cppbot::LogLevel::ERROR, "States log is damaged, its tail is discarded",
+    {{"path", path.string()}, {"bytes", std::to_string(content.size() - offset)}});
+  if (isCurrent)
+  {
+    // Record written during a crash is incomplete, next records are appended after the last good one
+    std::filesystem::resize_file(path, offset);
+  }
+}
+
+void states::PersistentStorage::rotateLog()
+{
+  // Called with the lock held, only two renames and opening of a file are done here
+  std::filesystem::path directory(directory_);
+  std::error_code ec;
+  std::filesystem::rename(directory / LOG_NAME, directory / OLD_LOG_NAME, ec);
+  if (ec)
+  {
+    log(cppbot::LogLevel::ERROR, "Cannot rotate states log", {{"error", ec.message()}});
+    return;
+  }
+  std::string logPath = (directory / LOG_NAME).string();
+  std::FILE* file = std::fopen(logPath.c_str(), "ab");
+  if (!file)
+  {
+    // Records keep going to the same file, so it gets its name back
+    std::filesystem::rename(directory / OLD_LOG_NAME, directory / LOG_NAME, ec);
+    log(cppbot::LogLevel::ERROR, "Cannot open states log", {{"path", logPath}});
+    return;
+  }
+  std::fclose(log_);
+  log_ = file;
+  logSize_ = 0;
+  isCompacting_ = true;
+}
+
+void states::PersistentStorage::compact()
+{
+  std::lock_guard< std::mutex > compactionLock(compactionMutex_);
+  {
+    std::lock_guard< std::mutex > lock(mutex_);
+    if (!isCompacting_)
+    {
+      // snapshot() has already written everything
+      return;
+    }
+  }
+  // Only files are read here, chats in memory are neither locked nor copied
+  std::filesystem::path directory(directory_);
+  std::unordered_map< size_t, std::string > records;
+  auto apply = [&records](const std::string& record)
+  {
+    size_t chatId = 0;
+    if (recordType(record, chatId) == REMOVE_RECORD)
+    {
+      records.erase(chatId);
+    }
+    else
+    {
+      records[chatId] = record;
+    }
+  };
+  readSnapshot(directory / SNAPSHOT_NAME, apply);
+  readLog(readFile(directory / OLD_LOG_NAME), apply);
+  writeSnapshot(directory, encodeSnapshot(records));
+  std::filesystem::remove(directory / OLD_LOG_NAME);
+  std::lock_guard< std::mutex > lock(mutex_);
+  isCompacting_ = false;
+}
+
+void states::PersistentStorage::runCompactor()
+{
+  std::unique_lock< std::mutex > lock(mutex_);
+  while (true)
+  {
+    compactionCondition_.wait(lock, [this]()
+    {
+      return isStopped_ || isCompacting_;
+    });
+    if (isStopped_)
+    {
+      return;
+    }
+    lock.unlock();
+    bool isFailed = false;
+    try
+    {
+      compact();
+    }
+    catch (const std::exception& e)
+    {
+      log(cppbot::LogLevel::ERROR, "Cannot compact states log", {{"error", e.what()}});
+      isFailed = true;
+    }
+    lock.lock();
+    if (isFailed)
+    {
+      // Old log is kept until the next try, new records go to the current log meanwhile
+      compactionCondition_.wait_for(lock, std::chrono::minutes(1), [this]()
+      {
+        return isStopped_;
+      });
+    }
+  }
+}
+
+void states::PersistentStorage::applyRecord(const std::string& record)
+{
+  RecordReader reader(record.data(), record.size());
+  uint8_t type = reader.get< uint8_t >();
+  size_t chatId = static_cast< size_t >(reader.get< uint64_t >());
+  if (type == REMOVE_RECORD)
+  {
+    Storage::remove(chatId);
+    records_.erase(chatId);
+    return;
+  }
+  decodeChat(chatId, reader);
+  records_[chatId] = record;
+}
+
+void states::PersistentStorage::forget(size_t chatId)
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  dirtyChats_.erase(chatId);
+  // Chats evicted while loading are not written, they are absent in the next snapshot anyway
+  if ((records_.erase(chatId) != 0) && log_)
+  {
+    std::string body;
+    put< uint8_t >(body, REMOVE_RECORD);
+    put< uint64_t >(body, chatId);
+    appendToLog(body);
+  }
+}
+
+void states::PersistentStorage::markDirty(size_t chatId)
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  dirtyChats_.insert(chatId);
+}
+
+std::string states::PersistentStorage::encodeRecord(size_t chatId)
+{
+  std::string body;
+  put< uint8_t >(body, CHAT_RECORD);
+  put< uint64_t >(body, chatId);
+  return body + encodeChat(chatId);
+}
+
+bool states::PersistentStorage::save(size_t chatId, std::string body)
+{
+  std::lock_guard< std::mutex > lock(mutex_);
+  std::string& record = records_[chatId];
+  if (record == body)
+  {
+    return false;
+  }
+  appendToLog(body);
+  record = std::move(body);
+  if ((logSize_ <= maxLogSize_) || isCompacting_)
+  {
+    return false;
+  }
+  rotateLog();
+  return isCompacting_;
+}
+
+void states::PersistentStorage::appendToLog(const std::string& body)
+{
+  std::string entry;
+  put< uint32_t >(entry, static_cast< uint32_t >(body.size()));
+  put< uint32_t >(entry, crc32(body.data(), body.size()));
+  entry += body;
+  // Flushing passes the record to OS, so it survives crash of the process
+  if (!log_ || (std::fwrite(entry.data(), 1, entry.size(), log_) != entry.size()) || (std::fflush(log_) != 0))
+  {
+    throw std::runtime_error("Cannot write states log in " + directory_);
+  }
+  logSize_ += entry.size();
+}
@@ -0,0 +1,368 @@
+#include "cppbot/remote_storage.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+namespace asio = boost::asio;
+
+std::string states::detail::makeFrame(RemoteOperation operation, size_t chatId, const std::string& payload)
+{
+  if (payload.size() > MAX_PAYLOAD_SIZE)
+  {
+    throw std::length_error("Chat is too big for state server: " + std::to_string(payload.size()) + " bytes");
+  }
+  std::string frame;
+  frame.reserve(FRAME_HEADER_SIZE + payload.size());
+  put< uint32_t >(frame, static_cast< uint32_t >(FRAME_HEADER_SIZE - sizeof(uint32_t) + payload.size()));
+  put< uint8_t >(frame, operation);
+  put< uint64_t >(frame, chatId);
+  frame += payload;
+  return frame;
+}
+
+asio::generic::stream_protocol::endpoint states::detail::makeEndpoint(asio::io_context& ioContext,
+  const std::string& address)
+{
+  const std::string tcpScheme = "tcp://";
+  const std::string unixScheme = "unix://";
+  if (address.compare(0, tcpScheme.size(), tcpScheme) == 0)
+  {
+    std::string hostPort = address.substr(tcpScheme.size());
+    size_t colon = hostPort.rfind(':');
+    if (colon == std::string::npos)
+    {
+      throw std::invalid_argument("Port of state server is not set: " + address);
+    }
+    asio::ip::tcp::resolver resolver(ioContext);
+    auto results = resolver.resolve(hostPort.substr(0, colon), hostPort.substr(colon + 1));
+    return asio::generic::stream_protocol::endpoint(results.begin()->endpoint());
+  }
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  if (address.compare(0, unixScheme.size(), unixScheme) == 0)
+  {
+    return asio::generic::stream_protocol::endpoint(asio::local::stream_protocol::endpoint(
+      address.substr(unixScheme.size())));
+  }
+#endif
+  throw std::invalid_argument("Unknown address of state server: " + address);
+}
+
+states::RemoteStorage::Connection::Connection(asio::io_context& ioContext):
+  socket(ioContext),
+  cached(),
+  dirtyChats(),
+  sent(),
+  staleChats(),
+  mutex()
+{}
+
+states::RemoteStorage::RemoteStorage(const std::string& address, size_t shards, size_t connections):
+  SerializingStorage(shards),
+  address_(address),
+  ioContext_(),
+  connections_()
+{
+  connections = std::max< size_t >(std::min(connections, shards), 1);
+  for (size_t i = 0; i < connections; ++i)
+  {
+    connections_.push_back(std::make_unique< Connection >(ioContext_));
+  }
+}
+
+states::State states::RemoteStorage::state(size_t chatId) const
+{
+  auto self = const_cast< RemoteStorage* >(this);
+  self->refresh(chatId);
+  self->fetch(self->connectionOf(chatId), {chatId});
+  return Storage::state(chatId);
+}
+
+void states::RemoteStorage::setState(size_t chatId, const State& state)
+{
+  Connection& connection = connectionOf(chatId);
+  // Invalidation received between fetching and marking would drop the chat, and the next access would
+  // read it again over the change
+  std::lock_guard< std::recursive_mutex > lock(connection.mutex);
+  refresh(chatId);
+  fetch(connection, {chatId});
+  Storage::setState(chatId, state);
+  markDirty(chatId);
+}
+
+states::StatesForm::Data& states::RemoteStorage::data(size_t chatId)
+{
+  Connection& connection = connectionOf(chatId);
+  std::lock_guard< std::recursive_mutex > lock(connection.mutex);
+  refresh(chatId);
+  fetch(connection, {chatId});
+  // Data is changed through the returned reference, so the chat is checked for changes on commit
+  markDirty(chatId);
+  return Storage::data(chatId);
+}
+
+states::Value& states::RemoteStorage::value(size_t chatId, const State& state)
+{
+  Connection& connection = connectionOf(chatId);
+  std::lock_guard< std::recursive_mutex > lock(connection.mutex);
+  refresh(chatId);
+  fetch(connection, {chatId});
+  markDirty(chatId);
+  return Storage::value(chatId, state);
+}
+
+void states::RemoteStorage::remove(size_t chatId)
+{
+  Connection& connection = connectionOf(chatId);
+  std::lock_guard< std::recursive_mutex > lock(connection.mutex);
+  Storage::remove(chatId);
+  connection.dirtyChats.erase(chatId);
+  connection.sent.erase(chatId);
+  connection.staleChats.erase(chatId);
+  send(connection, detail::makeFrame(detail::REMOVE, chatId));
+  connection.cached.insert(chatId);
+}
+
+void states::RemoteStorage::commit(size_t chatId)
+{
+  Connection& connection = connectionOf(chatId);
+  std::lock_guard< std::recursive_mutex > lock(connection.mutex);
+  if (connection.dirtyChats.erase(chatId) == 0)
+  {
+    return;
+  }
+  std::string body = encodeChat(chatId);
+  bool isStale = connection.staleChats.erase(chatId) != 0;
+  auto it = connection.sent.find(chatId);
+  if ((it != connection.sent.end()) && (it->second == body))
+  {
+    if (isStale)
+    {
+      // Handler changed nothing, so the change of other process is read on the next access
+      connection.cached.erase(chatId);
+      connection.sent.erase(it);
+    }
+    return;
+  }
+  // The answer is not awaited, next requests are pipelined after this one
+  send(connection, detail::makeFrame(detail::PUT, chatId, body));
+  connection.sent[chatId] = std::move(body);
+}
+
+void states::RemoteStorage::prefetch(const std::vector< size_t >& chatIds)
+{
+  std::vector< std::vector< size_t > > groups(connections_.size());
+  for (size_t chatId : chatIds)
+  {
+    groups[shardIndex(chatId) % connections_.size()].push_back(chatId);
+  }
+  for (size_t i = 0; i < groups.size(); ++i)
+  {
+    if (!groups[i].empty())
+    {
+      fetch(*connections_[i], groups[i]);
+    }
+  }
+}
+
+void states::RemoteStorage::evicted(size_t chatId)
+{
+  {
+    Connection& connection = connectionOf(chatId);
+    std::lock_guard< std::recursive_mutex > lock(connection.mutex);
+    connection.cached.erase(chatId);
+    connection.dirtyChats.erase(chatId);
+    connection.sent.erase(chatId);
+    connection.staleChats.erase(chatId);
+  }
+  Storage::evicted(chatId);
+}
+
+states::RemoteStorage::Connection& states::RemoteStorage::connectionOf(size_t chatId)
+{
+  // Chats evicted while decoding belong to the shard of decoded chat, so they have the same connection
+  return *connections_[shardIndex(chatId) % connections_.size()];
+}
+
+void states::RemoteStorage::fetch(Connection& connection, const std::vector< size_t >& chatIds)
+{
+  std::lock_guard< std::recursive_mutex > lock(connection.mutex);
+  if (!connection.socket.is_open())
+  {
+    connect(connection);
+  }
+  receiveInvalidations(connection);
+  std::unordered_set< size_t > requested;
+  std::string frames;
+  for (size_t chatId : chatIds)
+  {
+    if ((connection.cached.count(chatId) == 0) && requested.insert(chatId).second)
+    {
+      frames += detail::makeFrame(detail::GET, chatId);
+    }
+  }
+  if (requested.empty())
+  {
+    return;
+  }
+  send(connection, frames);
+  std::string payload;
+  try
+  {
+    while (!requested.empty())
+    {
+      std::pair< detail::RemoteOperation, size_t > frame = receive(connection, payload);
+      size_t chatId = frame.second;
+      if (frame.first == detail::INVALIDATE)
+      {
+        // Chat changed before the request was handled by the server comes with the new value
+        if (requested.count(chatId) == 0)
+        {
+          invalidate(connection, chatId);
+        }
+        continue;
+      }
+      if (frame.first == detail::VALUE)
+      {
+        detail::RecordReader reader(payload.data(), payload.size());
+        decodeChat(chatId, reader);
+        connection.sent[chatId] = payload;
+      }
+      else
+      {
+        reset(chatId);
+        connection.sent.erase(chatId);
+      }
+      requested.erase(chatId);
+      connection.cached.insert(chatId);
+    }
+  }
+  catch (const std::out_of_range& e)
+  {
+    disconnect(connection);
+    throw std::runtime_error(std::string("Bad answer of state server: ") + e.what());
+  }
+}
+
+void states::RemoteStorage::connect(Connection& connection)
+{
+  try
+  {
+    connection.socket.connect(detail::makeEndpoint(ioContext_, address_));
+  }
+  catch (const boost::system::system_error& e)
+  {
+    disconnect(connection);
+    throw std::runtime_error("Cannot connect to state server " + address_ + ": " + e.what());
+  }
+  boost::system::error_code ec;
+  connection.socket.set_option(asio::ip::tcp::no_delay(true), ec); // fails for unix sockets, it's fine
+  // Invalidations could be missed while there was no connection
+  dropCache(connection);
+}
+
+void states::RemoteStorage::disconnect(Connection& connection)
+{
+  boost::system::error_code ec;
+  connection.socket.close(ec);
+  dropCache(connection);
+}
+
+void states::RemoteStorage::send(Connection& connection, const std::string& frames)
+{
+  if (!connection.socket.is_open())
+  {
+    connect(connection);
+  }
+  try
+  {
+    asio::write(connection.socket, asio::buffer(frames));
+  }
+  catch (const boost::system::system_error& e)
+  {
+    disconnect(connection);
+    throw std::runtime_error(std::string("Cannot send to state server: ") + e.what());
+  }
+}
+
+void states::RemoteStorage::receiveInvalidations(Connection& connection)
+{
+  boost::system::error_code ec;
+  std::string payload;
+  while (connection.socket.available(ec) > 0)
+  {
+    invalidate(connection, receive(connection, payload).second);
+  }
+  if (ec)
+  {
+    disconnect(connection);
+    connect(connection);
+  }
+}
+
+std::pair< states::detail::RemoteOperation, size_t > states::RemoteStorage::receive(Connection& connection,
+  std::string& payload)
+{
+  char header[detail::FRAME_HEADER_SIZE];
+  try
+  {
+    asio::read(connection.socket, asio::buffer(header));
+    detail::RecordReader reader(header, sizeof(header));
+    uint32_t size = reader.get< uint32_t >();
+    auto operation = static_cast< detail::RemoteOperation >(reader.get< uint8_t >());
+    size_t chatId = static_cast< size_t >(reader.get< uint64_t >());
+    if (size < detail::FRAME_HEADER_SIZE - sizeof(uint32_t))
+    {
+      throw std::out_of_range("Frame is too short");
+    }
+    size_t payloadSize = size - (detail::FRAME_HEADER_SIZE - sizeof(uint32_t));
+    if (payloadSize > detail::MAX_PAYLOAD_SIZE)
+    {
+      throw std::out_of_range("Frame is too long");
+    }
+    payload.resize(payloadSize);
+    asio::read(connection.socket, asio::buffer(payload));
+    return {operation, chatId};
+  }
+  catch (const std::exception& e)
+  {
+    disconnect(connection);
+    throw std::runtime_error(std::string("Cannot receive from state server: ") + e.what());
+  }
+}
+
+void states::RemoteStorage::invalidate(Connection& connection, size_t chatId)
+{
+  if (connection.dirtyChats.count(chatId) != 0)
+  {
+    // Reading the chat again would replace data the handler works with, it's decided on commit
+    connection.staleChats.insert(chatId);
+    return;
+  }
+  connection.cached.erase(chatId);
+  connection.sent.erase(chatId);
+}
+
+void states::RemoteStorage::dropCache(Connection& connection)
+{
+  for (auto it = connection.cached.begin(); it != connection.cached.end();)
+  {
+    if (connection.dirtyChats.count(*it) != 0)
+    {
+      connection.staleChats.insert(*it);
+      ++it;
+      continue;
+    }
+    connection.sent.erase(*it);
+    it = connection.cached.erase(it);
+  }
+}
+
+void states::RemoteStorage::markDirty(size_t chatId)
+{
+  Connection& connection = connectionOf(chatId);
+  std::lock_guard< std::recursive_mutex > lock(connection.mutex);
+  connection.dirtyChats.insert(chatId);
+}
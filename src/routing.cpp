@@ -0,0 +1,155 @@
+#include "cppbot/routing.hpp"
+#include <cctype>
+
+namespace
+{
+  bool isSpace(char c)
+  {
+    return (c == ' ') || (c == '\n') || (c == '\t') || (c == '\r');
+  }
+
+  std::string_view trim(std::string_view text)
+  {
+    while (!text.empty() && isSpace(text.front()))
+    {
+      text.remove_prefix(1);
+    }
+    while (!text.empty() && isSpace(text.back()))
+    {
+      text.remove_suffix(1);
+    }
+    return text;
+  }
+
+  // Cuts next word from the text
+  std::string_view nextWord(std::string_view& text)
+  {
+    size_t end = 0;
+    while ((end < text.size()) && !isSpace(text[end]))
+    {
+      ++end;
+    }
+    std::string_view word = text.substr(0, end);
+    text = trim(text.substr(end));
+    return word;
+  }
+
+  bool isEqualIgnoreCase(std::string_view lhs, std::string_view rhs)
+  {
+    if (lhs.size() != rhs.size())
+    {
+      return false;
+    }
+    for (size_t i = 0; i < lhs.size(); ++i)
+    {
+      if (std::tolower(static_cast< unsigned char >(lhs[i])) != std::tolower(static_cast< unsigned char >(rhs[i])))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+handlers::CommandArgs::Iterator::Iterator(std::string_view rest):
+  current_(),
+  rest_(trim(rest))
+{
+  ++(*this);
+}
+
+handlers::CommandArgs::Iterator::reference handlers::CommandArgs::Iterator::operator*() const
+{
+  return current_;
+}
+
+handlers::CommandArgs::Iterator::pointer handlers::CommandArgs::Iterator::operator->() const
+{
+  return &current_;
+}
+
+handlers::CommandArgs::Iterator& handlers::CommandArgs::Iterator::operator++()
+{
+  current_ = nextWord(rest_);
+  return *this;
+}
+
+handlers::CommandArgs::Iterator handlers::CommandArgs::Iterator::operator++(int)
+{
+  Iterator old = *this;
+  ++(*this);
+  return old;
+}
+
+bool handlers::CommandArgs::Iterator::operator==(const Iterator& other) const
+{
+  return (current_.data() == other.current_.data()) && (current_.size() == other.current_.size());
+}
+
+bool handlers::CommandArgs::Iterator::operator!=(const Iterator& other) const
+{
+  return !(*this == other);
+}
+
+handlers::CommandArgs::CommandArgs(std::string_view text):
+  text_(trim(text))
+{}
+
+std::string_view handlers::CommandArgs::text() const
+{
+  return text_;
+}
+
+bool handlers::CommandArgs::empty() const
+{
+  return text_.empty();
+}
+
+size_t handlers::CommandArgs::size() const
+{
+  size_t count = 0;
+  for (auto it = begin(); it != end(); ++it)
+  {
+    ++count;
+  }
+  return count;
+}
+
+std::string_view handlers::CommandArgs::operator[](size_t i) const
+{
+  auto it = begin();
+  for (; (it != end()) && (i > 0); --i)
+  {
+    ++it;
+  }
+  return (it != end()) ? *it : std::string_view();
+}
+
+handlers::CommandArgs::Iterator handlers::CommandArgs::begin() const
+{
+  return Iterator(text_);
+}
+
+handlers::CommandArgs::Iterator handlers::CommandArgs::end() const
+{
+  return Iterator(text_.substr(text_.size()));
+}
+
+bool handlers::detail::splitCommand(std::string_view text, std::string_view botUsername, std::string_view& cmd,
+  std::string_view& args)
+{
+  cmd = nextWord(text);
+  args = text;
+  if (cmd.empty() || (cmd.front() != '/'))
+  {
+    return true;
+  }
+  size_t at = cmd.find('@');
+  if (at == std::string_view::npos)
+  {
+    return true;
+  }
+  std::string_view mention = cmd.substr(at + 1);
+  cmd = cmd.substr(0, at);
+  return botUsername.empty() || isEqualIgnoreCase(mention, botUsername);
+}
@@ -0,0 +1,170 @@
+#include "cppbot/serializing_storage.hpp"
+#include <type_traits>
+
+namespace
+{
+  template< class T >
+  void registerNumber(states::SerializingStorage& storage, const std::string& name)
+  {
+    storage.registerType< T >(name, [](const T& value)
+    {
+      return std::to_string(value);
+    }, [](const std::string& bytes)
+    {
+      if constexpr (std::is_floating_point_v< T >)
+      {
+        return static_cast< T >(std::stod(bytes));
+      }
+      else if constexpr (std::is_signed_v< T >)
+      {
+        return static_cast< T >(std::stoll(bytes));
+      }
+      else
+      {
+        return static_cast< T >(std::stoull(bytes));
+      }
+    });
+  }
+}
+
+states::SerializingStorage::SerializingStorage(size_t shards):
+  Storage(shards),
+  encoders_(),
+  decoders_(),
+  unknownTypes_(),
+  codecMutex_(),
+  logger_()
+{
+  registerType< std::string >("string", [](const std::string& value)
+  {
+    return value;
+  }, [](const std::string& bytes)
+  {
+    return bytes;
+  });
+  registerType< bool >("bool", [](const bool& value)
+  {
+    return std::string(value ? "1" : "0");
+  }, [](const std::string& bytes)
+  {
+    return bytes == "1";
+  });
+  registerNumber< int >(*this, "int");
+  registerNumber< long >(*this, "long");
+  registerNumber< long long >(*this, "long long");
+  registerNumber< unsigned >(*this, "unsigned");
+  registerNumber< unsigned long >(*this, "unsigned long");
+  registerNumber< unsigned long long >(*this, "unsigned long long");
+  registerNumber< double >(*this, "double");
+}
+
+std::string states::SerializingStorage::encodeChat(size_t chatId)
+{
+  using detail::put;
+  using detail::putString;
+  std::string body;
+  put< uint64_t >(body, Storage::state(chatId).id());
+  const StatesForm::Data& data = Storage::data(chatId);
+  size_t countOffset = body.size();
+  uint32_t count = 0;
+  put< uint32_t >(body, count);
+  for (const auto& value : data)
+  {
+    auto codec = encoders_.find(std::type_index(value.second.type()));
+    if (codec == encoders_.end())
+    {
+      warnUnknownType(value.second.type().name());
+      continue;
+    }
+    put< uint64_t >(body, value.first.id());
+    putString(body, codec->second.name);
+    putString(body, codec->second.encode(value.second));
+    ++count;
+  }
+  std::memcpy(&body[countOffset], &count, sizeof(count));
+
+  countOffset = body.size();
+  count = 0;
+  put< uint32_t >(body, count);
+  forEachValue(chatId, [this, &body, &count](size_t stateId, const Value& value)
+  {
+    auto codec = encoders_.find(std::type_index(value.type()));
+    if (codec == encoders_.end())
+    {
+      warnUnknownType(value.type().name());
+      return;
+    }
+    put< uint64_t >(body, stateId);
+    putString(body, codec->second.name);
+    putString(body, codec->second.encodeValue(value));
+    ++count;
+  });
+  std::memcpy(&body[countOffset], &count, sizeof(count));
+  return body;
+}
+
+void states::SerializingStorage::decodeChat(size_t chatId, detail::RecordReader& reader)
+{
+  reset(chatId);
+  Storage::setState(chatId, State::fromId(static_cast< size_t >(reader.get< uint64_t >())));
+  StatesForm::Data& data = Storage::data(chatId);
+  uint32_t count = reader.get< uint32_t >();
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    State key = State::fromId(static_cast< size_t >(reader.get< uint64_t >()));
+    std::string typeName = reader.getString();
+    std::string bytes = reader.getString();
+    auto decoder = decoders_.find(typeName);
+    if (decoder != decoders_.end())
+    {
+      data[key] = decoder->second.decode(bytes);
+    }
+    else
+    {
+      warnUnknownType(typeName);
+    }
+  }
+  count = reader.get< uint32_t >();
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    State key = State::fromId(static_cast< size_t >(reader.get< uint64_t >()));
+    std::string typeName = reader.getString();
+    std::string bytes = reader.getString();
+    auto decoder = decoders_.find(typeName);
+    if (decoder != decoders_.end())
+    {
+      Storage::value(chatId, key) = decoder->second.decodeValue(bytes);
+    }
+    else
+    {
+      warnUnknownType(typeName);
+    }
+  }
+}
+
+void states::SerializingStorage::setLogger(std::shared_ptr< cppbot::AsyncLogger > logger)
+{
+  logger_ = logger;
+}
+
+void states::SerializingStorage::log(cppbot::LogLevel level, const std::string& message,
+  cppbot::LogFields fields) const
+{
+  cppbot::log(logger_, level, message, std::move(fields));
+}
+
+void states::SerializingStorage::registerCodec(std::type_index type, const Codec& codec, const Decoder& decoder)
+{
+  std::lock_guard< std::mutex > lock(codecMutex_);
+  encoders_[type] = codec;
+  decoders_[codec.name] = decoder;
+}
+
+void states::SerializingStorage::warnUnknownType(const std::string& name)
+{
+  std::lock_guard< std::mutex > lock(codecMutex_);
+  if (unknownTypes_.insert(name).second)
+  {
+    log(cppbot::LogLevel::WARNING, "No codec for values of type, they are not saved", {{"type", name}});
+  }
+}
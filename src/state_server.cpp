@@ -0,0 +1,211 @@
+#include "cppbot/state_server.hpp"
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include "cppbot/remote_storage.hpp"
+
+namespace asio = boost::asio;
+
+class states::StateServer::Connection: public std::enable_shared_from_this< Connection >
+{
+ public:
+  Connection(StateServer* server, asio::generic::stream_protocol::socket socket):
+    server_(server),
+    socket_(std::move(socket)),
+    header_(),
+    payload_(),
+    outbox_()
+  {}
+
+  void read()
+  {
+    auto self = shared_from_this();
+    asio::async_read(socket_, asio::buffer(header_), [this, self](const boost::system::error_code& ec, size_t)
+    {
+      if (ec)
+      {
+        close();
+        return;
+      }
+      detail::RecordReader reader(header_, sizeof(header_));
+      uint32_t size = reader.get< uint32_t >();
+      size_t headerRest = detail::FRAME_HEADER_SIZE - sizeof(uint32_t);
+      if ((size < headerRest) || (size - headerRest > detail::MAX_PAYLOAD_SIZE))
+      {
+        // Broken or hostile peer, its frame isn't allocated
+        close();
+        return;
+      }
+      payload_.resize(size - headerRest);
+      asio::async_read(socket_, asio::buffer(payload_), [this, self](const boost::system::error_code& ec, size_t)
+      {
+        if (ec)
+        {
+          close();
+          return;
+        }
+        detail::RecordReader reader(header_ + sizeof(uint32_t), sizeof(header_) - sizeof(uint32_t));
+        uint8_t operation = reader.get< uint8_t >();
+        size_t chatId = static_cast< size_t >(reader.get< uint64_t >());
+        server_->handle(self, operation, chatId, payload_);
+        read();
+      });
+    });
+  }
+
+  void write(std::string frame)
+  {
+    outbox_.push_back(std::move(frame));
+    if (outbox_.size() == 1)
+    {
+      writeNext();
+    }
+  }
+
+  void close()
+  {
+    if (socket_.is_open())
+    {
+      boost::system::error_code ec;
+      socket_.close(ec);
+      server_->connections_.erase(shared_from_this());
+    }
+  }
+ private:
+  StateServer* server_;
+  asio::generic::stream_protocol::socket socket_;
+  char header_[detail::FRAME_HEADER_SIZE];
+  std::string payload_;
+  std::deque< std::string > outbox_;
+
+  void writeNext()
+  {
+    // Frames queued while writing are sent with one call
+    while (outbox_.size() > 1)
+    {
+      std::string& last = outbox_[outbox_.size() - 2];
+      last += outbox_.back();
+      outbox_.pop_back();
+    }
+    auto self = shared_from_this();
+    asio::async_write(socket_, asio::buffer(outbox_.front()), [this, self](const boost::system::error_code& ec, size_t)
+    {
+      outbox_.pop_front();
+      if (ec)
+      {
+        close();
+        return;
+      }
+      if (!outbox_.empty())
+      {
+        writeNext();
+      }
+    });
+  }
+};
+
+states::StateServer::StateServer(asio::io_context& ioContext, const std::string& address):
+  acceptor_(ioContext),
+  chats_(),
+  connections_(),
+  logger_()
+{
+  asio::generic::stream_protocol::endpoint endpoint = detail::makeEndpoint(ioContext, address);
+  const std::string unixScheme = "unix://";
+  if (address.compare(0, unixScheme.size(), unixScheme) == 0)
+  {
+    // Socket file left by previous run prevents binding
+    std::remove(address.substr(unixScheme.size()).c_str());
+  }
+  acceptor_.open(endpoint.protocol());
+  boost::system::error_code ec;
+  acceptor_.set_option(asio::socket_base::reuse_address(true), ec);
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+  accept();
+}
+
+states::StateServer::~StateServer()
+{
+  boost::system::error_code ec;
+  acceptor_.close(ec);
+  auto connections = connections_;
+  for (const auto& connection : connections)
+  {
+    connection->close();
+  }
+}
+
+size_t states::StateServer::size() const
+{
+  return chats_.size();
+}
+
+void states::StateServer::setLogger(std::shared_ptr< cppbot::AsyncLogger > logger)
+{
+  logger_ = logger;
+}
+
+void states::StateServer::accept()
+{
+  acceptor_.async_accept([this](const boost::system::error_code& ec, asio::generic::stream_protocol::socket socket)
+  {
+    if (ec == asio::error::operation_aborted)
+    {
+      return;
+    }
+    if (!ec)
+    {
+      auto connection = std::make_shared< Connection >(this, std::move(socket));
+      connections_.insert(connection);
+      connection->read();
+    }
+    else
+    {
+      cppbot::log(logger_, cppbot::LogLevel::ERROR, "State server cannot accept connection",
+        {{"error", ec.message()}});
+    }
+    accept();
+  });
+}
+
+void states::StateServer::handle(const std::shared_ptr< Connection >& connection, uint8_t operation, size_t chatId,
+  std::string& payload)
+{
+  if (operation == detail::GET)
+  {
+    auto it = chats_.find(chatId);
+    if (it != chats_.end())
+    {
+      connection->write(detail::makeFrame(detail::VALUE, chatId, it->second));
+    }
+    else
+    {
+      connection->write(detail::makeFrame(detail::NOT_FOUND, chatId));
+    }
+    return;
+  }
+  if (operation == detail::PUT)
+  {
+    chats_[chatId].swap(payload);
+  }
+  else if (operation == detail::REMOVE)
+  {
+    chats_.erase(chatId);
+  }
+  else
+  {
+    connection->close();
+    return;
+  }
+  std::string invalidation = detail::makeFrame(detail::INVALIDATE, chatId);
+  for (const auto& other : connections_)
+  {
+    if (other != connection)
+    {
+      other->write(invalidation);
+    }
+  }
+}
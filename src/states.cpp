@@ -1,10 +1,21 @@
 #include "cppbot/states.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
 
 states::State::State():
   id_(lastId_++)
 {}
 size_t states::State::lastId_ = 0;
 
+states::State::State(size_t id, IdTag):
+  id_(id)
+{}
+
 bool states::State::operator==(const states::State& other) const
 {
   return this->id_ == other.id_;
@@ -15,47 +26,600 @@ bool states::State::operator!=(const states::State& other) const
   return !(this->id_ == other.id_);
 }
 
+size_t states::State::id() const
+{
+  return id_;
+}
+
+states::State states::State::fromId(size_t id)
+{
+  return State(id, IdTag{});
+}
+
+size_t states::State::count()
+{
+  return lastId_;
+}
+
 states::StateMachine::StateMachine(std::shared_ptr< Storage > storage):
   storage_(storage)
 {}
 
 states::State states::StateMachine::getState(size_t chatId) const
 {
-  try
+  return storage_->state(chatId);
+}
+
+void states::StateMachine::setState(size_t chatId, const State& state) const
+{
+  storage_->setState(chatId, state);
+}
+
+void states::StateMachine::commit(size_t chatId) const
+{
+  storage_->commit(chatId);
+}
+
+const states::State states::StateMachine::DEFAULT_STATE = {};
+
+namespace
+{
+  states::Storage::duration_t::rep now()
   {
-    return storage_->currentStates_.at(chatId);
+#ifdef CLOCK_MONOTONIC_COARSE
+    // Every access reads the time, expiration doesn't need better precision than the coarse clock has
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+    auto sinceBoot = std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+    return std::chrono::duration_cast< states::Storage::duration_t >(sinceBoot).count();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
   }
-  catch(const std::out_of_range&)
+
+  size_t mix(size_t key)
   {
-    return states::StateMachine::DEFAULT_STATE;
+    uint64_t x = static_cast< uint64_t >(key);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast< size_t >(x ^ (x >> 31));
+  }
+
+  // Hash table with linear probing, keys are kept in one array so lookup touches a single node
+  template< class T >
+  class FlatTable
+  {
+   public:
+    T* find(size_t key) const
+    {
+      if (slots_.empty())
+      {
+        return nullptr;
+      }
+      size_t mask = slots_.size() - 1;
+      for (size_t i = mix(key) & mask; slots_[i].value; i = (i + 1) & mask)
+      {
+        if (slots_[i].key == key)
+        {
+          return slots_[i].value.get();
+        }
+      }
+      return nullptr;
+    }
+
+    std::pair< T*, bool > insert(size_t key)
+    {
+      if ((size_ + 1) * 4 > slots_.size() * 3)
+      {
+        grow();
+      }
+      size_t mask = slots_.size() - 1;
+      size_t i = mix(key) & mask;
+      for (; slots_[i].value; i = (i + 1) & mask)
+      {
+        if (slots_[i].key == key)
+        {
+          return {slots_[i].value.get(), false};
+        }
+      }
+      slots_[i].key = key;
+      slots_[i].value = std::make_unique< T >(key);
+      ++size_;
+      return {slots_[i].value.get(), true};
+    }
+
+    void erase(size_t key)
+    {
+      if (slots_.empty())
+      {
+        return;
+      }
+      size_t mask = slots_.size() - 1;
+      size_t i = mix(key) & mask;
+      for (; slots_[i].value && (slots_[i].key != key); i = (i + 1) & mask)
+      {}
+      if (!slots_[i].value)
+      {
+        return;
+      }
+      slots_[i].value.reset();
+      --size_;
+      // Next entries of the probe sequence are shifted back instead of leaving a tombstone
+      for (size_t j = (i + 1) & mask; slots_[j].value; j = (j + 1) & mask)
+      {
+        size_t home = mix(slots_[j].key) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+          slots_[i] = std::move(slots_[j]);
+          i = j;
+        }
+      }
+    }
+
+    size_t size() const
+    {
+      return size_;
+    }
+   private:
+    struct Slot
+    {
+      size_t key = 0;
+      std::unique_ptr< T > value;
+    };
+
+    std::vector< Slot > slots_;
+    size_t size_ = 0;
+
+    void grow()
+    {
+      std::vector< Slot > old(std::max< size_t >(slots_.size() * 2, 16));
+      old.swap(slots_);
+      size_t mask = slots_.size() - 1;
+      for (Slot& slot : old)
+      {
+        if (slot.value)
+        {
+          size_t i = mix(slot.key) & mask;
+          for (; slots_[i].value; i = (i + 1) & mask)
+          {}
+          slots_[i] = std::move(slot);
+        }
+      }
+    }
+  };
+
+  template< class Values >
+  void reserveFor(Values& values, size_t id)
+  {
+    if (values.size() <= id)
+    {
+      // All states usually exist at this moment, so the array is allocated once
+      values.resize(std::max(states::State::count(), id + 1));
+    }
   }
 }
 
-void states::StateMachine::setState(size_t chatId, const State& state) const
+boost::any& states::StateData::operator[](const State& state)
 {
-  storage_->currentStates_[chatId] = state;
+  reserveFor(values_, state.id());
+  return values_[state.id()];
 }
 
-const states::State states::StateMachine::DEFAULT_STATE = {};
+boost::any& states::StateData::at(const State& state)
+{
+  return const_cast< boost::any& >(static_cast< const StateData& >(*this).at(state));
+}
 
-states::Storage::Storage():
-  currentStates_(),
-  data_()
-{}
+const boost::any& states::StateData::at(const State& state) const
+{
+  if ((state.id() >= values_.size()) || values_[state.id()].empty())
+  {
+    throw std::out_of_range("No data of the state");
+  }
+  return values_[state.id()];
+}
+
+states::StateData::iterator states::StateData::find(const State& state)
+{
+  return (count(state) != 0) ? iterator(values_.data(), state.id(), values_.size()) : end();
+}
+
+states::StateData::const_iterator states::StateData::find(const State& state) const
+{
+  return (count(state) != 0) ? const_iterator(values_.data(), state.id(), values_.size()) : end();
+}
+
+size_t states::StateData::count(const State& state) const
+{
+  return ((state.id() < values_.size()) && !values_[state.id()].empty()) ? 1 : 0;
+}
+
+void states::StateData::erase(const State& state)
+{
+  if (state.id() < values_.size())
+  {
+    values_[state.id()] = boost::any();
+  }
+}
+
+void states::StateData::clear()
+{
+  values_.clear();
+}
+
+size_t states::StateData::size() const
+{
+  return std::count_if(values_.cbegin(), values_.cend(), [](const boost::any& value)
+  {
+    return !value.empty();
+  });
+}
+
+bool states::StateData::empty() const
+{
+  return size() == 0;
+}
+
+states::StateData::iterator states::StateData::begin()
+{
+  return iterator(values_.data(), 0, values_.size());
+}
+
+states::StateData::iterator states::StateData::end()
+{
+  return iterator(values_.data(), values_.size(), values_.size());
+}
+
+states::StateData::const_iterator states::StateData::begin() const
+{
+  return const_iterator(values_.data(), 0, values_.size());
+}
+
+states::StateData::const_iterator states::StateData::end() const
+{
+  return const_iterator(values_.data(), values_.size(), values_.size());
+}
+
+struct states::Storage::Session
+{
+  size_t chatId;
+  State state;
+  StatesForm::Data data;
+  std::vector< Value > values; ///< Values of fields indexed by number of the state
+  std::atomic< duration_t::rep > lastAccess; ///< Updated by readers without exclusive lock
+  duration_t::rep queuedAt; ///< Time of moving to the front of the access order
+  Session* newer;
+  Session* older;
+
+  explicit Session(size_t id):
+    chatId(id),
+    state(StateMachine::DEFAULT_STATE),
+    data(),
+    values(),
+    lastAccess(0),
+    queuedAt(0),
+    newer(nullptr),
+    older(nullptr)
+  {}
+};
+
+struct states::Storage::Shard
+{
+  mutable std::shared_mutex mutex;
+  FlatTable< Session > sessions;
+  Session* newest = nullptr; ///< Sessions are linked in order of access
+  Session* oldest = nullptr;
+
+  void pushFront(Session& session)
+  {
+    session.newer = nullptr;
+    session.older = newest;
+    (newest ? newest->newer : oldest) = &session;
+    newest = &session;
+  }
+
+  void unlink(Session& session)
+  {
+    (session.newer ? session.newer->older : newest) = session.older;
+    (session.older ? session.older->newer : oldest) = session.newer;
+  }
+};
+
+states::Storage::Storage(size_t shards):
+  shards_(),
+  shardMask_(1),
+  ttl_(0),
+  maxChatsPerShard_(0),
+  evictionHandler_()
+{
+  while (shardMask_ < shards)
+  {
+    shardMask_ <<= 1;
+  }
+  shards_ = std::make_unique< Shard[] >(shardMask_);
+  --shardMask_;
+}
+
+states::Storage::~Storage() = default;
+
+states::State states::Storage::state(size_t chatId) const
+{
+  Shard& shard = shardOf(chatId);
+  std::shared_lock< std::shared_mutex > lock(shard.mutex);
+  Session* session = find(shard, chatId, now());
+  return session ? session->state : states::StateMachine::DEFAULT_STATE;
+}
+
+void states::Storage::setState(size_t chatId, const State& state)
+{
+  std::vector< size_t > evictedChats;
+  {
+    Shard& shard = shardOf(chatId);
+    std::unique_lock< std::shared_mutex > lock(shard.mutex);
+    acquire(shard, chatId, evictedChats).state = state;
+  }
+  notifyEvicted(evictedChats);
+}
 
 boost::any& states::Storage::data(size_t chatId, const states::State& state)
 {
-  return data_[chatId][state];
+  StatesForm::Data& chatData = data(chatId);
+  Shard& shard = shardOf(chatId);
+  {
+    std::shared_lock< std::shared_mutex > lock(shard.mutex);
+    auto it = chatData.find(state);
+    if (it != chatData.end())
+    {
+      return it->second;
+    }
+  }
+  std::unique_lock< std::shared_mutex > lock(shard.mutex);
+  return chatData[state];
 }
 
 states::StatesForm::Data& states::Storage::data(size_t chatId)
 {
-  return data_[chatId];
+  Shard& shard = shardOf(chatId);
+  {
+    std::shared_lock< std::shared_mutex > lock(shard.mutex);
+    if (Session* session = find(shard, chatId, now()))
+    {
+      return session->data;
+    }
+  }
+  std::vector< size_t > evictedChats;
+  StatesForm::Data* chatData = nullptr;
+  {
+    std::unique_lock< std::shared_mutex > lock(shard.mutex);
+    chatData = &acquire(shard, chatId, evictedChats).data;
+  }
+  notifyEvicted(evictedChats);
+  return *chatData;
+}
+
+states::Value& states::Storage::value(size_t chatId, const State& state)
+{
+  Shard& shard = shardOf(chatId);
+  {
+    std::shared_lock< std::shared_mutex > lock(shard.mutex);
+    Session* session = find(shard, chatId, now());
+    if (session && (state.id() < session->values.size()))
+    {
+      return session->values[state.id()];
+    }
+  }
+  std::vector< size_t > evictedChats;
+  Value* result = nullptr;
+  {
+    std::unique_lock< std::shared_mutex > lock(shard.mutex);
+    std::vector< Value >& values = acquire(shard, chatId, evictedChats).values;
+    reserveFor(values, state.id());
+    result = &values[state.id()];
+  }
+  notifyEvicted(evictedChats);
+  return *result;
 }
 
 void states::Storage::remove(size_t chatId)
 {
-  data_[chatId].clear();
+  Shard& shard = shardOf(chatId);
+  std::unique_lock< std::shared_mutex > lock(shard.mutex);
+  if (Session* session = shard.sessions.find(chatId))
+  {
+    erase(shard, *session);
+  }
+}
+
+void states::Storage::commit(size_t)
+{}
+
+void states::Storage::setExpiration(duration_t ttl)
+{
+  ttl_ = ttl.count();
+}
+
+void states::Storage::setMaxChats(size_t maxChats)
+{
+  maxChatsPerShard_ = (maxChats == 0) ? 0 : std::max< size_t >((maxChats + shardMask_) / (shardMask_ + 1), 1);
+}
+
+void states::Storage::setEvictionHandler(eviction_handler_t handler)
+{
+  evictionHandler_ = handler;
+}
+
+void states::Storage::expire()
+{
+  std::vector< size_t > evictedChats;
+  for (size_t i = 0; i <= shardMask_; ++i)
+  {
+    std::unique_lock< std::shared_mutex > lock(shards_[i].mutex);
+    expire(shards_[i], now(), evictedChats);
+  }
+  notifyEvicted(evictedChats);
+}
+
+void states::Storage::evicted(size_t chatId)
+{
+  if (evictionHandler_)
+  {
+    evictionHandler_(chatId);
+  }
+}
+
+void states::Storage::forEachValue(size_t chatId, const std::function< void(size_t, const Value&) >& visit) const
+{
+  Shard& shard = shardOf(chatId);
+  std::shared_lock< std::shared_mutex > lock(shard.mutex);
+  Session* session = shard.sessions.find(chatId);
+  if (!session)
+  {
+    return;
+  }
+  for (size_t i = 0; i < session->values.size(); ++i)
+  {
+    if (!session->values[i].empty())
+    {
+      visit(i, session->values[i]);
+    }
+  }
+}
+
+void states::Storage::refresh(size_t chatId)
+{
+  std::vector< size_t > evictedChats;
+  {
+    Shard& shard = shardOf(chatId);
+    std::unique_lock< std::shared_mutex > lock(shard.mutex);
+    Session* session = shard.sessions.find(chatId);
+    duration_t::rep time = now();
+    if (session && isExpired(*session, time))
+    {
+      evictedChats.push_back(chatId);
+      erase(shard, *session);
+    }
+    else if (session)
+    {
+      session->lastAccess.store(time, std::memory_order_relaxed);
+    }
+  }
+  notifyEvicted(evictedChats);
+}
+
+void states::Storage::reset(size_t chatId)
+{
+  Shard& shard = shardOf(chatId);
+  std::unique_lock< std::shared_mutex > lock(shard.mutex);
+  if (Session* session = shard.sessions.find(chatId))
+  {
+    session->state = StateMachine::DEFAULT_STATE;
+    session->data.clear();
+    for (Value& value : session->values)
+    {
+      value.reset();
+    }
+  }
+}
+
+size_t states::Storage::shardIndex(size_t chatId) const
+{
+  // Fibonacci hashing spreads sequential ids among shards
+  uint64_t h = static_cast< uint64_t >(chatId) * 11400714819323198485ULL;
+  return static_cast< size_t >((h >> 32) & shardMask_);
+}
+
+states::Storage::Shard& states::Storage::shardOf(size_t chatId) const
+{
+  return shards_[shardIndex(chatId)];
+}
+
+bool states::Storage::isExpired(const Session& session, duration_t::rep time) const
+{
+  return (ttl_ != 0) && (time - session.lastAccess.load(std::memory_order_relaxed) >= ttl_);
+}
+
+states::Storage::Session* states::Storage::find(const Shard& shard, size_t chatId, duration_t::rep time) const
+{
+  Session* session = shard.sessions.find(chatId);
+  if (!session || isExpired(*session, time))
+  {
+    return nullptr;
+  }
+  session->lastAccess.store(time, std::memory_order_relaxed);
+  return session;
+}
+
+states::Storage::Session& states::Storage::acquire(Shard& shard, size_t chatId, std::vector< size_t >& evictedChats)
+{
+  duration_t::rep time = now();
+  expire(shard, time, evictedChats);
+  Session* existing = shard.sessions.find(chatId);
+  if (existing && isExpired(*existing, time))
+  {
+    // Sweeping stops at recently queued sessions, so an expired one can still be here
+    evictedChats.push_back(chatId);
+    erase(shard, *existing);
+  }
+  std::pair< Session*, bool > inserted = shard.sessions.insert(chatId);
+  Session& session = *inserted.first;
+  session.lastAccess.store(time, std::memory_order_relaxed);
+  if (!inserted.second)
+  {
+    return session;
+  }
+  shard.pushFront(session);
+  session.queuedAt = time;
+  // Sessions accessed after queuing get a second chance instead of moving them on every read
+  while ((maxChatsPerShard_ != 0) && (shard.sessions.size() > maxChatsPerShard_))
+  {
+    Session& oldest = *shard.oldest;
+    if ((&oldest == &session) || (oldest.lastAccess.load(std::memory_order_relaxed) > oldest.queuedAt))
+    {
+      oldest.queuedAt = time;
+      shard.unlink(oldest);
+      shard.pushFront(oldest);
+    }
+    else
+    {
+      evictedChats.push_back(oldest.chatId);
+      erase(shard, oldest);
+    }
+  }
+  return session;
+}
+
+void states::Storage::expire(Shard& shard, duration_t::rep time, std::vector< size_t >& evictedChats)
+{
+  // Sessions are ordered by queuing time, so checking stops at the first session queued recently
+  while ((ttl_ != 0) && shard.oldest && (time - shard.oldest->queuedAt >= ttl_))
+  {
+    Session& oldest = *shard.oldest;
+    if (isExpired(oldest, time))
+    {
+      evictedChats.push_back(oldest.chatId);
+      erase(shard, oldest);
+    }
+    else
+    {
+      oldest.queuedAt = time;
+      shard.unlink(oldest);
+      shard.pushFront(oldest);
+    }
+  }
+}
+
+void states::Storage::erase(Shard& shard, Session& session)
+{
+  shard.unlink(session);
+  shard.sessions.erase(session.chatId);
+}
+
+void states::Storage::notifyEvicted(const std::vector< size_t >& evictedChats)
+{
+  for (size_t chatId : evictedChats)
+  {
+    evicted(chatId);
+  }
 }
 
 states::StateContext::StateContext(size_t chatId, states::StateMachine* stateMachine):
@@ -70,12 +634,12 @@ states::State states::StateContext::current()
 
 void states::StateContext::setState(const states::State& state) const
 {
-  stateMachine_->storage_->currentStates_[chatId_] = state;
+  stateMachine_->setState(chatId_, state);
 }
 
 void states::StateContext::resetState()
 {
-  stateMachine_->storage_->currentStates_[chatId_] = states::StateMachine::DEFAULT_STATE;
+  stateMachine_->setState(chatId_, states::StateMachine::DEFAULT_STATE);
 }
 
 states::StatesForm::Data& states::StateContext::data()
@@ -87,3 +651,8 @@ boost::any& states::StateContext::data(const states::State& state)
 {
   return stateMachine_->storage_->data(chatId_, state);
 }
+
+states::Value& states::StateContext::value(const states::State& state)
+{
+  return stateMachine_->storage_->value(chatId_, state);
+}
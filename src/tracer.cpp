@@ -0,0 +1,189 @@
+#include "cppbot/tracer.hpp"
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <thread>
+#include <nlohmann/json.hpp>
+
+namespace
+{
+  thread_local cppbot::Tracer::Context currentContext;
+
+  uint64_t mix(uint64_t value)
+  {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+  }
+
+  uint32_t threadNumber()
+  {
+    static std::atomic< uint32_t > nextNumber(1);
+    thread_local uint32_t number = nextNumber.fetch_add(1, std::memory_order_relaxed);
+    return number;
+  }
+
+  int64_t microseconds(std::chrono::steady_clock::duration duration)
+  {
+    return std::chrono::duration_cast< std::chrono::microseconds >(duration).count();
+  }
+
+  class SlotLock
+  {
+   public:
+    explicit SlotLock(std::atomic< bool >& isBusy):
+      isBusy_(isBusy)
+    {
+      // Slot is shared only when the ring wraps around during writing, so waiting is very rare
+      while (isBusy_.exchange(true, std::memory_order_acquire))
+      {
+        std::this_thread::yield();
+      }
+    }
+
+    ~SlotLock()
+    {
+      isBusy_.store(false, std::memory_order_release);
+    }
+   private:
+    std::atomic< bool >& isBusy_;
+  };
+}
+
+void cppbot::Tracer::Context::record(const char* category, const char* name, const std::string& detail,
+  clock_t::time_point start) const
+{
+  if (tracer)
+  {
+    tracer->record(traceId, category, name, detail, start, clock_t::now());
+  }
+}
+
+cppbot::Tracer::Scope::Scope(Context context):
+  previous_(std::move(currentContext))
+{
+  currentContext = std::move(context);
+}
+
+cppbot::Tracer::Scope::~Scope()
+{
+  currentContext = std::move(previous_);
+}
+
+cppbot::Tracer::Tracer(double sampleRate, size_t capacity):
+  threshold_(0),
+  origin_(clock_t::now()),
+  slots_(std::make_unique< Slot[] >(std::max< size_t >(capacity, 1))),
+  capacity_(std::max< size_t >(capacity, 1)),
+  next_(0)
+{
+  if (sampleRate >= 1.0)
+  {
+    threshold_ = std::numeric_limits< uint64_t >::max();
+  }
+  else if (sampleRate > 0.0)
+  {
+    threshold_ = static_cast< uint64_t >(sampleRate * static_cast< double >(std::numeric_limits< uint64_t >::max()));
+  }
+  for (size_t i = 0; i < capacity_; ++i)
+  {
+    slots_[i].isBusy.store(false, std::memory_order_relaxed);
+    slots_[i].isSet = false;
+  }
+}
+
+const cppbot::Tracer::Context& cppbot::Tracer::current()
+{
+  return currentContext;
+}
+
+cppbot::Tracer::Context cppbot::Tracer::start(const std::shared_ptr< Tracer >& tracer, uint64_t traceId)
+{
+  if (!tracer || !tracer->isSampled(traceId))
+  {
+    return {};
+  }
+  return {tracer, traceId};
+}
+
+bool cppbot::Tracer::isSampled(uint64_t traceId) const
+{
+  return (threshold_ == std::numeric_limits< uint64_t >::max()) || (mix(traceId) < threshold_);
+}
+
+void cppbot::Tracer::record(uint64_t traceId, const char* category, const char* name, const std::string& detail,
+  clock_t::time_point start, clock_t::time_point end)
+{
+  Slot& slot = slots_[next_.fetch_add(1, std::memory_order_relaxed) % capacity_];
+  SlotLock lock(slot.isBusy);
+  slot.isSet = true;
+  slot.span.traceId = traceId;
+  // Strings of the slot keep their capacity, so short names don't allocate
+  slot.span.category = category;
+  slot.span.name = name;
+  slot.span.detail = detail;
+  slot.span.start = start;
+  slot.span.duration = end - start;
+  slot.span.thread = threadNumber();
+}
+
+std::vector< cppbot::Tracer::Span > cppbot::Tracer::spans() const
+{
+  std::vector< Span > result;
+  size_t first = next_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < capacity_; ++i)
+  {
+    const Slot& slot = slots_[(first + i) % capacity_];
+    SlotLock lock(slot.isBusy);
+    if (slot.isSet)
+    {
+      result.push_back(slot.span);
+    }
+  }
+  return result;
+}
+
+std::string cppbot::Tracer::chromeTrace() const
+{
+  nlohmann::json events = nlohmann::json::array();
+  std::set< uint64_t > traces;
+  for (const Span& span : spans())
+  {
+    events.push_back({
+      {"name", span.name},
+      {"cat", span.category},
+      {"ph", "X"},
+      {"ts", microseconds(span.start - origin_)},
+      {"dur", microseconds(span.duration)},
+      {"pid", 1},
+      {"tid", span.traceId},
+      {"args", {{"update_id", span.traceId}, {"detail", span.detail}, {"thread", span.thread}}}
+    });
+    traces.insert(span.traceId);
+  }
+  for (uint64_t traceId : traces)
+  {
+    events.push_back({
+      {"name", "thread_name"},
+      {"ph", "M"},
+      {"pid", 1},
+      {"tid", traceId},
+      {"args", {{"name", "update " + std::to_string(traceId)}}}
+    });
+  }
+  nlohmann::json trace = {
+    {"traceEvents", events},
+    {"displayTimeUnit", "ms"}
+  };
+  return trace.dump();
+}
+
+void cppbot::Tracer::clear()
+{
+  for (size_t i = 0; i < capacity_; ++i)
+  {
+    SlotLock lock(slots_[i].isBusy);
+    slots_[i].isSet = false;
+  }
+}
@@ -1,6 +1,9 @@
 #include "cppbot/types.hpp"
 #include <fstream>
+#include <filesystem>
 #include <exception>
+#include <memory>
+#include <stdexcept>
 
 using json = nlohmann::json;
 
@@ -215,7 +218,7 @@ void types::from_json(const json& j, types::Message& msg)
   }
   if (j.contains("document"))
   {
-    from_json(j, msg.document);
+    from_json(j.at("document"), msg.document);
   }
   if (j.contains("audio"))
   {
@@ -231,6 +234,11 @@ void types::from_json(const json& j, types::Message& msg)
   }
 }
 
+void types::from_json(const json& j, types::MessageId& messageId)
+{
+  j.at("message_id").get_to(messageId.id);
+}
+
 // CallbackQuery
 void types::to_json(json& j, const types::CallbackQuery& query)
 {
@@ -277,16 +285,60 @@ types::InputFile::InputFile(const std::string& path)
     throw std::runtime_error("Cannot open file: " + path);
   }
   file.close();
+  source_ = PATH;
   path_ = path;
+  name_ = extractFileName(path);
+}
+
+types::InputFile::InputFile(const std::string& name, std::string content):
+  types::InputFile(name, std::make_shared< const std::string >(std::move(content)))
+{}
+
+types::InputFile::InputFile(const std::string& name, buffer_t content)
+{
+  if (!content)
+  {
+    throw std::invalid_argument("File content is null: " + name);
+  }
+  source_ = BUFFER;
+  name_ = name;
+  buffer_ = content;
+  size_ = content->size();
+}
+
+types::InputFile::InputFile(const std::string& name, generator_t generator, size_t size)
+{
+  if (!generator)
+  {
+    throw std::invalid_argument("File generator is empty: " + name);
+  }
+  source_ = GENERATOR;
+  name_ = name;
+  generator_ = generator;
+  size_ = size;
 }
 
 std::string types::InputFile::name() const
 {
-  return extractFileName(path_);
+  return name_;
 }
 
 std::string types::InputFile::bytes() const
 {
+  if (source_ == BUFFER)
+  {
+    return *buffer_;
+  }
+  if (source_ == GENERATOR)
+  {
+    std::string content;
+    char chunk[16 * 1024];
+    for (size_t n = generator_(chunk, sizeof(chunk)); n != 0; n = generator_(chunk, sizeof(chunk)))
+    {
+      content.append(chunk, n);
+    }
+    return content;
+  }
   std::ifstream file(path_, std::ios::binary);
   if (!file)
   {
@@ -295,7 +347,46 @@ std::string types::InputFile::bytes() const
   return std::string(std::istreambuf_iterator< char >(file), std::istreambuf_iterator< char >());;
 }
 
-types::InputMedia::InputMedia(types::MediaType mediaType, const std::string& path, const std::string& caption)
+std::string types::InputFile::path() const
+{
+  return path_;
+}
+
+size_t types::InputFile::size() const
+{
+  if (source_ != PATH)
+  {
+    return size_;
+  }
+  std::error_code ec;
+  std::uintmax_t fileSize = std::filesystem::file_size(path_, ec);
+  if (ec)
+  {
+    throw std::runtime_error("Cannot get size of file: " + path_);
+  }
+  return static_cast< size_t >(fileSize);
+}
+
+types::InputFile::Source types::InputFile::source() const
+{
+  return source_;
+}
+
+types::InputFile::buffer_t types::InputFile::buffer() const
+{
+  return buffer_;
+}
+
+types::InputFile::generator_t types::InputFile::generator() const
+{
+  return generator_;
+}
+
+types::InputMedia::InputMedia(types::MediaType mediaType, const std::string& path, const std::string& caption):
+  types::InputMedia(mediaType, types::InputFile(path), caption)
+{}
+
+types::InputMedia::InputMedia(types::MediaType mediaType, const types::InputFile& file, const std::string& caption)
 {
   switch (mediaType)
   {
@@ -312,7 +403,7 @@ types::InputMedia::InputMedia(types::MediaType mediaType, const std::string& pat
     type_ = "video";
     break;
   }
-  file_ = types::InputFile(path);
+  file_ = file;
   this->caption = caption;
   hasSpoiler_ = false;
 }
@@ -347,30 +438,58 @@ types::InputMediaPhoto::InputMediaPhoto(const std::string& path):
   types::InputMedia(types::MediaType::PHOTO, path)
 {}
 
+types::InputMediaPhoto::InputMediaPhoto(const types::InputFile& file):
+  types::InputMedia(types::MediaType::PHOTO, file)
+{}
+
 types::InputMediaPhoto::InputMediaPhoto(const std::string& path, bool hasSpoiler):
   types::InputMediaPhoto(path)
 {
   hasSpoiler_ = hasSpoiler;
 }
 
+types::InputMediaPhoto::InputMediaPhoto(const types::InputFile& file, bool hasSpoiler):
+  types::InputMediaPhoto(file)
+{
+  hasSpoiler_ = hasSpoiler;
+}
+
 types::InputMediaDocument::InputMediaDocument(const std::string& path):
   types::InputMedia(types::MediaType::DOCUMENT, path)
 {}
 
+types::InputMediaDocument::InputMediaDocument(const types::InputFile& file):
+  types::InputMedia(types::MediaType::DOCUMENT, file)
+{}
+
 types::InputMediaAudio::InputMediaAudio(const std::string& path):
   types::InputMedia(types::MediaType::AUDIO, path)
 {}
 
+types::InputMediaAudio::InputMediaAudio(const types::InputFile& file):
+  types::InputMedia(types::MediaType::AUDIO, file)
+{}
+
 types::InputMediaVideo::InputMediaVideo(const std::string& path):
   types::InputMedia(types::MediaType::VIDEO, path)
 {}
 
+types::InputMediaVideo::InputMediaVideo(const types::InputFile& file):
+  types::InputMedia(types::MediaType::VIDEO, file)
+{}
+
 types::InputMediaVideo::InputMediaVideo(const std::string& path, bool hasSpoiler):
   types::InputMediaVideo(path)
 {
   hasSpoiler_ = hasSpoiler;
 }
 
+types::InputMediaVideo::InputMediaVideo(const types::InputFile& file, bool hasSpoiler):
+  types::InputMediaVideo(file)
+{
+  hasSpoiler_ = hasSpoiler;
+}
+
 // File types
 void types::from_json(const json& j, types::File& file)
 {
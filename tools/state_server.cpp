@@ -0,0 +1,36 @@
+#include <csignal>
+#include <exception>
+#include <iostream>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/signal_set.hpp>
+#include "cppbot/state_server.hpp"
+
+// Server keeping states of chats for bots using states::RemoteStorage.
+// Usage: cppbot-state-server tcp://0.0.0.0:7070
+//        cppbot-state-server unix:///tmp/cppbot-states.sock
+
+int main(int argc, char* argv[])
+{
+  if (argc != 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " tcp://host:port | unix:///path/to/socket\n";
+    return 1;
+  }
+  try
+  {
+    boost::asio::io_context ioContext;
+    states::StateServer server(ioContext, argv[1]);
+    boost::asio::signal_set signals(ioContext, SIGINT, SIGTERM);
+    signals.async_wait([&ioContext](const boost::system::error_code&, int)
+    {
+      ioContext.stop();
+    });
+    ioContext.run();
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}